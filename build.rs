@@ -12,6 +12,13 @@ const PATH_PREFIX: &str = "specs/cells/";
 const BUF_SIZE: usize = 8 * 1024;
 const CKB_HASH_PERSONALIZATION: &[u8] = b"ckb-default-hash";
 
+// With the uncompressed feature, the binaries are served straight from the
+// executable image instead of being gunzipped into a heap copy on every read.
+#[cfg(feature = "uncompressed")]
+const COMPRESSION: Compression = Compression::None;
+#[cfg(not(feature = "uncompressed"))]
+const COMPRESSION: Compression = Compression::Gzip;
+
 const BINARIES: &[(&str, &str)] = &[
     (
         "secp256k1_blake160_sighash_all",
@@ -44,7 +51,7 @@ fn main() {
 
         let mut buf = [0u8; BUF_SIZE];
         bundled
-            .add_file(&path, Compression::Gzip)
+            .add_file(&path, COMPRESSION)
             .expect("add files to resource bundle");
 
         // build hash
@@ -0,0 +1,84 @@
+/*
+arena.h
+
+A static bump allocator for the large buffers used by scripts. Buffers are
+allocated on top of each other, and released back to a previously taken
+mark, so buffers whose lifetimes don't overlap share the same memory. Since
+all the memory comes from one static region, the memory a script needs for
+its buffers is fixed at build time by CKB_ARENA_SIZE.
+
+When compiled with CKB_ARENA_REPORT defined, every new peak of arena usage
+is printed with ckb_debug, the last printed line is the peak of the script
+run.
+*/
+
+#ifndef CKB_ARENA_H_
+#define CKB_ARENA_H_
+
+#include "ckb_syscalls.h"
+
+#define CKB_ARENA_ERROR_EXHAUSTED -111
+
+/* Scripts can define their own arena size before including this header */
+#ifndef CKB_ARENA_SIZE
+#define CKB_ARENA_SIZE 65536
+#endif
+
+#define CKB_ARENA_ALIGNMENT 16
+
+static uint8_t ckb_arena_buffer[CKB_ARENA_SIZE]
+    __attribute__((aligned(CKB_ARENA_ALIGNMENT)));
+static size_t ckb_arena_used = 0;
+static size_t ckb_arena_peak = 0;
+
+#ifdef CKB_ARENA_REPORT
+static void ckb_arena_report() {
+  char message[64] = "arena peak: ";
+  char digits[20];
+  size_t n = 0;
+  size_t value = ckb_arena_peak;
+  do {
+    digits[n++] = '0' + (value % 10);
+    value /= 10;
+  } while (value > 0);
+  size_t pos = sizeof("arena peak: ") - 1;
+  while (n > 0) {
+    message[pos++] = digits[--n];
+  }
+  message[pos] = '\0';
+  ckb_debug(message);
+}
+#endif
+
+/*
+ * Returns a buffer of at least size bytes, or NULL when the arena doesn't
+ * have enough memory left.
+ */
+void *ckb_arena_alloc(size_t size) {
+  size_t aligned =
+      (size + CKB_ARENA_ALIGNMENT - 1) & ~((size_t)CKB_ARENA_ALIGNMENT - 1);
+  if (aligned < size || aligned > CKB_ARENA_SIZE - ckb_arena_used) {
+    return NULL;
+  }
+  void *p = &ckb_arena_buffer[ckb_arena_used];
+  ckb_arena_used += aligned;
+  if (ckb_arena_used > ckb_arena_peak) {
+    ckb_arena_peak = ckb_arena_used;
+#ifdef CKB_ARENA_REPORT
+    ckb_arena_report();
+#endif
+  }
+  return p;
+}
+
+/* Takes a mark, which can later be used to release all buffers allocated
+ after it */
+size_t ckb_arena_mark() { return ckb_arena_used; }
+
+void ckb_arena_release(size_t mark) {
+  if (mark < ckb_arena_used) {
+    ckb_arena_used = mark;
+  }
+}
+
+#endif /* CKB_ARENA_H_ */
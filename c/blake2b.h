@@ -175,6 +175,9 @@ static BLAKE2_INLINE void secure_zero_memory(void *v, size_t n)
 #endif
 
 // blake2b-ref.c
+#ifndef BLAKE2B_REF_C
+#define BLAKE2B_REF_C
+
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
@@ -254,12 +257,33 @@ int blake2b_init_param( blake2b_state *S, const blake2b_param *P )
 
 
 const char *DEFAULT_PERSONAL = "ckb-default-hash";
+
+/* blake2b_IV XORed with the parameter block blake2b_init builds for 32-byte
+   outputs, which carries the ckb-default-hash personalization. */
+#define BLAKE2B_CKB_HASH_BYTES 32
+static const uint64_t blake2b_ckb_default_IV[8] =
+{
+  0x6a09e667f2bdc928ULL, 0xbb67ae8584caa73bULL,
+  0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+  0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+  0x7ee5bccfd623d608ULL, 0x3393ac713e0a4d0cULL
+};
+
 int blake2b_init( blake2b_state *S, size_t outlen )
 {
   blake2b_param P[1];
 
   if ( ( !outlen ) || ( outlen > BLAKE2B_OUTBYTES ) ) return -1;
 
+  /* the hash size used all over CKB, skip building the parameter block */
+  if ( outlen == BLAKE2B_CKB_HASH_BYTES )
+  {
+    memset( S, 0, sizeof( blake2b_state ) );
+    memcpy( S->h, blake2b_ckb_default_IV, sizeof( S->h ) );
+    S->outlen = outlen;
+    return 0;
+  }
+
   P->digest_length = (uint8_t)outlen;
   P->key_length    = 0;
   P->fanout        = 1;
@@ -336,7 +360,7 @@ int blake2b_init_key( blake2b_state *S, size_t outlen, const void *key, size_t k
     G(r,7,v[ 3],v[ 4],v[ 9],v[14]); \
   } while(0)
 
-static void blake2b_compress( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
+static void blake2b_compress_ref( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
 {
   uint64_t m[16];
   uint64_t v[16];
@@ -380,6 +404,18 @@ static void blake2b_compress( blake2b_state *S, const uint8_t block[BLAKE2B_BLOC
 #undef G
 #undef ROUND
 
+#include "blake2b_compress_unrolled.h"
+
+/* The unrolled version is used by default on RISC-V64, define
+   BLAKE2B_COMPRESS_REF to use the reference version instead, or
+   BLAKE2B_COMPRESS_UNROLLED to use the unrolled version on other targets. */
+#if (defined(__riscv) && __riscv_xlen == 64 && !defined(BLAKE2B_COMPRESS_REF)) || \
+    defined(BLAKE2B_COMPRESS_UNROLLED)
+#define blake2b_compress blake2b_compress_unrolled
+#else
+#define blake2b_compress blake2b_compress_ref
+#endif
+
 int blake2b_update( blake2b_state *S, const void *pin, size_t inlen )
 {
   const unsigned char * in = (const unsigned char *)pin;
@@ -431,6 +467,31 @@ int blake2b_final( blake2b_state *S, void *out, size_t outlen )
   return 0;
 }
 
+/* One-shot 32-byte ckb-default-hash for inputs of at most one block, such as
+   public keys and small multisig scripts. The input is compressed as the only
+   and last block directly, without the buffering of blake2b_update and
+   blake2b_final. Returns -1 for larger inputs. */
+int blake2b_ckb_hash_block( void *out, const void *in, size_t inlen )
+{
+  blake2b_state S[1];
+  size_t i;
+
+  if( inlen > BLAKE2B_BLOCKBYTES ) return -1;
+
+  memcpy( S->h, blake2b_ckb_default_IV, sizeof( S->h ) );
+  S->t[0] = inlen;
+  S->t[1] = 0;
+  S->f[0] = (uint64_t)-1;
+  S->f[1] = 0;
+  memcpy( S->buf, in, inlen );
+  memset( S->buf + inlen, 0, BLAKE2B_BLOCKBYTES - inlen ); /* Padding */
+  blake2b_compress( S, S->buf );
+
+  for( i = 0; i < BLAKE2B_CKB_HASH_BYTES / sizeof( S->h[i] ); ++i )
+    store64( ( uint8_t * )out + sizeof( S->h[i] ) * i, S->h[i] );
+  return 0;
+}
+
 /* inlen, at least, should be uint64_t. Others can be size_t. */
 int blake2b( void *out, size_t outlen, const void *in, size_t inlen, const void *key, size_t keylen )
 {
@@ -540,3 +601,4 @@ fail:
 }
 #endif
 
+#endif /* BLAKE2B_REF_C */
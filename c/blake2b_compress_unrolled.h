@@ -0,0 +1,144 @@
+/*
+blake2b_compress_unrolled.h
+
+An unrolled version of blake2b_compress from the reference code, included by
+blake2b.h. The message schedule of each round is fixed at compile time, so
+message words and the working vector are plain local variables instead of
+arrays indexed through blake2b_sigma, which lets the compiler keep them in
+registers. On RISC-V64 each message word is read with a single ld, and
+rotations become rori when the bitmanip extension is enabled.
+
+The reference function stays available as blake2b_compress_ref, run
+`make check-blake2b` to compare both on random inputs.
+*/
+
+#ifndef BLAKE2B_COMPRESS_UNROLLED_H
+#define BLAKE2B_COMPRESS_UNROLLED_H
+
+#if defined(__riscv) && __riscv_xlen == 64
+/* CKB-VM is little endian and allows misaligned loads */
+#define BLAKE2B_UNROLLED_LOAD64(p)                                 \
+  ({                                                               \
+    uint64_t w_;                                                   \
+    __asm__("ld %0, %1" : "=r"(w_) : "m"(*(const uint64_t *)(p))); \
+    w_;                                                            \
+  })
+#else
+#define BLAKE2B_UNROLLED_LOAD64(p) load64(p)
+#endif
+
+#if defined(__riscv) && __riscv_xlen == 64 && \
+    (defined(__riscv_zbb) || defined(__riscv_bitmanip))
+#define BLAKE2B_UNROLLED_ROTR64(w, c)                       \
+  ({                                                        \
+    uint64_t r_;                                            \
+    __asm__("rori %0, %1, %2" : "=r"(r_) : "r"(w), "i"(c)); \
+    r_;                                                     \
+  })
+#else
+#define BLAKE2B_UNROLLED_ROTR64(w, c) (((w) >> (c)) | ((w) << (64 - (c))))
+#endif
+
+#define BLAKE2B_UNROLLED_G(a, b, c, d, x, y) \
+  do {                                       \
+    a = a + b + x;                           \
+    d = BLAKE2B_UNROLLED_ROTR64(d ^ a, 32);  \
+    c = c + d;                               \
+    b = BLAKE2B_UNROLLED_ROTR64(b ^ c, 24);  \
+    a = a + b + y;                           \
+    d = BLAKE2B_UNROLLED_ROTR64(d ^ a, 16);  \
+    c = c + d;                               \
+    b = BLAKE2B_UNROLLED_ROTR64(b ^ c, 63);  \
+  } while (0)
+
+/* the arguments are the message words of one round, in blake2b_sigma order */
+#define BLAKE2B_UNROLLED_ROUND(s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, \
+                               s11, s12, s13, s14, s15)                     \
+  do {                                                                      \
+    BLAKE2B_UNROLLED_G(v0, v4, v8, v12, s0, s1);                            \
+    BLAKE2B_UNROLLED_G(v1, v5, v9, v13, s2, s3);                            \
+    BLAKE2B_UNROLLED_G(v2, v6, v10, v14, s4, s5);                           \
+    BLAKE2B_UNROLLED_G(v3, v7, v11, v15, s6, s7);                           \
+    BLAKE2B_UNROLLED_G(v0, v5, v10, v15, s8, s9);                           \
+    BLAKE2B_UNROLLED_G(v1, v6, v11, v12, s10, s11);                         \
+    BLAKE2B_UNROLLED_G(v2, v7, v8, v13, s12, s13);                          \
+    BLAKE2B_UNROLLED_G(v3, v4, v9, v14, s14, s15);                          \
+  } while (0)
+
+static void blake2b_compress_unrolled(blake2b_state *S,
+                                      const uint8_t block[BLAKE2B_BLOCKBYTES]) {
+  const uint64_t m0 = BLAKE2B_UNROLLED_LOAD64(block + 0);
+  const uint64_t m1 = BLAKE2B_UNROLLED_LOAD64(block + 8);
+  const uint64_t m2 = BLAKE2B_UNROLLED_LOAD64(block + 16);
+  const uint64_t m3 = BLAKE2B_UNROLLED_LOAD64(block + 24);
+  const uint64_t m4 = BLAKE2B_UNROLLED_LOAD64(block + 32);
+  const uint64_t m5 = BLAKE2B_UNROLLED_LOAD64(block + 40);
+  const uint64_t m6 = BLAKE2B_UNROLLED_LOAD64(block + 48);
+  const uint64_t m7 = BLAKE2B_UNROLLED_LOAD64(block + 56);
+  const uint64_t m8 = BLAKE2B_UNROLLED_LOAD64(block + 64);
+  const uint64_t m9 = BLAKE2B_UNROLLED_LOAD64(block + 72);
+  const uint64_t m10 = BLAKE2B_UNROLLED_LOAD64(block + 80);
+  const uint64_t m11 = BLAKE2B_UNROLLED_LOAD64(block + 88);
+  const uint64_t m12 = BLAKE2B_UNROLLED_LOAD64(block + 96);
+  const uint64_t m13 = BLAKE2B_UNROLLED_LOAD64(block + 104);
+  const uint64_t m14 = BLAKE2B_UNROLLED_LOAD64(block + 112);
+  const uint64_t m15 = BLAKE2B_UNROLLED_LOAD64(block + 120);
+
+  uint64_t v0 = S->h[0];
+  uint64_t v1 = S->h[1];
+  uint64_t v2 = S->h[2];
+  uint64_t v3 = S->h[3];
+  uint64_t v4 = S->h[4];
+  uint64_t v5 = S->h[5];
+  uint64_t v6 = S->h[6];
+  uint64_t v7 = S->h[7];
+  uint64_t v8 = blake2b_IV[0];
+  uint64_t v9 = blake2b_IV[1];
+  uint64_t v10 = blake2b_IV[2];
+  uint64_t v11 = blake2b_IV[3];
+  uint64_t v12 = blake2b_IV[4] ^ S->t[0];
+  uint64_t v13 = blake2b_IV[5] ^ S->t[1];
+  uint64_t v14 = blake2b_IV[6] ^ S->f[0];
+  uint64_t v15 = blake2b_IV[7] ^ S->f[1];
+
+  BLAKE2B_UNROLLED_ROUND(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+                         m13, m14, m15);
+  BLAKE2B_UNROLLED_ROUND(m14, m10, m4, m8, m9, m15, m13, m6, m1, m12, m0, m2,
+                         m11, m7, m5, m3);
+  BLAKE2B_UNROLLED_ROUND(m11, m8, m12, m0, m5, m2, m15, m13, m10, m14, m3, m6,
+                         m7, m1, m9, m4);
+  BLAKE2B_UNROLLED_ROUND(m7, m9, m3, m1, m13, m12, m11, m14, m2, m6, m5, m10,
+                         m4, m0, m15, m8);
+  BLAKE2B_UNROLLED_ROUND(m9, m0, m5, m7, m2, m4, m10, m15, m14, m1, m11, m12,
+                         m6, m8, m3, m13);
+  BLAKE2B_UNROLLED_ROUND(m2, m12, m6, m10, m0, m11, m8, m3, m4, m13, m7, m5,
+                         m15, m14, m1, m9);
+  BLAKE2B_UNROLLED_ROUND(m12, m5, m1, m15, m14, m13, m4, m10, m0, m7, m6, m3,
+                         m9, m2, m8, m11);
+  BLAKE2B_UNROLLED_ROUND(m13, m11, m7, m14, m12, m1, m3, m9, m5, m0, m15, m4,
+                         m8, m6, m2, m10);
+  BLAKE2B_UNROLLED_ROUND(m6, m15, m14, m9, m11, m3, m0, m8, m12, m2, m13, m7,
+                         m1, m4, m10, m5);
+  BLAKE2B_UNROLLED_ROUND(m10, m2, m8, m4, m7, m6, m1, m5, m15, m11, m9, m14,
+                         m3, m12, m13, m0);
+  BLAKE2B_UNROLLED_ROUND(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12,
+                         m13, m14, m15);
+  BLAKE2B_UNROLLED_ROUND(m14, m10, m4, m8, m9, m15, m13, m6, m1, m12, m0, m2,
+                         m11, m7, m5, m3);
+
+  S->h[0] ^= v0 ^ v8;
+  S->h[1] ^= v1 ^ v9;
+  S->h[2] ^= v2 ^ v10;
+  S->h[3] ^= v3 ^ v11;
+  S->h[4] ^= v4 ^ v12;
+  S->h[5] ^= v5 ^ v13;
+  S->h[6] ^= v6 ^ v14;
+  S->h[7] ^= v7 ^ v15;
+}
+
+#undef BLAKE2B_UNROLLED_ROUND
+#undef BLAKE2B_UNROLLED_G
+#undef BLAKE2B_UNROLLED_ROTR64
+#undef BLAKE2B_UNROLLED_LOAD64
+
+#endif /* BLAKE2B_COMPRESS_UNROLLED_H */
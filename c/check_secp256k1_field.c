@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Checks secp256k1_fe_mul_inner and secp256k1_fe_sqr_inner of
+ * secp256k1_field_5x52_riscv64.h against the generic code of the vendored
+ * secp256k1, on random limbs up to the largest magnitude the field code
+ * feeds them, and on all limbs at their maximum. Both must produce the same
+ * limbs, not only the same field element. Built for the host, mulhu comes
+ * from __int128 there, the rest of the code is the same one the lock
+ * scripts run.
+ *
+ * Matching limbs only holds for the reduction schedule of the vendored
+ * revision, so both implementations are also checked on known answers,
+ * computed independently of either: the conversion vector of secp256k1's
+ * run_field_convert test, the edge values 0, 1 and p - 1, the generator
+ * coordinates, and the curve equation y^2 = x^3 + 7 at the generator.
+ */
+
+#define HAVE_CONFIG_H 1
+#include "util.h"
+
+#define secp256k1_fe_mul_inner secp256k1_fe_mul_inner_ref
+#define secp256k1_fe_sqr_inner secp256k1_fe_sqr_inner_ref
+#include "field_5x52_int128_impl.h"
+#undef secp256k1_fe_mul_inner
+#undef secp256k1_fe_sqr_inner
+
+#include "secp256k1_field_5x52_riscv64.h"
+/* secp256k1_fe_mul and the rest of the field code, on top of the above */
+#include "field_impl.h"
+
+#define ERROR_MISMATCH -1
+
+#define ROUNDS 1000000
+
+/*
+ * Big endian a, b, a * b, a^2 and (8a) * (8b) modulo p, the last one
+ * multiplying inputs of magnitude 8
+ */
+static const struct {
+  const char *a;
+  const char *b;
+  const char *product;
+  const char *square;
+  const char *product64;
+} KNOWN_ANSWERS[] = {
+    {"0001020304050607111213141516171822232425262728293334353637383940",
+     "0000000000000000000000000000000000000000000000000000000000000001",
+     "0001020304050607111213141516171822232425262728293334353637383940",
+     "96e61d109580b913cda807c1aae911fc17c18e52e4ba17d59754d2e6d24577fe",
+     "004080c1014181c44484c5054585c60888c9094989ca0a4ccd0d4d8dce0e5000"},
+    {"fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2e",
+     "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2e",
+     "0000000000000000000000000000000000000000000000000000000000000001",
+     "0000000000000000000000000000000000000000000000000000000000000001",
+     "0000000000000000000000000000000000000000000000000000000000000040"},
+    {"fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2e",
+     "0000000000000000000000000000000000000000000000000000000000000002",
+     "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2d",
+     "0000000000000000000000000000000000000000000000000000000000000001",
+     "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffbaf"},
+    {"0000000000000000000000000000000000000000000000000000000000000000",
+     "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2e",
+     "0000000000000000000000000000000000000000000000000000000000000000",
+     "0000000000000000000000000000000000000000000000000000000000000000",
+     "0000000000000000000000000000000000000000000000000000000000000000"},
+    {"79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798",
+     "483ada7726a3c4655da4fbfc0e1108a8fd17b448a68554199c47d08ffb10d4b8",
+     "fd3dc529c6eb60fb9d166034cf3c1a5a72324aa9dfd3428a56d7e1ce0179fd9b",
+     "8550e7d238fcf3086ba9adcf0fb52a9de3652194d06cb5bb38d50229b854fc49",
+     "4f714a71bad83ee745980d33cf06969c8c92aa77f4d0a295b5f873bf5e80572f"},
+    {"79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798",
+     "79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798",
+     "8550e7d238fcf3086ba9adcf0fb52a9de3652194d06cb5bb38d50229b854fc49",
+     "8550e7d238fcf3086ba9adcf0fb52a9de3652194d06cb5bb38d50229b854fc49",
+     "5439f48e3f3cc21aea6b73c3ed4aa778d94865341b2d6ece35408a8f153f9031"},
+    {"0001020304050607111213141516171822232425262728293334353637383940",
+     "483ada7726a3c4655da4fbfc0e1108a8fd17b448a68554199c47d08ffb10d4b8",
+     "82422591f29621aea831a4d58c543fac1d55786fd2f14c9571c92630917f0767",
+     "96e61d109580b913cda807c1aae911fc17c18e52e4ba17d59754d2e6d24577fe",
+     "9089647ca5886baa0c693563150feb07555e1bf4bc53255c72498c445fc253e0"},
+    {"8000000000000000000000000000000000000000000000000000000000000000",
+     "8000000000000000000000000000000000000000000000000000000000000001",
+     "c00000000000000000000000000000000000000000000000400001e84003a334",
+     "400000000000000000000000000000000000000000000000400001e84003a334",
+     "00000000000000000000000000000000000000000000001000007a4000e98430"},
+    {"ffffffffffffffffffffffffffffffffffffffffffffffffffeffffefffffc2f",
+     "000000000000000000000000000000000000000000000000000fffffffffffff",
+     "ffffffffffffffffffffffffffffffffffffff0000000000000ffffefffffc2f",
+     "0000000000000000000000000000000000000100000000000000000000000000",
+     "ffffffffffffffffffffffffffffffffffffc0000000000003fffffefffffc2f"},
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64*, good enough for test inputs */
+static uint64_t next_random() {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+/* Limbs 0 to 3 up to 56 bits and limb 4 up to 52 bits, a magnitude of 8 */
+static void random_limbs(uint64_t *a, int round) {
+  for (int i = 0; i < 5; i++) {
+    int bits = (i == 4) ? 52 : 56;
+    uint64_t max = (1ULL << bits) - 1;
+    a[i] = (round % 16 == 0) ? max : (next_random() >> (64 - bits));
+  }
+}
+
+static void hex_to_fe(secp256k1_fe *r, const char *hex) {
+  unsigned char b32[32];
+  for (int i = 0; i < 32; i++) {
+    unsigned int byte;
+    sscanf(&hex[i * 2], "%2x", &byte);
+    b32[i] = (unsigned char)byte;
+  }
+  secp256k1_fe_set_b32(r, b32);
+}
+
+/* Whether r, of magnitude 1, is the field element given in hex */
+static int fe_is(const secp256k1_fe *r, const char *hex) {
+  secp256k1_fe expected;
+  secp256k1_fe normalized = *r;
+  hex_to_fe(&expected, hex);
+  secp256k1_fe_normalize(&normalized);
+  return secp256k1_fe_equal(&normalized, &expected);
+}
+
+static int check_known_answers() {
+  for (size_t i = 0; i < sizeof(KNOWN_ANSWERS) / sizeof(KNOWN_ANSWERS[0]);
+       i++) {
+    secp256k1_fe a, b, a8, b8, r;
+    hex_to_fe(&a, KNOWN_ANSWERS[i].a);
+    hex_to_fe(&b, KNOWN_ANSWERS[i].b);
+    a8 = a;
+    b8 = b;
+    secp256k1_fe_mul_int(&a8, 8);
+    secp256k1_fe_mul_int(&b8, 8);
+
+    secp256k1_fe_mul_inner_ref(r.n, a.n, b.n);
+    if (!fe_is(&r, KNOWN_ANSWERS[i].product)) {
+      printf("generic product mismatch in known answer %zu\n", i);
+      return ERROR_MISMATCH;
+    }
+    secp256k1_fe_mul(&r, &a, &b);
+    if (!fe_is(&r, KNOWN_ANSWERS[i].product)) {
+      printf("secp256k1_fe_mul mismatch in known answer %zu\n", i);
+      return ERROR_MISMATCH;
+    }
+    secp256k1_fe_sqr_inner_ref(r.n, a.n);
+    if (!fe_is(&r, KNOWN_ANSWERS[i].square)) {
+      printf("generic square mismatch in known answer %zu\n", i);
+      return ERROR_MISMATCH;
+    }
+    secp256k1_fe_sqr(&r, &a);
+    if (!fe_is(&r, KNOWN_ANSWERS[i].square)) {
+      printf("secp256k1_fe_sqr mismatch in known answer %zu\n", i);
+      return ERROR_MISMATCH;
+    }
+    secp256k1_fe_mul_inner_ref(r.n, a8.n, b8.n);
+    if (!fe_is(&r, KNOWN_ANSWERS[i].product64)) {
+      printf("generic magnitude 8 product mismatch in known answer %zu\n", i);
+      return ERROR_MISMATCH;
+    }
+    secp256k1_fe_mul(&r, &a8, &b8);
+    if (!fe_is(&r, KNOWN_ANSWERS[i].product64)) {
+      printf("magnitude 8 secp256k1_fe_mul mismatch in known answer %zu\n",
+             i);
+      return ERROR_MISMATCH;
+    }
+  }
+
+  /* y^2 = x^3 + 7 at the generator, with the generator from the test vectors */
+  secp256k1_fe x, y, lhs, rhs;
+  secp256k1_fe seven = SECP256K1_FE_CONST(0, 0, 0, 0, 0, 0, 0, 7);
+  hex_to_fe(&x, KNOWN_ANSWERS[4].a);
+  hex_to_fe(&y, KNOWN_ANSWERS[4].b);
+  secp256k1_fe_sqr(&lhs, &y);
+  secp256k1_fe_sqr(&rhs, &x);
+  secp256k1_fe_mul(&rhs, &rhs, &x);
+  secp256k1_fe_add(&rhs, &seven);
+  secp256k1_fe_normalize(&lhs);
+  secp256k1_fe_normalize(&rhs);
+  if (!secp256k1_fe_equal(&lhs, &rhs)) {
+    printf("curve equation mismatch at the generator\n");
+    return ERROR_MISMATCH;
+  }
+  return 0;
+}
+
+int main() {
+  int ret = check_known_answers();
+  if (ret != 0) {
+    return ret;
+  }
+  for (int round = 0; round < ROUNDS; round++) {
+    uint64_t a[5], b[5], ref[5], r[5];
+    random_limbs(a, round);
+    random_limbs(b, round);
+
+    secp256k1_fe_mul_inner_ref(ref, a, b);
+    secp256k1_fe_mul_inner(r, a, b);
+    if (memcmp(ref, r, sizeof(r)) != 0) {
+      printf("secp256k1_fe_mul_inner mismatch in round %d\n", round);
+      return ERROR_MISMATCH;
+    }
+    /* The field code multiplies in place as well */
+    memcpy(r, a, sizeof(r));
+    secp256k1_fe_mul_inner(r, r, b);
+    if (memcmp(ref, r, sizeof(r)) != 0) {
+      printf("in place secp256k1_fe_mul_inner mismatch in round %d\n", round);
+      return ERROR_MISMATCH;
+    }
+
+    secp256k1_fe_sqr_inner_ref(ref, a);
+    memcpy(r, a, sizeof(r));
+    secp256k1_fe_sqr_inner(r, r);
+    if (memcmp(ref, r, sizeof(r)) != 0) {
+      printf("secp256k1_fe_sqr_inner mismatch in round %d\n", round);
+      return ERROR_MISMATCH;
+    }
+  }
+  printf("secp256k1 field: %zu known answers and %d rounds match\n",
+         sizeof(KNOWN_ANSWERS) / sizeof(KNOWN_ANSWERS[0]), ROUNDS);
+  return 0;
+}
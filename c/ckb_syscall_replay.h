@@ -0,0 +1,214 @@
+/*
+ckb_syscall_replay.h
+
+Syscalls for running the scripts natively on the host, included by
+ckb_syscalls.h when CKB_SYSCALL_REPLAY is defined. Instead of asking CKB-VM,
+every syscall is answered from a replay file recorded from a real
+transaction, path of which is taken from the CKB_REPLAY_FILE environment
+variable. This way the scripts can be profiled with perf, valgrind or any
+other native tools, see record_replay_files in src/tests/replay.rs for how
+the files are recorded.
+
+A replay file starts with the 8-byte magic "CKBRPLY1", followed by entries
+of six little endian uint64 values: syscall number, index, source, field,
+return code and data size, then data size bytes of data. Syscalls which
+don't take some of index, source and field use 0 for them. A syscall with
+no matching entry returns CKB_INDEX_OUT_OF_BOUND, the same as CKB-VM does for
+items beyond the end of a source.
+*/
+
+#ifndef CKB_SYSCALL_REPLAY_H_
+#define CKB_SYSCALL_REPLAY_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ckb_consts.h"
+
+#define CKB_REPLAY_MAGIC "CKBRPLY1"
+#define CKB_REPLAY_MAGIC_SIZE 8
+#define CKB_REPLAY_ENTRY_HEADER_SIZE 48
+#define CKB_REPLAY_ENV "CKB_REPLAY_FILE"
+/* exit code of the process when the replay file can't be used */
+#define CKB_REPLAY_EXIT_ERROR 127
+
+typedef struct {
+  uint64_t syscall;
+  uint64_t index;
+  uint64_t source;
+  uint64_t field;
+  uint64_t ret;
+  uint64_t size;
+  const uint8_t *data;
+} ckb_replay_entry_t;
+
+static ckb_replay_entry_t *ckb_replay_entries = NULL;
+static size_t ckb_replay_entries_len = 0;
+
+static void ckb_replay_fail(const char *message) {
+  fprintf(stderr, "syscall replay: %s\n", message);
+  exit(CKB_REPLAY_EXIT_ERROR);
+}
+
+static uint64_t ckb_replay_read_u64(const uint8_t *p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+/* the file is kept in memory for the whole run, entries point into it */
+static void ckb_replay_load() {
+  const char *path = getenv(CKB_REPLAY_ENV);
+  if (path == NULL) {
+    ckb_replay_fail("CKB_REPLAY_FILE is not set");
+  }
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    ckb_replay_fail("cannot open replay file");
+  }
+  if (fseek(fp, 0, SEEK_END) != 0) {
+    ckb_replay_fail("cannot read replay file");
+  }
+  long file_size = ftell(fp);
+  if (file_size < CKB_REPLAY_MAGIC_SIZE || fseek(fp, 0, SEEK_SET) != 0) {
+    ckb_replay_fail("cannot read replay file");
+  }
+  uint8_t *buffer = malloc(file_size);
+  if (buffer == NULL ||
+      fread(buffer, 1, file_size, fp) != (size_t)file_size) {
+    ckb_replay_fail("cannot read replay file");
+  }
+  fclose(fp);
+  if (memcmp(buffer, CKB_REPLAY_MAGIC, CKB_REPLAY_MAGIC_SIZE) != 0) {
+    ckb_replay_fail("not a replay file");
+  }
+
+  /* first pass counts the entries, second pass fills them */
+  for (int pass = 0; pass < 2; pass++) {
+    size_t offset = CKB_REPLAY_MAGIC_SIZE;
+    size_t n = 0;
+    while (offset < (size_t)file_size) {
+      if ((size_t)file_size - offset < CKB_REPLAY_ENTRY_HEADER_SIZE) {
+        ckb_replay_fail("truncated entry");
+      }
+      const uint8_t *p = &buffer[offset];
+      uint64_t size = ckb_replay_read_u64(p + 40);
+      offset += CKB_REPLAY_ENTRY_HEADER_SIZE;
+      if ((size_t)file_size - offset < size) {
+        ckb_replay_fail("truncated entry");
+      }
+      if (pass == 1) {
+        ckb_replay_entry_t *entry = &ckb_replay_entries[n];
+        entry->syscall = ckb_replay_read_u64(p);
+        entry->index = ckb_replay_read_u64(p + 8);
+        entry->source = ckb_replay_read_u64(p + 16);
+        entry->field = ckb_replay_read_u64(p + 24);
+        entry->ret = ckb_replay_read_u64(p + 32);
+        entry->size = size;
+        entry->data = &buffer[offset];
+      }
+      offset += size;
+      n++;
+    }
+    if (pass == 0) {
+      ckb_replay_entries = malloc(sizeof(ckb_replay_entry_t) * (n + 1));
+      if (ckb_replay_entries == NULL) {
+        ckb_replay_fail("out of memory");
+      }
+      ckb_replay_entries_len = n;
+    }
+  }
+}
+
+static const ckb_replay_entry_t *ckb_replay_find(uint64_t syscall,
+                                                 uint64_t index,
+                                                 uint64_t source,
+                                                 uint64_t field) {
+  if (ckb_replay_entries == NULL) {
+    ckb_replay_load();
+  }
+  for (size_t i = 0; i < ckb_replay_entries_len; i++) {
+    const ckb_replay_entry_t *entry = &ckb_replay_entries[i];
+    if (entry->syscall == syscall && entry->index == index &&
+        entry->source == source && entry->field == field) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/* Same partial loading rules as CKB-VM: data from offset on are copied up to
+ the size of the buffer, and the length is set to the full size left from
+ offset */
+static long ckb_replay_store(const ckb_replay_entry_t *entry, uint8_t *addr,
+                             uint64_t *len, uint64_t offset) {
+  if (entry == NULL) {
+    return CKB_INDEX_OUT_OF_BOUND;
+  }
+  if (entry->ret != CKB_SUCCESS) {
+    return (long)entry->ret;
+  }
+  if (offset > entry->size) {
+    offset = entry->size;
+  }
+  uint64_t full_size = entry->size - offset;
+  uint64_t real_size = *len < full_size ? *len : full_size;
+  if (addr != NULL && real_size > 0) {
+    memcpy(addr, entry->data + offset, real_size);
+  }
+  *len = full_size;
+  return CKB_SUCCESS;
+}
+
+static long ckb_replay_syscall(long n, long a0, long a1, long a2, long a3,
+                               long a4, long a5) {
+  const ckb_replay_entry_t *entry = NULL;
+  switch (n) {
+    case SYS_exit:
+      exit((int8_t)a0);
+    case SYS_ckb_debug:
+      fprintf(stderr, "%s\n", (const char *)a0);
+      return CKB_SUCCESS;
+    case SYS_ckb_load_tx_hash:
+    case SYS_ckb_load_script_hash:
+    case SYS_ckb_load_script:
+      entry = ckb_replay_find(n, 0, 0, 0);
+      return ckb_replay_store(entry, (uint8_t *)a0, (uint64_t *)a1, a2);
+    case SYS_ckb_load_cell:
+    case SYS_ckb_load_input:
+    case SYS_ckb_load_header:
+    case SYS_ckb_load_witness:
+    case SYS_ckb_load_cell_data:
+      entry = ckb_replay_find(n, a3, a4, 0);
+      return ckb_replay_store(entry, (uint8_t *)a0, (uint64_t *)a1, a2);
+    case SYS_ckb_load_cell_by_field:
+    case SYS_ckb_load_header_by_field:
+    case SYS_ckb_load_input_by_field:
+      entry = ckb_replay_find(n, a3, a4, a5);
+      return ckb_replay_store(entry, (uint8_t *)a0, (uint64_t *)a1, a2);
+    case SYS_ckb_load_cell_data_as_code:
+      /* the data are recorded as SYS_ckb_load_cell_data entries */
+      entry = ckb_replay_find(SYS_ckb_load_cell_data, a4, a5, 0);
+      if (entry == NULL) {
+        return CKB_INDEX_OUT_OF_BOUND;
+      }
+      if (entry->ret != CKB_SUCCESS) {
+        return (long)entry->ret;
+      }
+      if ((uint64_t)a3 > (uint64_t)a1 || (uint64_t)a2 > entry->size ||
+          (uint64_t)a3 > entry->size - a2) {
+        ckb_replay_fail("invalid load_cell_data_as_code arguments");
+      }
+      memcpy((uint8_t *)a0, entry->data + a2, a3);
+      memset((uint8_t *)a0 + a3, 0, a1 - a3);
+      return CKB_SUCCESS;
+    default:
+      ckb_replay_fail("unknown syscall");
+  }
+  return CKB_SUCCESS;
+}
+
+#endif /* CKB_SYSCALL_REPLAY_H_ */
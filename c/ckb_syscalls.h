@@ -6,6 +6,44 @@
 
 #include "ckb_consts.h"
 
+#if defined(__riscv)
+
+#define memory_barrier() asm volatile("fence" ::: "memory")
+
+static inline long __internal_syscall(long n, long _a0, long _a1, long _a2,
+                                      long _a3, long _a4, long _a5) {
+  register long a0 asm("a0") = _a0;
+  register long a1 asm("a1") = _a1;
+  register long a2 asm("a2") = _a2;
+  register long a3 asm("a3") = _a3;
+  register long a4 asm("a4") = _a4;
+  register long a5 asm("a5") = _a5;
+  register long syscall_id asm("a7") = n;
+  asm volatile("scall"
+               : "+r"(a0)
+               : "r"(a1), "r"(a2), "r"(a3), "r"(a4), "r"(a5), "r"(syscall_id));
+  /*
+   * Syscalls might modify memory sent as pointer, adding a barrier here
+   * ensures gcc won't do incorrect optimization.
+   */
+  memory_barrier();
+  return a0;
+}
+
+#elif defined(CKB_SYSCALL_REPLAY)
+
+/* native host build, syscalls are answered from a replay file */
+#include "ckb_syscall_replay.h"
+
+#define memory_barrier() __sync_synchronize()
+
+static inline long __internal_syscall(long n, long _a0, long _a1, long _a2,
+                                      long _a3, long _a4, long _a5) {
+  return ckb_replay_syscall(n, _a0, _a1, _a2, _a3, _a4, _a5);
+}
+
+#else
+
 #define memory_barrier() asm volatile("fence" ::: "memory")
 
 static inline long __internal_syscall(long n, long _a0, long _a1, long _a2,
@@ -13,6 +51,8 @@ static inline long __internal_syscall(long n, long _a0, long _a1, long _a2,
     return 0;
 }
 
+#endif
+
 #define syscall(n, a, b, c, d, e, f)                                           \
   __internal_syscall(n, (long)(a), (long)(b), (long)(c), (long)(d), (long)(e), \
                      (long)(f))
@@ -4,8 +4,13 @@ common.h
 Defines commonly used high level functions and constants.
 */
 
+#include "arena.h"
+#include "blake2b.h"
 #include "ckb_syscalls.h"
+#include "molecule_lazy.h"
+#include "profile.h"
 #include "protocol.h"
+#include "tx_shape.h"
 #include "utils.h"
 
 /* Common errors */
@@ -28,41 +33,55 @@ Defines commonly used high level functions and constants.
 #define SINCE_VALUE_MASK 0x00ffffffffffffff
 #define SINCE_EPOCH_FRACTION_FLAG 0b00100000
 
-/* calculate inputs length */
-int calculate_inputs_len() {
-  uint64_t len = 0;
-  /* lower bound, at least tx has one input */
-  int lo = 0;
-  /* higher bound */
-  int hi = 4;
-  int ret;
-  /* try to load input until failing to increase lo and hi */
-  while (1) {
-    ret = ckb_load_input_by_field(NULL, &len, 0, hi, CKB_SOURCE_INPUT,
-                                  CKB_INPUT_FIELD_SINCE);
-    if (ret == CKB_SUCCESS) {
-      lo = hi;
-      hi *= 2;
-    } else {
-      break;
+/* witnesses are streamed into the hasher in chunks of this size */
+#define WITNESS_CHUNK_SIZE 32768
+/* size of the tx hash and of the sighash all message */
+#define SIGHASH_ALL_HASH_SIZE 32
+
+static int hash_witness_chunks(blake2b_state *ctx, uint8_t *chunk,
+                               size_t index, size_t source) {
+  uint64_t len = WITNESS_CHUNK_SIZE;
+  int ret = ckb_load_witness(chunk, &len, 0, index, source);
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  /* len is now the full length of the witness */
+  blake2b_update(ctx, (char *)&len, sizeof(uint64_t));
+  uint64_t offset = (len > WITNESS_CHUNK_SIZE) ? WITNESS_CHUNK_SIZE : len;
+  blake2b_update(ctx, chunk, offset);
+  while (offset < len) {
+    uint64_t chunk_len = WITNESS_CHUNK_SIZE;
+    ret = ckb_load_witness(chunk, &chunk_len, offset, index, source);
+    if (ret != CKB_SUCCESS) {
+      return ERROR_SYSCALL;
+    }
+    /* the remaining length must stay consistent with the first load */
+    if (chunk_len != len - offset) {
+      return ERROR_SYSCALL;
     }
+    if (chunk_len > WITNESS_CHUNK_SIZE) {
+      chunk_len = WITNESS_CHUNK_SIZE;
+    }
+    blake2b_update(ctx, chunk, chunk_len);
+    offset += chunk_len;
   }
+  return CKB_SUCCESS;
+}
 
-  /* now we get our lower bound and higher bound,
-   count number of inputs by binary search */
-  int i;
-  while (lo + 1 != hi) {
-    i = (lo + hi) / 2;
-    ret = ckb_load_input_by_field(NULL, &len, 0, i, CKB_SOURCE_INPUT,
-                                  CKB_INPUT_FIELD_SINCE);
-    if (ret == CKB_SUCCESS) {
-      lo = i;
-    } else {
-      hi = i;
-    }
+/* load a witness chunk by chunk, hash its length as a 64-bit unsigned little
+ endian integer, then hash its content. Only WITNESS_CHUNK_SIZE bytes of arena
+ memory are used no matter how large the witness is, and they are released
+ before returning. Returns CKB_INDEX_OUT_OF_BOUND when the witness does not
+ exist */
+int load_and_hash_witness(blake2b_state *ctx, size_t index, size_t source) {
+  size_t mark = ckb_arena_mark();
+  uint8_t *chunk = ckb_arena_alloc(WITNESS_CHUNK_SIZE);
+  if (chunk == NULL) {
+    return CKB_ARENA_ERROR_EXHAUSTED;
   }
-  /* now lo is last input index and hi is length of inputs */
-  return hi;
+  int ret = hash_witness_chunks(ctx, chunk, index, source);
+  ckb_arena_release(mark);
+  return ret;
 }
 
 /* Extract lock from WitnessArgs */
@@ -72,30 +91,156 @@ int extract_witness_lock(uint8_t *witness, uint64_t len,
   witness_seg.ptr = witness;
   witness_seg.size = len;
 
-  if (MolReader_WitnessArgs_verify(&witness_seg, false) != MOL_OK) {
+  // Only the lock field is verified, the other fields are left to the scripts
+  // reading them.
+  mol_seg_t lock_seg;
+  if (MolLazyReader_WitnessArgs_get_lock(&witness_seg, &lock_seg) != MOL_OK) {
     return ERROR_ENCODING;
   }
-  mol_seg_t lock_seg = MolReader_WitnessArgs_get_lock(&witness_seg);
 
   if (MolReader_BytesOpt_is_none(&lock_seg)) {
     return ERROR_ENCODING;
   }
+  if (MolReader_Bytes_verify(&lock_seg, false) != MOL_OK) {
+    return ERROR_ENCODING;
+  }
   *lock_bytes_seg = MolReader_Bytes_raw_bytes(&lock_seg);
   return CKB_SUCCESS;
 }
 
+/* start the sighash all hasher with the tx hash, then the first witness, with
+ zero_len bytes starting at zero_offset hashed as zeros. The witness itself is
+ left untouched, so the caller can keep reading signatures from it. The
+ witness is preceded by its length as a 64-bit unsigned little endian
+ integer */
+int sighash_all_hash_first_witness(blake2b_state *blake2b_ctx,
+                                   const uint8_t *first_witness,
+                                   uint64_t first_witness_len,
+                                   size_t zero_offset, size_t zero_len) {
+  static const uint8_t zeros[BLAKE2B_BLOCKBYTES] = {0};
+  if (zero_offset > first_witness_len ||
+      zero_len > first_witness_len - zero_offset) {
+    return ERROR_ENCODING;
+  }
+
+  unsigned char tx_hash[SIGHASH_ALL_HASH_SIZE];
+  uint64_t len = SIGHASH_ALL_HASH_SIZE;
+  int ret = ckb_load_tx_hash(tx_hash, &len, 0);
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  if (len != SIGHASH_ALL_HASH_SIZE) {
+    return ERROR_SYSCALL;
+  }
+
+  blake2b_init(blake2b_ctx, SIGHASH_ALL_HASH_SIZE);
+  blake2b_update(blake2b_ctx, tx_hash, SIGHASH_ALL_HASH_SIZE);
+
+  /* first witness, with the zero range replaced by zeros */
+  blake2b_update(blake2b_ctx, (char *)&first_witness_len, sizeof(uint64_t));
+  blake2b_update(blake2b_ctx, first_witness, zero_offset);
+  size_t remaining = zero_len;
+  while (remaining > 0) {
+    size_t n = remaining > sizeof(zeros) ? sizeof(zeros) : remaining;
+    blake2b_update(blake2b_ctx, zeros, n);
+    remaining -= n;
+  }
+  size_t tail_offset = zero_offset + zero_len;
+  blake2b_update(blake2b_ctx, first_witness + tail_offset,
+                 first_witness_len - tail_offset);
+  return CKB_SUCCESS;
+}
+
+/* hash all witnesses with index equal to or larger than the inputs length,
+ each preceded by its length, then finish the sighash all message */
+int sighash_all_hash_trailing_witnesses(blake2b_state *blake2b_ctx,
+                                        tx_shape_t *shape, uint8_t *message) {
+  size_t inputs_len;
+  int ret = tx_shape_load_inputs_len(shape, &inputs_len);
+  if (ret != CKB_SUCCESS) {
+    return ERROR_SYSCALL;
+  }
+  size_t i = inputs_len;
+  while (i < shape->witnesses_len) {
+    ret = load_and_hash_witness(blake2b_ctx, i, CKB_SOURCE_INPUT);
+    if (ret == CKB_INDEX_OUT_OF_BOUND) {
+      break;
+    }
+    if (ret != CKB_SUCCESS) {
+      return ERROR_SYSCALL;
+    }
+    i += 1;
+  }
+  /* a transaction might have fewer witnesses than inputs, the witnesses
+   length is only known here when at least one trailing witness exists */
+  if (i > inputs_len) {
+    shape->witnesses_len = i;
+  }
+
+  blake2b_final(blake2b_ctx, message, SIGHASH_ALL_HASH_SIZE);
+  return CKB_SUCCESS;
+}
+
+/* calculate the sighash all message, the message is the blake2b hash of:
+
+ * the tx hash;
+ * the first witness of current group, with zero_len bytes starting at
+   zero_offset hashed as zeros, see sighash_all_hash_first_witness;
+ * the remaining witnesses of current group;
+ * all witnesses with index equal to or larger than the inputs length.
+
+ each witness is preceded by its length as a 64-bit unsigned little endian
+ integer. The counts in shape are used to stop the witness loops, and filled
+ in when a loop finds the end by itself. */
+int calculate_sighash_all_message(tx_shape_t *shape,
+                                  const uint8_t *first_witness,
+                                  uint64_t first_witness_len,
+                                  size_t zero_offset, size_t zero_len,
+                                  uint8_t *message) {
+  blake2b_state blake2b_ctx;
+  int ret = sighash_all_hash_first_witness(&blake2b_ctx, first_witness,
+                                           first_witness_len, zero_offset,
+                                           zero_len);
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  CKB_PROFILE_PHASE("message");
+
+  /* remaining witnesses of current group, the loop runs till the first missing
+   witness when the group inputs length is not known yet */
+  size_t i = 1;
+  while (i < shape->group_inputs_len) {
+    ret = load_and_hash_witness(&blake2b_ctx, i, CKB_SOURCE_GROUP_INPUT);
+    if (ret == CKB_INDEX_OUT_OF_BOUND) {
+      break;
+    }
+    if (ret != CKB_SUCCESS) {
+      return ERROR_SYSCALL;
+    }
+    i += 1;
+  }
+
+  /* witnesses which don't have a corresponding input cell */
+  ret = sighash_all_hash_trailing_witnesses(&blake2b_ctx, shape, message);
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  CKB_PROFILE_PHASE("trailing_witnesses");
+  return CKB_SUCCESS;
+}
+
 /* check since,
  for all inputs the since field must have the exactly same flags with the since
  constraint, and the value of since must greater or equals than the since
- contstaint */
-int check_since(uint64_t since) {
+ contstaint. The group inputs length is recorded in shape. */
+int check_since(tx_shape_t *shape, uint64_t since) {
   size_t i = 0, len;
   uint64_t input_since;
   /* the 8 msb is flag */
   uint8_t since_flags = since >> SINCE_VALUE_BITS;
   uint64_t since_value = since & SINCE_VALUE_MASK;
   int ret;
-  while (1) {
+  while (i < shape->group_inputs_len) {
     len = sizeof(uint64_t);
     ret =
         ckb_load_input_by_field(&input_since, &len, 0, i,
@@ -121,5 +266,6 @@ int check_since(uint64_t since) {
     }
     i += 1;
   }
+  shape->group_inputs_len = i;
   return CKB_SUCCESS;
 }
@@ -0,0 +1,129 @@
+// # crypto-lib
+//
+// Shared crypto library cell for lock scripts, see crypto_lib.h for the interface.
+// This is built with `make crypto-lib` into build/crypto_lib, a flat binary of
+// position independent code linked at address 0 with crypto_lib.lds. The linker
+// script rejects any writable data, and the Makefile rejects any absolute
+// relocation, since both would break once the binary is mapped at another address.
+//
+// The library is built against the same secp256k1_data_info.h as the locks, so it
+// uses the layout and window size of the deployed secp256k1 data cell.
+#include "crypto_lib.h"
+#include "ckb_syscalls.h"
+#include "secp256k1_data_info.h"
+
+#define CKB_CRYPTO_LIB_ERROR_ILLEGAL_CALLBACK -102
+#define CKB_CRYPTO_LIB_ERROR_ERROR_CALLBACK -103
+
+// The library is linked without libc, those are the only functions gcc and
+// secp256k1 expect from it. The build uses -fno-tree-loop-distribute-patterns, so
+// the loops below are not turned back into calls to themselves.
+void *memset(void *dest, int c, size_t n) {
+  uint8_t *d = dest;
+  while (n-- > 0) {
+    *d++ = (uint8_t)c;
+  }
+  return dest;
+}
+
+void *memcpy(void *dest, const void *src, size_t n) {
+  uint8_t *d = dest;
+  const uint8_t *s = src;
+  while (n-- > 0) {
+    *d++ = *s++;
+  }
+  return dest;
+}
+
+int memcmp(const void *a, const void *b, size_t n) {
+  const uint8_t *x = a;
+  const uint8_t *y = b;
+  for (size_t i = 0; i < n; i++) {
+    if (x[i] != y[i]) {
+      return x[i] < y[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+#define HAVE_CONFIG_H 1
+#define USE_EXTERNAL_DEFAULT_CALLBACKS
+#ifdef CKB_SECP256K1_FIELD_RISCV64
+#include "secp256k1_field_5x52_riscv64.h"
+#endif
+#include <secp256k1.c>
+
+#if defined(CKB_SECP256K1_DATA_WINDOW_SIZE) && \
+    CKB_SECP256K1_DATA_WINDOW_SIZE != WINDOW_G
+#error "secp256k1 data is generated with a different ecmult window size!"
+#endif
+
+void secp256k1_default_illegal_callback_fn(const char *str, void *data) {
+  (void)str;
+  (void)data;
+  ckb_exit(CKB_CRYPTO_LIB_ERROR_ILLEGAL_CALLBACK);
+}
+
+void secp256k1_default_error_callback_fn(const char *str, void *data) {
+  (void)str;
+  (void)data;
+  ckb_exit(CKB_CRYPTO_LIB_ERROR_ERROR_CALLBACK);
+}
+
+// The context lives on the stack of each call. Its callbacks are assigned here
+// instead of being copied from secp256k1's default callback structs, which hold
+// function pointers that would need relocating.
+static void setup_context(secp256k1_context *context,
+                          const void *secp256k1_data) {
+  context->illegal_callback.fn = secp256k1_default_illegal_callback_fn;
+  context->illegal_callback.data = NULL;
+  context->error_callback.fn = secp256k1_default_error_callback_fn;
+  context->error_callback.data = NULL;
+
+  secp256k1_ecmult_context_init(&context->ecmult_ctx);
+  secp256k1_ecmult_gen_context_init(&context->ecmult_gen_ctx);
+
+  const uint8_t *p = secp256k1_data;
+  context->ecmult_ctx.pre_g = (secp256k1_ge_storage(*)[])p;
+  context->ecmult_ctx.pre_g_128 =
+      (secp256k1_ge_storage(*)[])(&p[CKB_SECP256K1_DATA_PRE_SIZE]);
+}
+
+static int secp256k1_recover_compressed(const void *secp256k1_data,
+                                        const uint8_t *signature,
+                                        const uint8_t *message,
+                                        uint8_t *pubkey) {
+  secp256k1_context context;
+  setup_context(&context, secp256k1_data);
+
+  secp256k1_ecdsa_recoverable_signature recoverable_signature;
+  if (secp256k1_ecdsa_recoverable_signature_parse_compact(
+          &context, &recoverable_signature, signature,
+          signature[CKB_CRYPTO_LIB_SIGNATURE_SIZE - 1]) == 0) {
+    return CKB_CRYPTO_LIB_ERROR_PARSE_SIGNATURE;
+  }
+  secp256k1_pubkey recovered;
+  if (secp256k1_ecdsa_recover(&context, &recovered, &recoverable_signature,
+                              message) != 1) {
+    return CKB_CRYPTO_LIB_ERROR_RECOVER_PUBKEY;
+  }
+  size_t pubkey_size = CKB_CRYPTO_LIB_PUBKEY_SIZE;
+  if (secp256k1_ec_pubkey_serialize(&context, pubkey, &pubkey_size, &recovered,
+                                    SECP256K1_EC_COMPRESSED) != 1) {
+    return CKB_CRYPTO_LIB_ERROR_SERIALIZE_PUBKEY;
+  }
+  return 0;
+}
+
+// Entry function, placed at offset 0 of the binary by crypto_lib.lds. Addresses
+// of the functions are taken at runtime, they are PC relative and hence correct
+// wherever the library is mapped.
+__attribute__((section(".text.ckb_crypto_lib_entry"))) int
+ckb_crypto_lib_entry(ckb_crypto_lib_t *lib, uint64_t version) {
+  if (version != CKB_CRYPTO_LIB_VERSION) {
+    return CKB_CRYPTO_LIB_ERROR_VERSION;
+  }
+  lib->version = CKB_CRYPTO_LIB_VERSION;
+  lib->secp256k1_recover_compressed = secp256k1_recover_compressed;
+  return 0;
+}
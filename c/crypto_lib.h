@@ -0,0 +1,57 @@
+/*
+crypto_lib.h
+
+Interface of the crypto library cell, built from crypto_lib.c by
+`make crypto-lib`. The library packages the verify only secp256k1 code, so
+lock scripts can map it from a cell dep with ckb_load_cell_code, instead of
+each of them shipping its own copy. See ckb_crypto_lib_load in
+secp256k1_helper.h for the loader. blake2b is small enough to stay inline in
+the locks, which hash through common.h.
+
+The library is a flat binary of position independent code, with the entry
+function at offset 0. Pages mapped by ckb_load_cell_code are not writable,
+so the library keeps no state: the entry function fills in a function table
+owned by the caller, and every function works on caller provided memory.
+*/
+
+#ifndef CKB_CRYPTO_LIB_H_
+#define CKB_CRYPTO_LIB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* bumped whenever the function table changes */
+#define CKB_CRYPTO_LIB_VERSION 1
+
+/*
+ * Errors of secp256k1_recover_compressed, they have the same values as the
+ * ERROR_SECP_* codes in common.h, so locks can return them as they are.
+ */
+#define CKB_CRYPTO_LIB_ERROR_RECOVER_PUBKEY -11
+#define CKB_CRYPTO_LIB_ERROR_PARSE_SIGNATURE -14
+#define CKB_CRYPTO_LIB_ERROR_SERIALIZE_PUBKEY -15
+/* returned by the entry function for an unsupported version */
+#define CKB_CRYPTO_LIB_ERROR_VERSION -16
+
+#define CKB_CRYPTO_LIB_SIGNATURE_SIZE 65
+#define CKB_CRYPTO_LIB_MESSAGE_SIZE 32
+#define CKB_CRYPTO_LIB_PUBKEY_SIZE 33
+
+typedef struct {
+  uint64_t version;
+  /*
+   * Recovers the public key from a 65-byte recoverable signature of a 32-byte
+   * message, the recovery ID is the last byte of the signature. The key is
+   * written in compressed form to pubkey, which must hold 33 bytes.
+   * secp256k1_data points to the precomputed secp256k1 data cell contents,
+   * the same data the library is built against.
+   */
+  int (*secp256k1_recover_compressed)(const void *secp256k1_data,
+                                      const uint8_t *signature,
+                                      const uint8_t *message, uint8_t *pubkey);
+} ckb_crypto_lib_t;
+
+/* Fills in lib, version is the CKB_CRYPTO_LIB_VERSION the caller expects */
+typedef int (*ckb_crypto_lib_entry_t)(ckb_crypto_lib_t *lib, uint64_t version);
+
+#endif /* CKB_CRYPTO_LIB_H_ */
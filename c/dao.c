@@ -6,7 +6,14 @@
 
 // Necessary headers. This script will need to perform syscalls to read current
 // transaction structure, then parse WitnessArgs data structure in molecule format.
+//
+// The buffer for the script is taken from a static arena. Witnesses are never loaded
+// as a whole, only the few bytes needed out of them are.
+#define CKB_ARENA_SIZE 32768
+#include "arena.h"
 #include "ckb_syscalls.h"
+#include "molecule_lazy.h"
+#include "profile.h"
 #include "protocol.h"
 
 // Error definitions
@@ -27,18 +34,54 @@
 #define ERROR_SCRIPT_TOO_LONG -21
 
 // Common definitions here, one important limitation, is that this script only works
-// with scripts and witnesses that are no larger than 32KB. We believe this should be enough
-// for most cases.
+// with scripts and witnesses that are no larger than 32KB. We believe this should be
+// enough for most cases.
 #define HASH_SIZE 32
-#define HEADER_SIZE 4096
 /* 32 KB */
-#define MAX_WITNESS_SIZE 32768
 #define SCRIPT_SIZE 32768
+#define MAX_WITNESS_SIZE 32768
 
-// For simplicity, a transaction containing Nervos DAO script is limited to
-// 64 output cells so we can simplify processing. Later we might upgrade this
-// script to relax this limitation.
-#define MAX_OUTPUT_LENGTH 64
+// WitnessArgs is a table of 3 fields, its header is the total size followed by
+// the offsets of the fields. The input_type field holding the deposit header
+// index is a Bytes value of the 64-bit index, it is the length of the bytes
+// followed by the bytes.
+#define WITNESS_ARGS_FIELD_COUNT 3
+#define WITNESS_ARGS_HEADER_SIZE (MOL_NUM_T_SIZE * (WITNESS_ARGS_FIELD_COUNT + 1))
+#define WITNESS_ARGS_INPUT_TYPE_INDEX 1
+#define DEPOSIT_HEADER_INDEX_SIZE 8
+#define INPUT_TYPE_SIZE (MOL_NUM_T_SIZE + DEPOSIT_HEADER_INDEX_SIZE)
+
+// With empty args, a serialized DAO type script is 53 bytes long, some room is
+// left here just in case. Most cells are small, a CellOutput up to the given size
+// is parsed from one syscall, larger ones are loaded field by field.
+#define DAO_SCRIPT_SIZE 64
+#define CELL_OUTPUT_SIZE 512
+
+// Layout of the fields used in Header, see `MolReader_RawHeader_get_*` in
+// protocol.h, the raw header is at the start of Header.
+#define HEADER_SIZE 208
+#define HEADER_NUMBER_OFFSET 16
+#define HEADER_EPOCH_OFFSET 24
+#define HEADER_DAO_OFFSET 160
+#define HEADER_DAO_SIZE 32
+#define HEADER_LOAD_SIZE \
+  (HEADER_DAO_OFFSET + HEADER_DAO_SIZE - HEADER_NUMBER_OFFSET)
+
+// A transaction containing Nervos DAO script is limited to this many output
+// cells, so withdrawing outputs can be tracked in a fixed size bitset. The
+// bitset costs the same per cell no matter how large the limit is, the limit
+// only decides its size: 1024 outputs take 128 bytes.
+#define MAX_OUTPUT_LENGTH 1024
+
+#define OUTPUT_BITSET_WORDS ((MAX_OUTPUT_LENGTH + 63) / 64)
+
+static void output_bitset_set(uint64_t *bitset, size_t index) {
+  bitset[index / 64] |= ((uint64_t)1) << (index % 64);
+}
+
+static int output_bitset_test(const uint64_t *bitset, size_t index) {
+  return (bitset[index / 64] >> (index % 64)) & 1;
+}
 
 // One lock period of NervosDAO is set as 180 epoches, which is roughly 30 days.
 #define LOCK_PERIOD_EPOCHES 180
@@ -55,43 +98,68 @@
 #define EPOCH_LENGTH_MASK ((1 << EPOCH_LENGTH_BITS) - 1)
 
 // Fetches deposit header index. The index is kepted in the witness of the same
-// index as the input cell. The witness is first treated as a WitnessArgs object
-// in molecule format. Then we extract the value from the `input_type` field of
-// WitnessArgs. The value is kept as a 64-bit unsigned little endian value.
+// index as the input cell. The witness is treated as a WitnessArgs object in
+// molecule format, and the value is extracted from its `input_type` field. The
+// value is kept as a 64-bit unsigned little endian value, of which only the
+// lowest byte is used as the index.
+//
+// The witness might also hold a large lock field, such as the signatures of a
+// multisig lock, so it is never loaded as a whole. The table header is loaded
+// first, then only the `input_type` field through the offset argument of the
+// syscall. The checks are the same as MolLazyReader_WitnessArgs_get_input_type
+// followed by MolReader_Bytes_verify, the full witness length reported by the
+// first syscall stands for the input size.
 static int extract_deposit_header_index(size_t input_index, size_t *index) {
-  int ret;
-  uint64_t len = 0;
-  unsigned char witness[MAX_WITNESS_SIZE];
-
-  len = MAX_WITNESS_SIZE;
-  ret = ckb_load_witness(witness, &len, 0, input_index, CKB_SOURCE_INPUT);
+  uint8_t header[WITNESS_ARGS_HEADER_SIZE];
+  uint64_t len = WITNESS_ARGS_HEADER_SIZE;
+  int ret = ckb_load_witness(header, &len, 0, input_index, CKB_SOURCE_INPUT);
   if (ret != CKB_SUCCESS) {
     return ERROR_SYSCALL;
   }
+  // len is the full size of the witness. There are exactly 3 fields, so the
+  // first field starts right after the header.
   if (len > MAX_WITNESS_SIZE) {
     return ERROR_WITNESS_TOO_LONG;
   }
-
-  mol_seg_t witness_seg;
-  witness_seg.ptr = (uint8_t *)witness;
-  witness_seg.size = len;
-
-  if (MolReader_WitnessArgs_verify(&witness_seg, false) != MOL_OK) {
+  if (len < WITNESS_ARGS_HEADER_SIZE) {
     return ERROR_ENCODING;
   }
-  // Load `input_type`
-  mol_seg_t type_seg = MolReader_WitnessArgs_get_input_type(&witness_seg);
-
-  if (MolReader_BytesOpt_is_none(&type_seg)) {
+  uint64_t witness_len = len;
+  mol_num_t total_size = mol_unpack_number(header);
+  mol_num_t first_offset = mol_unpack_number(&header[MOL_NUM_T_SIZE]);
+  if (total_size != witness_len || first_offset != WITNESS_ARGS_HEADER_SIZE) {
+    return ERROR_ENCODING;
+  }
+  mol_num_t start = mol_unpack_number(
+      &header[MOL_NUM_T_SIZE * (WITNESS_ARGS_INPUT_TYPE_INDEX + 1)]);
+  mol_num_t end = mol_unpack_number(
+      &header[MOL_NUM_T_SIZE * (WITNESS_ARGS_INPUT_TYPE_INDEX + 2)]);
+  if (start < first_offset || start > end || end > total_size) {
+    return ERROR_ENCODING;
+  }
+  // An empty field means `input_type` is none, anything else than the length
+  // and the 8 bytes of the index is rejected before it is loaded.
+  if (end - start != INPUT_TYPE_SIZE) {
     return ERROR_ENCODING;
   }
 
-  mol_seg_t type_bytes_seg = MolReader_Bytes_raw_bytes(&type_seg);
-  if (type_bytes_seg.size != 8) {
+  uint8_t input_type[INPUT_TYPE_SIZE];
+  len = INPUT_TYPE_SIZE;
+  ret = ckb_load_witness(input_type, &len, start, input_index,
+                         CKB_SOURCE_INPUT);
+  if (ret != CKB_SUCCESS) {
+    return ERROR_SYSCALL;
+  }
+  // len is the size of the witness from start on, which must not have changed
+  // since the header was loaded.
+  if (len != witness_len - start) {
+    return ERROR_ENCODING;
+  }
+  if (mol_unpack_number(input_type) != DEPOSIT_HEADER_INDEX_SIZE) {
     return ERROR_ENCODING;
   }
 
-  *index = *type_bytes_seg.ptr;
+  *index = input_type[MOL_NUM_T_SIZE];
   return CKB_SUCCESS;
 }
 
@@ -128,38 +196,78 @@ typedef struct {
   uint8_t dao[32];
 } dao_header_data_t;
 
-// Load a block header and extract all the useful data.
-static int load_dao_header_data(size_t index, size_t source,
-                                dao_header_data_t *data) {
-  uint8_t buffer[HEADER_SIZE];
-  uint64_t len = HEADER_SIZE;
-  int ret = ckb_load_header(buffer, &len, 0, index, source);
+// Load a block header and extract all the useful data. Header is a fixed size
+// molecule struct starting with the raw header, so every field lives at a fixed
+// offset. Instead of loading the whole header and verifying it, only the range
+// from number to dao is loaded here, the length reported by the syscall is then
+// checked against the fixed header size.
+static int fetch_dao_header_data(size_t index, size_t source,
+                                 dao_header_data_t *data) {
+  uint8_t buffer[HEADER_LOAD_SIZE];
+  uint64_t len = HEADER_LOAD_SIZE;
+  int ret = ckb_load_header(buffer, &len, HEADER_NUMBER_OFFSET, index, source);
   if (ret != CKB_SUCCESS) {
     return ret;
   }
-  if (len > HEADER_SIZE) {
-    return ERROR_BUFFER_NOT_ENOUGH;
+  // len is the size of the header from the given offset on.
+  if (len != HEADER_SIZE - HEADER_NUMBER_OFFSET) {
+    return ERROR_ENCODING;
   }
 
-  // The header is also serialized in molecule format.
-  mol_seg_t header_seg;
-  header_seg.ptr = (uint8_t *)buffer;
-  header_seg.size = len;
+  data->block_number = *((uint64_t *)&buffer[0]);
+  memcpy(data->dao, &buffer[HEADER_DAO_OFFSET - HEADER_NUMBER_OFFSET],
+         HEADER_DAO_SIZE);
+  return extract_epoch_info(
+      *((uint64_t *)&buffer[HEADER_EPOCH_OFFSET - HEADER_NUMBER_OFFSET]), 0,
+      &(data->epoch_number), &(data->epoch_index), &(data->epoch_length));
+}
 
-  if (MolReader_Header_verify(&header_seg, false) != MOL_OK) {
-    return ERROR_ENCODING;
-  }
+// Many DAO cells in one transaction tend to share the same deposit header in
+// `header_deps`, so the decoded headers are cached for the whole script run, keyed
+// by source and index. The header of each input is only needed once, so only header
+// deps are cached. The cache is small, when all entries are taken, the oldest one
+// gets replaced.
+//
+// Keying by block hash would also let different sources share entries, but the
+// hash is not part of the serialized header, computing it for each lookup would
+// cost more than loading the header again.
+#define DAO_HEADER_CACHE_SIZE 16
+
+typedef struct {
+  size_t source;
+  size_t index;
+  dao_header_data_t data;
+} dao_header_cache_entry_t;
 
-  mol_seg_t raw_seg = MolReader_Header_get_raw(&header_seg);
-  mol_seg_t dao_seg = MolReader_RawHeader_get_dao(&raw_seg);
-  mol_seg_t epoch_seg = MolReader_RawHeader_get_epoch(&raw_seg);
-  mol_seg_t block_number_seg = MolReader_RawHeader_get_number(&raw_seg);
+static dao_header_cache_entry_t dao_header_cache[DAO_HEADER_CACHE_SIZE];
+static size_t dao_header_cache_len = 0;
+static size_t dao_header_cache_next = 0;
 
-  data->block_number = *((uint64_t *)block_number_seg.ptr);
-  memcpy(data->dao, dao_seg.ptr, 32);
-  return extract_epoch_info(*((uint64_t *)epoch_seg.ptr), 0,
-                            &(data->epoch_number), &(data->epoch_index),
-                            &(data->epoch_length));
+static int load_dao_header_data(size_t index, size_t source,
+                                dao_header_data_t *data) {
+  if (source != CKB_SOURCE_HEADER_DEP) {
+    return fetch_dao_header_data(index, source, data);
+  }
+  for (size_t i = 0; i < dao_header_cache_len; i++) {
+    if (dao_header_cache[i].source == source &&
+        dao_header_cache[i].index == index) {
+      *data = dao_header_cache[i].data;
+      return CKB_SUCCESS;
+    }
+  }
+  int ret = fetch_dao_header_data(index, source, data);
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  dao_header_cache_entry_t *entry = &dao_header_cache[dao_header_cache_next];
+  entry->source = source;
+  entry->index = index;
+  entry->data = *data;
+  dao_header_cache_next = (dao_header_cache_next + 1) % DAO_HEADER_CACHE_SIZE;
+  if (dao_header_cache_len < DAO_HEADER_CACHE_SIZE) {
+    dao_header_cache_len++;
+  }
+  return CKB_SUCCESS;
 }
 
 // Validates an input cell is indeed deposited to NervosDAO in
@@ -179,6 +287,7 @@ static int calculate_dao_input_capacity(size_t input_index,
   if (ret != CKB_SUCCESS) {
     return ret;
   }
+  CKB_PROFILE_PHASE("deposit_header_index");
 
   dao_header_data_t deposit_data;
   ret =
@@ -186,6 +295,7 @@ static int calculate_dao_input_capacity(size_t input_index,
   if (ret != CKB_SUCCESS) {
     return ret;
   }
+  CKB_PROFILE_PHASE("deposit_header");
   // deposited_block_number must match actual deposited block
   if (deposited_block_number != deposit_data.block_number) {
     return ERROR_INVALID_WITHDRAW_BLOCK;
@@ -196,6 +306,7 @@ static int calculate_dao_input_capacity(size_t input_index,
   if (ret != CKB_SUCCESS) {
     return ret;
   }
+  CKB_PROFILE_PHASE("withdraw_header");
 
   uint64_t withdraw_fraction =
       withdraw_data.epoch_index * deposit_data.epoch_length;
@@ -239,6 +350,7 @@ static int calculate_dao_input_capacity(size_t input_index,
       deposit_data.epoch_number + lock_epoches;
   uint64_t minimal_since_epoch_index = deposit_data.epoch_index;
   uint64_t minimal_since_epoch_length = deposit_data.epoch_length;
+  CKB_PROFILE_PHASE("lock_period");
 
   // Loads since value from current input to make sure correct lock period is set.
   uint64_t input_since = 0;
@@ -276,6 +388,7 @@ static int calculate_dao_input_capacity(size_t input_index,
        (input_since_epoch_fraction < minimal_since_epoch_fraction))) {
     return ERROR_INCORRECT_SINCE;
   }
+  CKB_PROFILE_PHASE("since");
 
   // Now we can calculate the maximum amount one can withdraw from this cell. Please
   // refer to Nervos DAO RFC for more details on the formula used here.
@@ -295,6 +408,7 @@ static int calculate_dao_input_capacity(size_t input_index,
   if (len != 8) {
     return ERROR_SYSCALL;
   }
+  CKB_PROFILE_PHASE("occupied_capacity");
 
   // Like any serious smart contracts, we will perform overflow checks here.
   uint64_t counted_capacity = 0;
@@ -315,6 +429,89 @@ static int calculate_dao_input_capacity(size_t input_index,
   }
 
   *calculated_capacity = withdraw_capacity;
+  CKB_PROFILE_PHASE("withdraw_capacity");
+  return CKB_SUCCESS;
+}
+
+// The running NervosDAO script, both serialized and hashed. A cell uses the
+// NervosDAO type script when its type script has the same serialized bytes, or
+// the same type hash when the type hash is loaded instead.
+typedef struct {
+  unsigned char script[DAO_SCRIPT_SIZE];
+  uint64_t script_len;
+  unsigned char hash[HASH_SIZE];
+} dao_script_t;
+
+// The parts of a cell checked by the NervosDAO script.
+typedef struct {
+  uint64_t capacity;
+  int has_type;
+  int is_dao;
+} dao_cell_t;
+
+// Loads a cell in one ckb_load_cell syscall, then parses the capacity and the
+// type script out of CellOutput. When the cell has a type script, it is compared
+// with the running script directly, so no type hash is needed. Cells too large
+// for the buffer are loaded field by field instead. Syscall errors, including
+// CKB_INDEX_OUT_OF_BOUND for a missing cell, are returned as is.
+static int load_dao_cell(size_t index, size_t source,
+                         const dao_script_t *dao_script, dao_cell_t *cell) {
+  uint8_t buffer[CELL_OUTPUT_SIZE];
+  uint64_t len = CELL_OUTPUT_SIZE;
+  int ret = ckb_load_cell(buffer, &len, 0, index, source);
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  if (len <= CELL_OUTPUT_SIZE) {
+    mol_seg_t cell_seg;
+    cell_seg.ptr = buffer;
+    cell_seg.size = len;
+    // The lock script is not needed here, only capacity and type script are
+    // verified.
+    mol_seg_t capacity_seg;
+    if (MolLazyReader_CellOutput_get_capacity(&cell_seg, &capacity_seg) !=
+            MOL_OK ||
+        MolReader_Uint64_verify(&capacity_seg, false) != MOL_OK) {
+      return ERROR_ENCODING;
+    }
+    cell->capacity = *((uint64_t *)capacity_seg.ptr);
+    // The type script is only compared byte by byte, it needs no verifying.
+    mol_seg_t type_seg;
+    if (MolLazyReader_CellOutput_get_type_(&cell_seg, &type_seg) != MOL_OK) {
+      return ERROR_ENCODING;
+    }
+    cell->has_type = !MolReader_ScriptOpt_is_none(&type_seg);
+    cell->is_dao = cell->has_type && type_seg.size == dao_script->script_len &&
+                   memcmp(type_seg.ptr, dao_script->script, type_seg.size) == 0;
+    return CKB_SUCCESS;
+  }
+
+  len = 8;
+  ret = ckb_load_cell_by_field((unsigned char *)&cell->capacity, &len, 0, index,
+                               source, CKB_CELL_FIELD_CAPACITY);
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  if (len != 8) {
+    return ERROR_SYSCALL;
+  }
+  unsigned char type_hash[HASH_SIZE];
+  len = HASH_SIZE;
+  ret = ckb_load_cell_by_field(type_hash, &len, 0, index, source,
+                               CKB_CELL_FIELD_TYPE_HASH);
+  if (ret == CKB_ITEM_MISSING) {
+    cell->has_type = 0;
+    cell->is_dao = 0;
+    return CKB_SUCCESS;
+  }
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  if (len != HASH_SIZE) {
+    return ERROR_SYSCALL;
+  }
+  cell->has_type = 1;
+  cell->is_dao = memcmp(type_hash, dao_script->hash, HASH_SIZE) == 0;
   return CKB_SUCCESS;
 }
 
@@ -333,43 +530,33 @@ static int calculate_dao_input_capacity(size_t input_index,
 // Since this will be part of the transaction, an input lock script shall
 // validate the lock script cannot be tampered.
 static int validate_withdrawing_cell(size_t index, uint64_t input_capacity,
-                                     unsigned char *dao_script_hash) {
-  unsigned char hash1[HASH_SIZE];
-  uint64_t len = HASH_SIZE;
-  // Check type script
-  len = HASH_SIZE;
-  int ret = ckb_load_cell_by_field(hash1, &len, 0, index, CKB_SOURCE_OUTPUT,
-                               CKB_CELL_FIELD_TYPE_HASH);
+                                     const dao_script_t *dao_script) {
+  uint64_t len = 0;
+  dao_cell_t output;
+  int ret = load_dao_cell(index, CKB_SOURCE_OUTPUT, dao_script, &output);
   if (ret != CKB_SUCCESS) {
     return ret;
   }
-  if (len != HASH_SIZE) {
-    return ERROR_SYSCALL;
+  // Check type script, a cell without type script is reported the same way as
+  // the type hash syscall does.
+  if (!output.has_type) {
+    return CKB_ITEM_MISSING;
   }
-  if (memcmp(hash1, dao_script_hash, HASH_SIZE) != 0) {
+  if (!output.is_dao) {
     return ERROR_INVALID_WITHDRAWING_CELL;
   }
   // Check capacity
-  uint64_t output_capacity = 0;
-  len = 8;
-  ret =
-      ckb_load_cell_by_field((unsigned char *)&output_capacity, &len, 0, index,
-                             CKB_SOURCE_OUTPUT, CKB_CELL_FIELD_CAPACITY);
-  if (ret != CKB_SUCCESS) {
-    return ret;
-  }
-  if (len != 8) {
-    return ERROR_SYSCALL;
-  }
-  if (output_capacity != input_capacity) {
+  if (output.capacity != input_capacity) {
     return ERROR_INVALID_WITHDRAWING_CELL;
   }
+  CKB_PROFILE_PHASE("withdrawing_output");
   // Check cell data
   dao_header_data_t deposit_header;
   ret = load_dao_header_data(index, CKB_SOURCE_INPUT, &deposit_header);
   if (ret != CKB_SUCCESS) {
     return ret;
   }
+  CKB_PROFILE_PHASE("withdrawing_deposit_header");
   uint64_t stored_block_number = 0;
   len = 8;
   ret = ckb_load_cell_data((unsigned char *)&stored_block_number, &len, 0,
@@ -383,13 +570,13 @@ static int validate_withdrawing_cell(size_t index, uint64_t input_capacity,
   if (stored_block_number != deposit_header.block_number) {
     return ERROR_INVALID_WITHDRAWING_CELL;
   }
+  CKB_PROFILE_PHASE("withdrawing_cell_data");
   return CKB_SUCCESS;
 }
 
 int main() {
   int ret;
-  unsigned char script_hash[HASH_SIZE];
-  unsigned char script[SCRIPT_SIZE];
+  dao_script_t dao_script;
   uint64_t len = 0;
   mol_seg_t script_seg;
   mol_seg_t args_seg;
@@ -397,7 +584,13 @@ int main() {
 
   // NervosDAO script requires script args part to be empty, this way we can ensure
   // that all DAO related scripts in a transaction is mapped to the same group, and
-  // processed together in one execution.
+  // processed together in one execution. Only a copy of the small script is kept
+  // after this check, the buffer is released right after.
+  size_t arena_mark = ckb_arena_mark();
+  unsigned char *script = ckb_arena_alloc(SCRIPT_SIZE);
+  if (script == NULL) {
+    return CKB_ARENA_ERROR_EXHAUSTED;
+  }
   len = SCRIPT_SIZE;
   ret = ckb_load_script(script, &len, 0);
   if (ret != CKB_SUCCESS) {
@@ -408,28 +601,36 @@ int main() {
   }
   script_seg.ptr = (uint8_t *)script;
   script_seg.size = len;
-  if (MolReader_Script_verify(&script_seg, false) != MOL_OK) {
+  if (MolLazyReader_Script_get_args(&script_seg, &args_seg) != MOL_OK ||
+      MolReader_Bytes_verify(&args_seg, false) != MOL_OK) {
     return ERROR_ENCODING;
   }
-  args_seg = MolReader_Script_get_args(&script_seg);
   bytes_seg = MolReader_Bytes_raw_bytes(&args_seg);
   if (bytes_seg.size != 0) {
     return ERROR_WRONG_NUMBER_OF_ARGUMENTS;
   }
+  if (len > DAO_SCRIPT_SIZE) {
+    return ERROR_SCRIPT_TOO_LONG;
+  }
+  memcpy(dao_script.script, script, len);
+  dao_script.script_len = len;
+  ckb_arena_release(arena_mark);
 
   // Load current script hash. Unlike a lock script which only cares for cells
   // using its own lock script. The NervosDAO script here will need to loop
   // through all cells to ensure the output cells contain a valid number of
   // capacities. Hence we need to manually check if a cell uses the NervosDAO
-  // type script.
+  // type script. Most cells are checked by comparing their type script with the
+  // copy kept above, the hash is used for the cells loaded field by field.
   len = HASH_SIZE;
-  ret = ckb_load_script_hash(script_hash, &len, 0);
+  ret = ckb_load_script_hash(dao_script.hash, &len, 0);
   if (ret != CKB_SUCCESS) {
     return ret;
   }
   if (len != HASH_SIZE) {
     return ERROR_SYSCALL;
   }
+  CKB_PROFILE_PHASE("script");
 
   // First, we will need to loop against all input cells in current transaction.
   // For a normal transaction, we will just add up its own capacity. For a
@@ -439,35 +640,23 @@ int main() {
   // containing the *true* capacities of all the input cells here.
   size_t index = 0;
   uint64_t input_capacities = 0;
-#if MAX_OUTPUT_LENGTH > 64
-#error "Masking solutioin can only work with 64 outputs at most!"
-#endif
-  uint64_t output_withdrawing_mask = 0;
+  uint64_t output_withdrawing_bitset[OUTPUT_BITSET_WORDS];
+  memset(output_withdrawing_bitset, 0, sizeof(output_withdrawing_bitset));
   while (1) {
-    int dao_input = 0;
-    uint64_t capacity = 0;
-    len = 8;
-    ret = ckb_load_cell_by_field(((unsigned char *)&capacity), &len, 0, index,
-                                 CKB_SOURCE_INPUT, CKB_CELL_FIELD_CAPACITY);
+    // When an input cell has the same type script as current running one, we
+    // know we are dealing with a script using NervosDAO script.
+    dao_cell_t input;
+    ret = load_dao_cell(index, CKB_SOURCE_INPUT, &dao_script, &input);
     if (ret == CKB_INDEX_OUT_OF_BOUND) {
       break;
-    } else if (ret == CKB_SUCCESS) {
-      if (len != 8) {
-        return ERROR_SYSCALL;
-      }
-      unsigned char current_script_hash[HASH_SIZE];
-      len = HASH_SIZE;
-      ret = ckb_load_cell_by_field(current_script_hash, &len, 0, index,
-                                   CKB_SOURCE_INPUT, CKB_CELL_FIELD_TYPE_HASH);
-      // When an input cell has the same type script hash as current running
-      // we know we are dealing with a script using NervosDAO script.
-      if ((ret == CKB_SUCCESS) && len == HASH_SIZE &&
-          (memcmp(script_hash, current_script_hash, HASH_SIZE) == 0)) {
-        dao_input = 1;
-      }
-    } else {
+    } else if (ret == ERROR_ENCODING) {
+      return ret;
+    } else if (ret != CKB_SUCCESS) {
       return ERROR_SYSCALL;
     }
+    CKB_PROFILE_PHASE("input_cells");
+    int dao_input = input.is_dao;
+    uint64_t capacity = input.capacity;
 
     if (!dao_input) {
       // Normal input, use its own capacity
@@ -499,6 +688,7 @@ int main() {
       if (len != 8) {
         return ERROR_SYSCALL;
       }
+      CKB_PROFILE_PHASE("input_cell_data");
 
       if (block_number > 0) {
         // For a withdrawing cell, we can start calculate the maximum capacity
@@ -520,17 +710,17 @@ int main() {
         // the withdrawing cell must at the same index with the deposited cell.
         // Due to the fact that one deposited cell is mapped to exactly one
         // withdrawing cell, this would work fine here.
-        ret = validate_withdrawing_cell(index, capacity, script_hash);
+        ret = validate_withdrawing_cell(index, capacity, &dao_script);
         if (ret != CKB_SUCCESS) {
           return ret;
         }
         // Note that `validate_withdrawing_cell` above already verifies that an
-        // output cell for the current input cell at the same location exists. If
-        // the current input cell has index equal to or larger than 64, it means we
-        // will also have an output cell that thas index equal to or larger than
-        // 64, which will trigger an error. Hence we don't need to check for
-        // overflows for `1 << index` operation.
-        output_withdrawing_mask |= (1 << index);
+        // output cell for the current input cell at the same location exists, so
+        // an index beyond the bitset means there are too many output cells.
+        if (index >= MAX_OUTPUT_LENGTH) {
+          return ERROR_TOO_MANY_OUTPUT_CELLS;
+        }
+        output_bitset_set(output_withdrawing_bitset, index);
         // Like any serious smart contracts, we will perform overflow checks here.
         if (__builtin_uaddl_overflow(input_capacities, capacity,
                                      &input_capacities)) {
@@ -547,21 +737,16 @@ int main() {
   index = 0;
   uint64_t output_capacities = 0;
   while (1) {
-    uint64_t capacity = 0;
-    len = 8;
-    ret = ckb_load_cell_by_field(((unsigned char *)&capacity), &len, 0, index,
-                                 CKB_SOURCE_OUTPUT, CKB_CELL_FIELD_CAPACITY);
+    dao_cell_t output;
+    ret = load_dao_cell(index, CKB_SOURCE_OUTPUT, &dao_script, &output);
     if (ret == CKB_INDEX_OUT_OF_BOUND) {
       break;
     }
     if (ret != CKB_SUCCESS) {
       return ret;
     }
-    if (len != 8) {
-      return ERROR_SYSCALL;
-    }
-    // For simplicity we are limiting to 64 output cells at most, so we can use
-    // simple bit masking.
+    uint64_t capacity = output.capacity;
+    // Output cells are limited to MAX_OUTPUT_LENGTH, so they fit in the bitset.
     if (index >= MAX_OUTPUT_LENGTH) {
       return ERROR_TOO_MANY_OUTPUT_CELLS;
     }
@@ -571,16 +756,11 @@ int main() {
       return ERROR_OVERFLOW;
     }
 
-    unsigned char current_script_hash[HASH_SIZE];
-    len = HASH_SIZE;
-    ret = ckb_load_cell_by_field(current_script_hash, &len, 0, index,
-                                 CKB_SOURCE_OUTPUT, CKB_CELL_FIELD_TYPE_HASH);
-    if ((ret == CKB_SUCCESS) && len == HASH_SIZE &&
-        (memcmp(script_hash, current_script_hash, HASH_SIZE) == 0)) {
+    if (output.is_dao) {
       // Similar to the above loop, we also need to check if we are creating a
       // deposited cell, or a withdrawing cell here. This can be easily determined
-      // using `output_withdrawing_mask` here: in previous iteration we've marked
-      // all created withdrawing cells in the bit mask.
+      // using `output_withdrawing_bitset` here: in previous iteration we've marked
+      // all created withdrawing cells in the bitset.
       //
       // For withdrawing cells, we already perform all the necessary checks when
       // we are checking the corresponding deposited cells above. No further
@@ -588,7 +768,7 @@ int main() {
       //
       // For newly deposited cells, we need to validate that the cell data part
       // contains 8 bytes of data filled with 0.
-      if ((output_withdrawing_mask & (1 << index)) == 0) {
+      if (!output_bitset_test(output_withdrawing_bitset, index)) {
         uint64_t block_number = 0;
         len = 8;
         ret = ckb_load_cell_data((unsigned char *)&block_number, &len, 0, index,
@@ -607,6 +787,7 @@ int main() {
 
     index += 1;
   }
+  CKB_PROFILE_PHASE("output_cells");
 
   // The final thing we need to check here, is that the sum of capacities in output
   // cells, cannot exceed the sum of capacities in all input cells with Nervos DAO
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "blake2b.h"
+
+#define ERROR_IO -1
+#define ERROR_ARGUMENTS -2
+
+/*
+ * Writes the info header of a crypto library binary, with its size and data
+ * hash, which lock scripts loading the library are compiled with.
+ */
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <library path> <info path>\n", argv[0]);
+    return ERROR_ARGUMENTS;
+  }
+  FILE* fp_lib = fopen(argv[1], "rb");
+  if (!fp_lib) {
+    return ERROR_IO;
+  }
+  blake2b_state blake2b_ctx;
+  blake2b_init(&blake2b_ctx, 32);
+  uint8_t buf[4096];
+  size_t size = 0;
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp_lib)) > 0) {
+    blake2b_update(&blake2b_ctx, buf, n);
+    size += n;
+  }
+  fclose(fp_lib);
+  uint8_t hash[32];
+  blake2b_final(&blake2b_ctx, hash, 32);
+
+  FILE* fp = fopen(argv[2], "w");
+  if (!fp) {
+    return ERROR_IO;
+  }
+  fprintf(fp, "#ifndef CKB_CRYPTO_LIB_INFO_H_\n");
+  fprintf(fp, "#define CKB_CRYPTO_LIB_INFO_H_\n");
+  fprintf(fp, "#define CKB_CRYPTO_LIB_SIZE %ld\n", size);
+  fprintf(fp, "static uint8_t ckb_crypto_lib_data_hash[32] = {\n  ");
+  for (int i = 0; i < 32; i++) {
+    fprintf(fp, "%u", hash[i]);
+    if (i != 31) {
+      fprintf(fp, ", ");
+    }
+  }
+  fprintf(fp, "\n};\n");
+  fprintf(fp, "#endif\n");
+  fclose(fp);
+  return 0;
+}
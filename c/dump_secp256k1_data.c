@@ -10,20 +10,48 @@
 #include <secp256k1.c>
 
 #define ERROR_IO -1
+#define ERROR_ARGUMENTS -2
 
-int main(int argc, char* argv[]) {
-  size_t pre_size = sizeof(secp256k1_ecmult_static_pre_context);
-  size_t pre128_size = sizeof(secp256k1_ecmult_static_pre128_context);
+#define DEFAULT_DATA_PATH "specs/cells/secp256k1_data"
+#define DEFAULT_INFO_PATH "build/secp256k1_data_info.h"
 
-  FILE* fp_data = fopen("specs/cells/secp256k1_data", "wb");
+/*
+ * Tables for dumping in runtime mode, they use the WINDOW_G this dumper is
+ * compiled with, which can be changed via ECMULT_WINDOW_SIZE.
+ */
+static secp256k1_ge_storage runtime_pre_g[ECMULT_TABLE_SIZE(WINDOW_G)];
+static secp256k1_ge_storage runtime_pre_g_128[ECMULT_TABLE_SIZE(WINDOW_G)];
+
+/*
+ * Same calculation as secp256k1_ecmult_context_build, but into static
+ * tables so we don't need an allocator here.
+ */
+static void build_runtime_tables() {
+  secp256k1_gej gj;
+  secp256k1_gej_set_ge(&gj, &secp256k1_ge_const_g);
+  secp256k1_ecmult_odd_multiples_table_storage_var(ECMULT_TABLE_SIZE(WINDOW_G),
+                                                   runtime_pre_g, &gj);
+
+  /* calculate 2^128*generator */
+  secp256k1_gej g_128j = gj;
+  for (int i = 0; i < 128; i++) {
+    secp256k1_gej_double_var(&g_128j, &g_128j, NULL);
+  }
+  secp256k1_ecmult_odd_multiples_table_storage_var(ECMULT_TABLE_SIZE(WINDOW_G),
+                                                   runtime_pre_g_128, &g_128j);
+}
+
+static int dump(const char* data_path, const char* info_path, const void* pre,
+                size_t pre_size, const void* pre128, size_t pre128_size) {
+  FILE* fp_data = fopen(data_path, "wb");
   if (!fp_data) {
     return ERROR_IO;
   }
-  fwrite(secp256k1_ecmult_static_pre_context, pre_size, 1, fp_data);
-  fwrite(secp256k1_ecmult_static_pre128_context, pre128_size, 1, fp_data);
+  fwrite(pre, pre_size, 1, fp_data);
+  fwrite(pre128, pre128_size, 1, fp_data);
   fclose(fp_data);
 
-  FILE* fp = fopen("build/secp256k1_data_info.h", "w");
+  FILE* fp = fopen(info_path, "w");
   if (!fp) {
     return ERROR_IO;
   }
@@ -33,13 +61,13 @@ int main(int argc, char* argv[]) {
   fprintf(fp, "#define CKB_SECP256K1_DATA_SIZE %ld\n", pre_size + pre128_size);
   fprintf(fp, "#define CKB_SECP256K1_DATA_PRE_SIZE %ld\n", pre_size);
   fprintf(fp, "#define CKB_SECP256K1_DATA_PRE128_SIZE %ld\n", pre128_size);
+  fprintf(fp, "#define CKB_SECP256K1_DATA_WINDOW_SIZE %d\n", WINDOW_G);
 
   blake2b_state blake2b_ctx;
   uint8_t hash[32];
   blake2b_init(&blake2b_ctx, 32);
-  blake2b_update(&blake2b_ctx, secp256k1_ecmult_static_pre_context, pre_size);
-  blake2b_update(&blake2b_ctx, secp256k1_ecmult_static_pre128_context,
-                 pre128_size);
+  blake2b_update(&blake2b_ctx, pre, pre_size);
+  blake2b_update(&blake2b_ctx, pre128, pre128_size);
   blake2b_final(&blake2b_ctx, hash, 32);
 
   fprintf(fp, "static uint8_t ckb_secp256k1_data_hash[32] = {\n  ");
@@ -55,3 +83,28 @@ int main(int argc, char* argv[]) {
 
   return 0;
 }
+
+/*
+ * Without arguments, the static precomputed tables are dumped to
+ * specs/cells/secp256k1_data and build/secp256k1_data_info.h.
+ *
+ * With a data path and an info path as arguments, the tables are computed
+ * in runtime for the window size this dumper is compiled with, this is used
+ * to build variants of secp256k1_data with different window sizes.
+ */
+int main(int argc, char* argv[]) {
+  if (argc == 1) {
+    return dump(DEFAULT_DATA_PATH, DEFAULT_INFO_PATH,
+                secp256k1_ecmult_static_pre_context,
+                sizeof(secp256k1_ecmult_static_pre_context),
+                secp256k1_ecmult_static_pre128_context,
+                sizeof(secp256k1_ecmult_static_pre128_context));
+  }
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s [<data path> <info path>]\n", argv[0]);
+    return ERROR_ARGUMENTS;
+  }
+  build_runtime_tables();
+  return dump(argv[1], argv[2], runtime_pre_g, sizeof(runtime_pre_g),
+              runtime_pre_g_128, sizeof(runtime_pre_g_128));
+}
@@ -0,0 +1,74 @@
+/*
+molecule_lazy.h
+
+Verify-on-access readers for the molecule tables in protocol.h. The generated
+MolReader_*_verify functions walk every field of a table before any of them
+is read, while scripts usually need a single field out of it. The readers
+here only check what is on the path to the requested field: the total size,
+the table header, and the two offsets bounding the field. The returned
+segment is always within the input, callers then verify the field itself
+with its own MolReader_*_verify, before reading anything out of it.
+
+Fields which are not accessed are not verified, so a table with a malformed
+field elsewhere is no longer rejected by the reader of another field.
+*/
+
+#ifndef CKB_MOLECULE_LAZY_H_
+#define CKB_MOLECULE_LAZY_H_
+
+#include "protocol.h"
+
+/* Slices field field_index out of a table with field_count fields, tables
+ with extra fields are only accepted in compatible mode */
+mol_errno mol_lazy_table_slice_by_index(const mol_seg_t *input,
+                                        mol_num_t field_count, bool compatible,
+                                        mol_num_t field_index,
+                                        mol_seg_t *field) {
+  if (input->size < MOL_NUM_T_SIZE * 2) {
+    return MOL_ERR_HEADER;
+  }
+  mol_num_t total_size = mol_unpack_number(input->ptr);
+  if (input->size != total_size) {
+    return MOL_ERR_TOTAL_SIZE;
+  }
+  mol_num_t first_offset = mol_unpack_number(input->ptr + MOL_NUM_T_SIZE);
+  if (first_offset % 4 > 0 || first_offset < MOL_NUM_T_SIZE * 2) {
+    return MOL_ERR_OFFSET;
+  }
+  mol_num_t actual_field_count = first_offset / 4 - 1;
+  if (actual_field_count < field_count ||
+      (!compatible && actual_field_count > field_count)) {
+    return MOL_ERR_FIELD_COUNT;
+  }
+  if (field_index >= field_count) {
+    return MOL_ERR_INDEX_OUT_OF_BOUNDS;
+  }
+  if (total_size < first_offset) {
+    return MOL_ERR_HEADER;
+  }
+  mol_num_t start =
+      mol_unpack_number(input->ptr + MOL_NUM_T_SIZE * (field_index + 1));
+  mol_num_t end = total_size;
+  if (field_index + 1 < actual_field_count) {
+    end = mol_unpack_number(input->ptr + MOL_NUM_T_SIZE * (field_index + 2));
+  }
+  if (start < first_offset || start > end || end > total_size) {
+    return MOL_ERR_OFFSET;
+  }
+  field->ptr = input->ptr + start;
+  field->size = end - start;
+  return MOL_OK;
+}
+
+#define MolLazyReader_Script_get_args(s, f) \
+  mol_lazy_table_slice_by_index(s, 3, false, 2, f)
+#define MolLazyReader_CellOutput_get_capacity(s, f) \
+  mol_lazy_table_slice_by_index(s, 3, false, 0, f)
+#define MolLazyReader_CellOutput_get_type_(s, f) \
+  mol_lazy_table_slice_by_index(s, 3, false, 2, f)
+#define MolLazyReader_WitnessArgs_get_lock(s, f) \
+  mol_lazy_table_slice_by_index(s, 3, false, 0, f)
+#define MolLazyReader_WitnessArgs_get_input_type(s, f) \
+  mol_lazy_table_slice_by_index(s, 3, false, 1, f)
+
+#endif /* CKB_MOLECULE_LAZY_H_ */
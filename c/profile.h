@@ -0,0 +1,136 @@
+/*
+profile.h
+
+Per-phase instrumentation for the native replay builds of the scripts,
+enabled by compiling with CKB_SCRIPT_PROFILE defined (see `make profile`
+and CMakeLists.txt). Scripts mark the end of
+each phase with CKB_PROFILE_PHASE(name), the cycles spent since the
+previous mark are added to the named phase, so a phase run once per input
+cell is summed up over all of them. When the script returns, the summary is
+printed with ckb_debug as one line:
+
+  profile script=1234 witness=567 ... total=89012
+
+The numbers are nanoseconds of the monotonic clock. CKB-VM at the ckb
+version pinned in Cargo.toml has neither a cycle syscall nor the cycle CSRs,
+a RISC-V build reading rdcycle would trap at its first phase mark, so this
+mode is refused there. The first phase also includes reading the replay
+file, which happens on the first syscall. Without CKB_SCRIPT_PROFILE all the
+macros expand to nothing.
+*/
+
+#ifndef CKB_PROFILE_H_
+#define CKB_PROFILE_H_
+
+#ifdef CKB_SCRIPT_PROFILE
+
+#if defined(__riscv)
+#error "CKB_SCRIPT_PROFILE needs a cycle source CKB-VM lacks, profile the native replay build"
+#endif
+
+#include <string.h>
+#include <time.h>
+
+#include "ckb_syscalls.h"
+
+#define CKB_PROFILE_MAX_PHASES 16
+#define CKB_PROFILE_MESSAGE_SIZE 512
+
+typedef struct {
+  const char *name;
+  uint64_t cycles;
+} ckb_profile_phase_t;
+
+static ckb_profile_phase_t ckb_profile_phases[CKB_PROFILE_MAX_PHASES];
+static size_t ckb_profile_phases_len = 0;
+static uint64_t ckb_profile_start = 0;
+static uint64_t ckb_profile_last = 0;
+
+static uint64_t ckb_profile_cycles() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void ckb_profile_phase(const char *name) {
+  uint64_t now = ckb_profile_cycles();
+  uint64_t spent = now - ckb_profile_last;
+  ckb_profile_last = now;
+  for (size_t i = 0; i < ckb_profile_phases_len; i++) {
+    if (strcmp(ckb_profile_phases[i].name, name) == 0) {
+      ckb_profile_phases[i].cycles += spent;
+      return;
+    }
+  }
+  /* phases beyond the limit are only counted in the total */
+  if (ckb_profile_phases_len < CKB_PROFILE_MAX_PHASES) {
+    ckb_profile_phases[ckb_profile_phases_len].name = name;
+    ckb_profile_phases[ckb_profile_phases_len].cycles = spent;
+    ckb_profile_phases_len++;
+  }
+}
+
+static size_t ckb_profile_append(char *message, size_t pos, const char *name,
+                                 uint64_t value) {
+  char digits[20];
+  size_t n = 0;
+  do {
+    digits[n++] = '0' + (value % 10);
+    value /= 10;
+  } while (value > 0);
+  size_t name_len = strlen(name);
+  /* room for the separator, '=', the digits and the terminating zero */
+  if (pos + name_len + n + 3 > CKB_PROFILE_MESSAGE_SIZE) {
+    return pos;
+  }
+  message[pos++] = ' ';
+  memcpy(&message[pos], name, name_len);
+  pos += name_len;
+  message[pos++] = '=';
+  while (n > 0) {
+    message[pos++] = digits[--n];
+  }
+  return pos;
+}
+
+static void ckb_profile_report() {
+  char message[CKB_PROFILE_MESSAGE_SIZE] = "profile";
+  size_t pos = sizeof("profile") - 1;
+  for (size_t i = 0; i < ckb_profile_phases_len; i++) {
+    pos = ckb_profile_append(message, pos, ckb_profile_phases[i].name,
+                             ckb_profile_phases[i].cycles);
+  }
+  pos = ckb_profile_append(message, pos, "total",
+                           ckb_profile_cycles() - ckb_profile_start);
+  message[pos] = '\0';
+  ckb_debug(message);
+}
+
+/*
+ * The script's own main is renamed to ckb_profile_script_main, and wrapped
+ * by the main below, so the summary is printed on every return path of the
+ * script. main is a function-like macro here, which leaves the parenthesized
+ * (main) below alone.
+ */
+#define main() ckb_profile_script_main()
+int ckb_profile_script_main();
+
+int(main)() {
+  ckb_profile_start = ckb_profile_cycles();
+  ckb_profile_last = ckb_profile_start;
+  int ret = ckb_profile_script_main();
+  ckb_profile_report();
+  return ret;
+}
+
+#define CKB_PROFILE_PHASE(name) ckb_profile_phase(name)
+
+#else
+
+#define CKB_PROFILE_PHASE(name) \
+  do {                          \
+  } while (0)
+
+#endif /* CKB_SCRIPT_PROFILE */
+
+#endif /* CKB_PROFILE_H_ */
@@ -0,0 +1,147 @@
+#ifndef CKB_SECP256K1_BATCH_RECOVER_H_
+#define CKB_SECP256K1_BATCH_RECOVER_H_
+
+/*
+ * Batched public key recovery for several recoverable signatures signing
+ * the same message, this should be included after secp256k1_helper.h and
+ * arena.h.
+ *
+ * Each public key still needs its own point multiplication, since callers
+ * only know the blake160 hashes of the public keys, there is no way to
+ * combine the multiplications without losing the individual keys. What we
+ * can share is the rest of the work: the inversions of all signature R
+ * values are merged into a single scalar inversion, and the conversions of
+ * all recovered points to affine coordinates are merged into a single field
+ * inversion.
+ *
+ * The per signature state comes from the static arena instead of the stack,
+ * since count comes from the witness. It is released before returning.
+ */
+
+#define CKB_SECP256K1_BATCH_SIGNATURE_SIZE 65
+#define CKB_SECP256K1_BATCH_RECID_INDEX 64
+#define CKB_SECP256K1_BATCH_PUBKEY_SIZE 33
+
+static int ckb_secp256k1_batch_recover_with(
+    const secp256k1_context* ctx, const uint8_t* signatures, size_t count,
+    const uint8_t* msg32, uint8_t (*pubkeys)[CKB_SECP256K1_BATCH_PUBKEY_SIZE],
+    secp256k1_scalar* sigr, secp256k1_scalar* sigs, secp256k1_scalar* acc,
+    secp256k1_gej* points, secp256k1_ge* keys) {
+  secp256k1_scalar m;
+  secp256k1_scalar_set_b32(&m, msg32, NULL);
+
+  /* Decompress all R points, the same way as secp256k1_ecdsa_sig_recover */
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t* p = &signatures[i * CKB_SECP256K1_BATCH_SIGNATURE_SIZE];
+    secp256k1_ecdsa_recoverable_signature signature;
+    int recid;
+    if (secp256k1_ecdsa_recoverable_signature_parse_compact(
+            ctx, &signature, p, p[CKB_SECP256K1_BATCH_RECID_INDEX]) == 0) {
+      return 0;
+    }
+    secp256k1_ecdsa_recoverable_signature_load(ctx, &sigr[i], &sigs[i], &recid,
+                                               &signature);
+    if (secp256k1_scalar_is_zero(&sigr[i]) ||
+        secp256k1_scalar_is_zero(&sigs[i])) {
+      return 0;
+    }
+    unsigned char brx[32];
+    secp256k1_fe fx;
+    secp256k1_ge x;
+    secp256k1_scalar_get_b32(brx, &sigr[i]);
+    /* brx comes from a scalar, so is less than the order; certainly less
+     * than p */
+    secp256k1_fe_set_b32(&fx, brx);
+    if (recid & 2) {
+      if (secp256k1_fe_cmp_var(&fx, &secp256k1_ecdsa_const_p_minus_order) >=
+          0) {
+        return 0;
+      }
+      secp256k1_fe_add(&fx, &secp256k1_ecdsa_const_order_as_fe);
+    }
+    if (!secp256k1_ge_set_xo_var(&x, &fx, recid & 1)) {
+      return 0;
+    }
+    secp256k1_gej_set_ge(&points[i], &x);
+  }
+
+  /*
+   * Invert all R values with one inversion: acc[i] holds the product of
+   * sigr[0..i], after inverting the full product, walking backwards yields
+   * the inverse of each sigr[i], which then replaces sigr[i].
+   */
+  acc[0] = sigr[0];
+  for (size_t i = 1; i < count; i++) {
+    secp256k1_scalar_mul(&acc[i], &acc[i - 1], &sigr[i]);
+  }
+  secp256k1_scalar inv;
+  secp256k1_scalar_inverse_var(&inv, &acc[count - 1]);
+  for (size_t i = count - 1; i > 0; i--) {
+    secp256k1_scalar rn;
+    secp256k1_scalar_mul(&rn, &inv, &acc[i - 1]);
+    secp256k1_scalar_mul(&inv, &inv, &sigr[i]);
+    sigr[i] = rn;
+  }
+  sigr[0] = inv;
+
+  /* Q = r^-1 * (s * R - m * G) */
+  for (size_t i = 0; i < count; i++) {
+    secp256k1_scalar u1, u2;
+    secp256k1_scalar_mul(&u1, &sigr[i], &m);
+    secp256k1_scalar_negate(&u1, &u1);
+    secp256k1_scalar_mul(&u2, &sigr[i], &sigs[i]);
+    secp256k1_gej xj = points[i];
+    secp256k1_ecmult(&ctx->ecmult_ctx, &points[i], &xj, &u2, &u1);
+    if (secp256k1_gej_is_infinity(&points[i])) {
+      return 0;
+    }
+  }
+
+  /* All recovered points share one field inversion here */
+  secp256k1_ge_set_all_gej_var(keys, points, count);
+  for (size_t i = 0; i < count; i++) {
+    size_t pubkey_size = CKB_SECP256K1_BATCH_PUBKEY_SIZE;
+    if (!secp256k1_eckey_pubkey_serialize(&keys[i], pubkeys[i], &pubkey_size,
+                                          1) ||
+        pubkey_size != CKB_SECP256K1_BATCH_PUBKEY_SIZE) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * signatures holds count consecutive 65-byte signatures, each one is a
+ * 64-byte compact recoverable signature followed by the recovery ID.
+ * The compressed public keys are written to pubkeys in the same order.
+ *
+ * Returns 1 when all public keys are recovered, 0 otherwise, including when
+ * the arena can't hold the state of count signatures. The failing signature
+ * is not reported here, callers are expected to fall back to
+ * secp256k1_ecdsa_recover for each signature to get a precise error.
+ */
+int ckb_secp256k1_batch_recover(
+    const secp256k1_context* ctx, const uint8_t* signatures, size_t count,
+    const uint8_t* msg32,
+    uint8_t (*pubkeys)[CKB_SECP256K1_BATCH_PUBKEY_SIZE]) {
+  if (count == 0) {
+    return 1;
+  }
+  size_t arena_mark = ckb_arena_mark();
+  secp256k1_scalar* sigr = ckb_arena_alloc(count * sizeof(secp256k1_scalar));
+  secp256k1_scalar* sigs = ckb_arena_alloc(count * sizeof(secp256k1_scalar));
+  secp256k1_scalar* acc = ckb_arena_alloc(count * sizeof(secp256k1_scalar));
+  secp256k1_gej* points = ckb_arena_alloc(count * sizeof(secp256k1_gej));
+  secp256k1_ge* keys = ckb_arena_alloc(count * sizeof(secp256k1_ge));
+  int ret = 0;
+  if (sigr != NULL && sigs != NULL && acc != NULL && points != NULL &&
+      keys != NULL) {
+    ret = ckb_secp256k1_batch_recover_with(ctx, signatures, count, msg32,
+                                           pubkeys, sigr, sigs, acc, points,
+                                           keys);
+  }
+  ckb_arena_release(arena_mark);
+  return ret;
+}
+
+#endif /* CKB_SECP256K1_BATCH_RECOVER_H_ */
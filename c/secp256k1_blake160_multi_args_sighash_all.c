@@ -0,0 +1,300 @@
+// # secp256k1-blake160-multi-args-sighash-all
+//
+// This is a variant of the [single signing script](./secp256k1_blake160_sighash_all)
+// for funds spread across many addresses owned by the same key. The script args are the
+// blake160 hash of the public key, followed by any number of bytes telling the addresses
+// apart:
+//
+// +-------------+------------------------------------+-------+
+// |             |           Description              | Bytes |
+// +-------------+------------------------------------+-------+
+// | PubKeyHash  | blake160 of the public key         |    20 |
+// | Suffix      | anything, can be empty             |     ? |
+// +-------------+------------------------------------+-------+
+//
+// Each distinct args value is still its own lock group, and CKB still runs this script
+// once per group, but only one of those runs verifies a signature. Of all inputs locked by
+// this script code with the same public key hash, the one with the lowest index decides:
+//
+// * The group owning that input is the leading group. It verifies one recoverable
+// signature, in the lock field of its first witness, over a message committing to the
+// witnesses of every input locked with the same public key hash, no matter which group
+// they belong to.
+// * Every other group with the same public key hash returns success once it has found an
+// input of the leading group in front of its own inputs. The leading group is run by CKB
+// just as well, and the transaction only passes when it does.
+//
+// The signature covers the transaction hash, so it covers the inputs of all groups, and
+// the message covers their witnesses, so nothing a following group is guarded by is left
+// unsigned. An input locked by someone else with the same public key hash can take the
+// lead, but then it is that group which has to provide the signature.
+//
+// The message is the blake2b hash of the following, each witness being preceded by its
+// length as a 64-bit unsigned little endian integer:
+//
+// * The current transaction hash;
+// * The witness of the leading input, with the 65-byte lock field filled with zeros;
+// * The witnesses of all the following inputs locked with the same public key hash, in
+// input order;
+// * All the witnesses with index values equal to or larger than the number of inputs.
+//
+// When all inputs of a transaction share one key, this is the message of the single
+// signing script for a group made of all the inputs. A transaction consolidating K
+// addresses of one key then costs one recovery and one secp256k1_data load instead of K.
+//
+// This variant is not part of the deployed scripts, `make multi-args-sighash-all` builds
+// it into build/, and `make bench-multi-args-sighash-all` compares its cycles with the
+// single signing script.
+#include "blake2b.h"
+#include "ckb_syscalls.h"
+#include "common.h"
+#include "protocol.h"
+#include "secp256k1_helper.h"
+
+// Common definitions here, the same limits as the single signing script apply.
+#define BLAKE2B_BLOCK_SIZE 32
+#define BLAKE160_SIZE 20
+#define PUBKEY_SIZE 33
+#define TEMP_SIZE 32768
+#define RECID_INDEX 64
+/* 32 KB */
+#define MAX_WITNESS_SIZE 32768
+#define SCRIPT_SIZE 32768
+#define SIGNATURE_SIZE 65
+
+// Compile-time guard against buffer abuse
+#if (MAX_WITNESS_SIZE > TEMP_SIZE) || (SCRIPT_SIZE > TEMP_SIZE)
+#error "Temp buffer is not big enough!"
+#endif
+
+// code_hash and hash_type have fixed sizes, so in a serialized Script the header, both
+// fields and the args length are always at the same offsets, and the public key hash
+// starts right after them. Those bytes, except the total size, tell whether a lock uses
+// this script code with the same public key hash.
+#define SCRIPT_TOTAL_SIZE_SIZE 4
+#define SCRIPT_ARGS_LENGTH_OFFSET 49
+#define SCRIPT_PUBKEY_HASH_OFFSET 53
+#define SCRIPT_KEY_SIZE (SCRIPT_PUBKEY_HASH_OFFSET + BLAKE160_SIZE)
+
+#define INPUT_OTHER_LOCK 0
+#define INPUT_CURRENT_LOCK 1
+#define INPUT_SAME_KEY 2
+
+typedef struct {
+  uint8_t script_key[SCRIPT_KEY_SIZE];
+  uint8_t script_hash[BLAKE2B_BLOCK_SIZE];
+} lock_key_t;
+
+// Tells whether input `index` is locked by the current lock script, by another lock
+// script of this script code with the same public key hash, or by anything else.
+// Returns CKB_INDEX_OUT_OF_BOUND after the last input.
+int classify_input(const lock_key_t *key, size_t index, int *kind) {
+  uint8_t buf[SCRIPT_KEY_SIZE];
+  uint64_t len = BLAKE2B_BLOCK_SIZE;
+  int ret = ckb_load_cell_by_field(buf, &len, 0, index, CKB_SOURCE_INPUT,
+                                   CKB_CELL_FIELD_LOCK_HASH);
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  if (len != BLAKE2B_BLOCK_SIZE) {
+    return ERROR_SYSCALL;
+  }
+  if (memcmp(buf, key->script_hash, BLAKE2B_BLOCK_SIZE) == 0) {
+    *kind = INPUT_CURRENT_LOCK;
+    return CKB_SUCCESS;
+  }
+
+  // Only the fixed size part of the lock and the public key hash are loaded, a lock
+  // with args shorter than a public key hash is shorter than that.
+  len = SCRIPT_KEY_SIZE;
+  ret = ckb_load_cell_by_field(buf, &len, 0, index, CKB_SOURCE_INPUT,
+                               CKB_CELL_FIELD_LOCK);
+  if (ret != CKB_SUCCESS) {
+    return ERROR_SYSCALL;
+  }
+  if (len < SCRIPT_KEY_SIZE ||
+      memcmp(buf + SCRIPT_TOTAL_SIZE_SIZE,
+             key->script_key + SCRIPT_TOTAL_SIZE_SIZE,
+             SCRIPT_ARGS_LENGTH_OFFSET - SCRIPT_TOTAL_SIZE_SIZE) != 0 ||
+      memcmp(buf + SCRIPT_PUBKEY_HASH_OFFSET,
+             key->script_key + SCRIPT_PUBKEY_HASH_OFFSET, BLAKE160_SIZE) != 0) {
+    *kind = INPUT_OTHER_LOCK;
+  } else {
+    *kind = INPUT_SAME_KEY;
+  }
+  return CKB_SUCCESS;
+}
+
+int main() {
+  int ret;
+  uint64_t len = 0;
+
+  // Load the script, which must be at least as long as its public key hash part, and
+  // keep that part together with the script hash.
+  size_t arena_mark = ckb_arena_mark();
+  unsigned char *script = ckb_arena_alloc(SCRIPT_SIZE);
+  if (script == NULL) {
+    return CKB_ARENA_ERROR_EXHAUSTED;
+  }
+  len = SCRIPT_SIZE;
+  ret = ckb_load_script(script, &len, 0);
+  if (ret != CKB_SUCCESS) {
+    return ERROR_SYSCALL;
+  }
+  if (len > SCRIPT_SIZE) {
+    return ERROR_SCRIPT_TOO_LONG;
+  }
+  mol_seg_t script_seg;
+  script_seg.ptr = (uint8_t *)script;
+  script_seg.size = len;
+
+  mol_seg_t args_seg;
+  if (MolLazyReader_Script_get_args(&script_seg, &args_seg) != MOL_OK ||
+      MolReader_Bytes_verify(&args_seg, false) != MOL_OK) {
+    return ERROR_ENCODING;
+  }
+  mol_seg_t args_bytes_seg = MolReader_Bytes_raw_bytes(&args_seg);
+  if (args_bytes_seg.size < BLAKE160_SIZE) {
+    return ERROR_ARGUMENTS_LEN;
+  }
+  if (args_bytes_seg.ptr != script + SCRIPT_PUBKEY_HASH_OFFSET) {
+    return ERROR_ENCODING;
+  }
+  lock_key_t key;
+  memcpy(key.script_key, script, SCRIPT_KEY_SIZE);
+  ckb_arena_release(arena_mark);
+
+  len = BLAKE2B_BLOCK_SIZE;
+  ret = ckb_load_script_hash(key.script_hash, &len, 0);
+  if (ret != CKB_SUCCESS || len != BLAKE2B_BLOCK_SIZE) {
+    return ERROR_SYSCALL;
+  }
+  CKB_PROFILE_PHASE("script");
+
+  // Look for the leading input. The inputs of the current group are there, so the scan
+  // always stops before running out of inputs.
+  size_t leading_index = 0;
+  while (1) {
+    int kind;
+    ret = classify_input(&key, leading_index, &kind);
+    if (ret != CKB_SUCCESS) {
+      return ERROR_SYSCALL;
+    }
+    if (kind == INPUT_SAME_KEY) {
+      // Another group with the same public key leads, its signature covers this group.
+      CKB_PROFILE_PHASE("leading_input");
+      return 0;
+    }
+    if (kind == INPUT_CURRENT_LOCK) {
+      break;
+    }
+    leading_index += 1;
+  }
+  CKB_PROFILE_PHASE("leading_input");
+
+  // From here on this is the leading group, the signature is loaded from its first
+  // witness as in the single signing script.
+  unsigned char *temp = ckb_arena_alloc(TEMP_SIZE);
+  if (temp == NULL) {
+    return CKB_ARENA_ERROR_EXHAUSTED;
+  }
+
+  uint64_t witness_len = MAX_WITNESS_SIZE;
+  ret = ckb_load_witness(temp, &witness_len, 0, 0, CKB_SOURCE_GROUP_INPUT);
+  if (ret != CKB_SUCCESS) {
+    return ERROR_SYSCALL;
+  }
+  if (witness_len > MAX_WITNESS_SIZE) {
+    return ERROR_WITNESS_SIZE;
+  }
+
+  mol_seg_t lock_bytes_seg;
+  ret = extract_witness_lock(temp, witness_len, &lock_bytes_seg);
+  if (ret != 0) {
+    return ERROR_ENCODING;
+  }
+  if (lock_bytes_seg.size != SIGNATURE_SIZE) {
+    return ERROR_ARGUMENTS_LEN;
+  }
+  const unsigned char *lock_bytes = lock_bytes_seg.ptr;
+  CKB_PROFILE_PHASE("witness");
+
+  blake2b_state blake2b_ctx;
+  ret = sighash_all_hash_first_witness(&blake2b_ctx, temp, witness_len,
+                                       lock_bytes - temp, SIGNATURE_SIZE);
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  CKB_PROFILE_PHASE("message");
+
+  // The witnesses of all the following inputs with the same public key hash, those of
+  // the current group included. Witnesses can be fewer than inputs, once one of them is
+  // missing so are all the following ones.
+  tx_shape_t shape;
+  tx_shape_init(&shape);
+  size_t i = leading_index + 1;
+  int witnesses_left = 1;
+  while (1) {
+    int kind;
+    ret = classify_input(&key, i, &kind);
+    if (ret == CKB_INDEX_OUT_OF_BOUND) {
+      shape.inputs_len = i;
+      break;
+    }
+    if (ret != CKB_SUCCESS) {
+      return ERROR_SYSCALL;
+    }
+    if (kind != INPUT_OTHER_LOCK && witnesses_left) {
+      ret = load_and_hash_witness(&blake2b_ctx, i, CKB_SOURCE_INPUT);
+      if (ret == CKB_INDEX_OUT_OF_BOUND) {
+        witnesses_left = 0;
+      } else if (ret != CKB_SUCCESS) {
+        return ERROR_SYSCALL;
+      }
+    }
+    i += 1;
+  }
+  CKB_PROFILE_PHASE("key_witnesses");
+
+  unsigned char message[BLAKE2B_BLOCK_SIZE];
+  ret = sighash_all_hash_trailing_witnesses(&blake2b_ctx, &shape, message);
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  CKB_PROFILE_PHASE("trailing_witnesses");
+
+  // The public key is recovered from the signature and compared with the public key
+  // hash in script args, as in the single signing script.
+  secp256k1_context context;
+  ret = ckb_secp256k1_custom_verify_only_initialize_mapped(
+      &context, CKB_SECP256K1_DATA_DEP_INDEX_HINT);
+  if (ret != 0) {
+    return ret;
+  }
+  CKB_PROFILE_PHASE("secp256k1_init");
+
+  secp256k1_ecdsa_recoverable_signature signature;
+  if (secp256k1_ecdsa_recoverable_signature_parse_compact(
+          &context, &signature, lock_bytes, lock_bytes[RECID_INDEX]) == 0) {
+    return ERROR_SECP_PARSE_SIGNATURE;
+  }
+  secp256k1_pubkey pubkey;
+  if (secp256k1_ecdsa_recover(&context, &pubkey, &signature, message) != 1) {
+    return ERROR_SECP_RECOVER_PUBKEY;
+  }
+  CKB_PROFILE_PHASE("recover");
+
+  size_t pubkey_size = PUBKEY_SIZE;
+  if (secp256k1_ec_pubkey_serialize(&context, temp, &pubkey_size, &pubkey,
+                                    SECP256K1_EC_COMPRESSED) != 1) {
+    return ERROR_SECP_SERIALIZE_PUBKEY;
+  }
+  blake2b_ckb_hash_block(temp, temp, pubkey_size);
+  if (memcmp(key.script_key + SCRIPT_PUBKEY_HASH_OFFSET, temp, BLAKE160_SIZE) !=
+      0) {
+    return ERROR_PUBKEY_BLAKE160_HASH;
+  }
+  CKB_PROFILE_PHASE("pubkey_hash");
+
+  return 0;
+}
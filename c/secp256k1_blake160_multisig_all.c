@@ -19,7 +19,7 @@
 // +-------------+------------------------------------+-------+
 // |             |           Description              | Bytes |
 // +-------------+------------------------------------+-------+
-// | S           | reserved field, must be zero       |     1 |
+// | S           | signature order mode, see below    |     1 |
 // | R           | first nth public keys must match   |     1 |
 // | M           | threshold                          |     1 |
 // | N           | total public keys                  |     1 |
@@ -32,16 +32,27 @@
 // part, this way no matter how many public keys we are including, and how many signatures
 // we are testing, the lock script size remains a constant value. One implicit rule, is that
 // `multisig_script` remains a constant since the hash is already fixed in script args part.
+//
+// S selects how signatures are matched against public keys. With 0, signatures can come
+// in any order, and each one is compared against all unused public keys. With 1, the
+// signatures must follow the order of their public keys in `multisig_script`, so they
+// are matched in a single forward pass, which keeps the cost linear for large signer
+// sets. Other values are reserved.
 
 // First we will need to include a few headers here, for legacy reasons, this repository
 // ships with those headers. We are now maintaining a new [repository](https://github.com/nervosnetwork/ckb-c-stdlib)
 // with most of those headers included. If you are building a new script, we do recommend
 // you to take a look at what's in the new repository, and use the code there directly.
+//
+// Besides the first witness and the recovered public keys, the arena holds the state of
+// the batched recovery, 312 bytes per signature, 80KB for a threshold of 255.
+#define CKB_ARENA_SIZE 131072
 #include "blake2b.h"
 #include "ckb_syscalls.h"
 #include "common.h"
 #include "protocol.h"
 #include "secp256k1_helper.h"
+#include "secp256k1_batch_recover.h"
 
 // Script args validation errors
 #define ERROR_INVALID_RESERVE_FIELD -41
@@ -52,16 +63,20 @@
 #define ERROR_MULTSIG_SCRIPT_HASH -51
 #define ERROR_VERIFICATION -52
 
+// Values of the S field in multisig_script
+#define MULTISIG_MODE_ANY_ORDER 0
+#define MULTISIG_MODE_SORTED 1
+
 // Common definitions here, one important limitation, is that this lock script only works
-// with scripts and witnesses that are no larger than 32KB. We believe this should be enough
-// for most cases.
+// with scripts and a first witness that are no larger than 32KB. The remaining witnesses
+// are streamed into the hasher, so they are only limited by cycles. We believe this should
+// be enough for most cases.
 //
 // Here we are also employing a common convention: we append the recovery ID to the end of
 // the 64-byte compact recoverable signature.
 #define BLAKE2B_BLOCK_SIZE 32
 #define BLAKE160_SIZE 20
 #define PUBKEY_SIZE 33
-#define TEMP_SIZE 32768
 #define RECID_INDEX 64
 /* 32 KB */
 #define MAX_WITNESS_SIZE 32768
@@ -69,11 +84,6 @@
 #define SIGNATURE_SIZE 65
 #define FLAGS_SIZE 4
 
-// Compile-time guard against buffer abuse
-#if (MAX_WITNESS_SIZE > TEMP_SIZE) || (MAX_SCRIPT_SIZE > TEMP_SIZE)
-#error "Temp buffer is not big enough!"
-#endif
-
 // To use this script, the script args part must contain the blake160 hash of the
 // `multisig_script` part mentioned above. The blake160 hash is calculated as the
 // first 20 bytes of the blake2b hash(with "ckb-default-hash" as personalization).
@@ -84,11 +94,17 @@
 int main() {
   int ret;
   uint64_t len;
-  unsigned char temp[TEMP_SIZE];
 
+  // Like the single signing script, large buffers come from the static arena in `arena.h`,
+  // and each one is released once we are done with it.
+  //
   // First let's load and extract script args part, which is also the blake160 hash of public
   // key from current running script.
-  unsigned char script[MAX_SCRIPT_SIZE];
+  size_t arena_mark = ckb_arena_mark();
+  unsigned char *script = ckb_arena_alloc(MAX_SCRIPT_SIZE);
+  if (script == NULL) {
+    return CKB_ARENA_ERROR_EXHAUSTED;
+  }
   len = MAX_SCRIPT_SIZE;
   ret = ckb_load_script(script, &len, 0);
   if (ret != CKB_SUCCESS) {
@@ -101,11 +117,11 @@ int main() {
   script_seg.ptr = (uint8_t *)script;
   script_seg.size = len;
 
-  if (MolReader_Script_verify(&script_seg, false) != MOL_OK) {
+  mol_seg_t args_seg;
+  if (MolLazyReader_Script_get_args(&script_seg, &args_seg) != MOL_OK ||
+      MolReader_Bytes_verify(&args_seg, false) != MOL_OK) {
     return ERROR_ENCODING;
   }
-
-  mol_seg_t args_seg = MolReader_Script_get_args(&script_seg);
   mol_seg_t args_bytes_seg = MolReader_Bytes_raw_bytes(&args_seg);
   // The script args part should either be 20 bytes(containing only the blake160 hash),
   // or 28 bytes(containing blake160 hash and since value).
@@ -118,10 +134,19 @@ int main() {
   if (args_bytes_seg.size == BLAKE160_SIZE + sizeof(uint64_t)) {
     since = *(uint64_t *)&args_bytes_seg.ptr[BLAKE160_SIZE];
   }
+  // Only the multisig script hash is needed from now on, keep it and release the script
+  // buffer.
+  unsigned char args_hash[BLAKE160_SIZE];
+  memcpy(args_hash, args_bytes_seg.ptr, BLAKE160_SIZE);
+  ckb_arena_release(arena_mark);
+  CKB_PROFILE_PHASE("script");
 
   // Load the first witness, or the witness of the same index as the first input using
   // current script.
-  unsigned char witness[MAX_WITNESS_SIZE];
+  unsigned char *witness = ckb_arena_alloc(MAX_WITNESS_SIZE);
+  if (witness == NULL) {
+    return CKB_ARENA_ERROR_EXHAUSTED;
+  }
   uint64_t witness_len = MAX_WITNESS_SIZE;
   ret = ckb_load_witness(witness, &witness_len, 0, 0, CKB_SOURCE_GROUP_INPUT);
   if (ret != CKB_SUCCESS) {
@@ -150,17 +175,18 @@ int main() {
   if (lock_bytes_seg.size > witness_len) {
     return ERROR_ENCODING;
   }
-  // Keep the full lock field somewhere, since later we will modify this field in place.
-  unsigned char lock_bytes[lock_bytes_seg.size];
+  // The lock field stays in the witness buffer, the message builder below never modifies
+  // the witness object, so there is no need to keep a copy of it.
+  const unsigned char *lock_bytes = lock_bytes_seg.ptr;
   uint64_t lock_bytes_len = lock_bytes_seg.size;
-  memcpy(lock_bytes, lock_bytes_seg.ptr, lock_bytes_len);
+  CKB_PROFILE_PHASE("witness");
 
   // Extract multisig script flags.
   uint8_t pubkeys_cnt = lock_bytes[3];
   uint8_t threshold = lock_bytes[2];
   uint8_t require_first_n = lock_bytes[1];
-  uint8_t reserved_field = lock_bytes[0];
-  if (reserved_field != 0) {
+  uint8_t mode = lock_bytes[0];
+  if (mode != MULTISIG_MODE_ANY_ORDER && mode != MULTISIG_MODE_SORTED) {
     return ERROR_INVALID_RESERVE_FIELD;
   }
   if (pubkeys_cnt == 0) {
@@ -185,164 +211,146 @@ int main() {
   }
 
   // Perform hash check of the `multisig_script` part, notice the signature part
-  // is not included here.
-  blake2b_state blake2b_ctx;
-  blake2b_init(&blake2b_ctx, BLAKE2B_BLOCK_SIZE);
-  blake2b_update(&blake2b_ctx, lock_bytes, multisig_script_len);
-  blake2b_final(&blake2b_ctx, temp, BLAKE2B_BLOCK_SIZE);
+  // is not included here. With up to 6 public keys, `multisig_script` fits in a
+  // single blake2b block and can be hashed in one shot.
+  unsigned char multisig_script_hash[BLAKE2B_BLOCK_SIZE];
+  if (blake2b_ckb_hash_block(multisig_script_hash, lock_bytes,
+                             multisig_script_len) != 0) {
+    blake2b_state blake2b_ctx;
+    blake2b_init(&blake2b_ctx, BLAKE2B_BLOCK_SIZE);
+    blake2b_update(&blake2b_ctx, lock_bytes, multisig_script_len);
+    blake2b_final(&blake2b_ctx, multisig_script_hash, BLAKE2B_BLOCK_SIZE);
+  }
 
-  if (memcmp(args_bytes_seg.ptr, temp, BLAKE160_SIZE) != 0) {
+  if (memcmp(args_hash, multisig_script_hash, BLAKE160_SIZE) != 0) {
     return ERROR_MULTSIG_SCRIPT_HASH;
   }
+  CKB_PROFILE_PHASE("multisig_script_hash");
 
-  // Check lock period logic, we have prepared a handy utility function for this.
-  ret = check_since(since);
+  // Check lock period logic, we have prepared a handy utility function for this. While
+  // checking, it also counts the input cells using current lock script, and keeps the
+  // count in the transaction shape, so later loops don't need to probe for it again.
+  tx_shape_t shape;
+  tx_shape_init(&shape);
+  ret = check_since(&shape, since);
   if (ret != CKB_SUCCESS) {
     return ret;
   }
+  CKB_PROFILE_PHASE("since");
 
-  // Load the current transaction hash.
-  unsigned char tx_hash[BLAKE2B_BLOCK_SIZE];
-  len = BLAKE2B_BLOCK_SIZE;
-  ret = ckb_load_tx_hash(tx_hash, &len, 0);
+  // Here we prepare the message used in signature verification. It is prepared the same
+  // way as in the single signing script, using the shared message builder. The only
+  // difference is that the whole signature section following `multisig_script` in the
+  // lock field, is hashed as all zeros.
+  unsigned char message[BLAKE2B_BLOCK_SIZE];
+  ret = calculate_sighash_all_message(
+      &shape, witness, witness_len,
+      (lock_bytes - witness) + multisig_script_len, signatures_len, message);
   if (ret != CKB_SUCCESS) {
     return ret;
   }
-  if (len != BLAKE2B_BLOCK_SIZE) {
-    return ERROR_SYSCALL;
-  }
-
-  // Erase the signature part to all zeros, so we can prepare the sining message.
-  memset((void *)(lock_bytes_seg.ptr + multisig_script_len), 0, signatures_len);
-  // Here we start to prepare the message used in signature verification. First, let's
-  // hash the just loaded transaction hash.
-  unsigned char message[BLAKE2B_BLOCK_SIZE];
-  blake2b_init(&blake2b_ctx, BLAKE2B_BLOCK_SIZE);
-  blake2b_update(&blake2b_ctx, tx_hash, BLAKE2B_BLOCK_SIZE);
-  // Before hashing each witness, we need to hash the witness length first as a 64-bit
-  // unsigned little endian integer.
-  blake2b_update(&blake2b_ctx, (char *)&witness_len, sizeof(uint64_t));
-  // Like shown above, we will fill the signature section with all 0, then used the modified
-  // first witness here as the value to hash.
-  blake2b_update(&blake2b_ctx, witness, witness_len);
 
-  // Let's loop and hash all witnesses with the same indices as the remaining input cells
-  // using current running lock script.
-  size_t i = 1;
-  while (1) {
-    len = MAX_WITNESS_SIZE;
-    // Using *CKB_SOURCE_GROUP_INPUT* as the source value provides us with a quick way to
-    // loop through all input cells using current running lock script. We don't have to
-    // loop and check each individual cell by ourselves.
-    ret = ckb_load_witness(temp, &len, 0, i, CKB_SOURCE_GROUP_INPUT);
-    if (ret == CKB_INDEX_OUT_OF_BOUND) {
-      break;
-    }
-    if (ret != CKB_SUCCESS) {
-      return ERROR_SYSCALL;
-    }
-    if (len > MAX_WITNESS_SIZE) {
-      return ERROR_WITNESS_SIZE;
-    }
-    // Before hashing each witness, we need to hash the witness length first as a 64-bit
-    // unsigned little endian integer.
-    blake2b_update(&blake2b_ctx, (char *)&len, sizeof(uint64_t));
-    blake2b_update(&blake2b_ctx, temp, len);
-    i += 1;
-  }
-
-  // For safety consideration, this lock script will also hash and guard all witnesses that
-  // have index values equal to or larger than the number of input cells. It assumes all
-  // witnesses that do have an input cell with the same index, will be guarded by the lock
-  // script of the input cell.
-  //
-  // For convenience reason, we provide a utility function here to calculate the number of
-  // input cells in a transaction.
-  i = calculate_inputs_len();
-  while (1) {
-    len = MAX_WITNESS_SIZE;
-    // Here we are guarding input cells with any arbitrary lock script, hence we are using
-    // the plain *CKB_SOURCE_INPUT* source to loop all witnesses.
-    ret = ckb_load_witness(temp, &len, 0, i, CKB_SOURCE_INPUT);
-    if (ret == CKB_INDEX_OUT_OF_BOUND) {
-      break;
-    }
-    if (ret != CKB_SUCCESS) {
-      return ERROR_SYSCALL;
-    }
-    if (len > MAX_WITNESS_SIZE) {
-      return ERROR_WITNESS_SIZE;
-    }
-    // Before hashing each witness, we need to hash the witness length first as a 64-bit
-    // unsigned little endian integer.
-    blake2b_update(&blake2b_ctx, (char *)&len, sizeof(uint64_t));
-    blake2b_update(&blake2b_ctx, temp, len);
-    i += 1;
-  }
-  // Now the message preparation is completed.
-  blake2b_final(&blake2b_ctx, message, BLAKE2B_BLOCK_SIZE);
-
-  // Verify threshold signatures, threshold is a uint8_t, at most it is
-  // 255, meaning this array will definitely have a reasonable upper bound.
-  // Also this code uses C99's new feature to allocate a variable length array.
-  uint8_t used_signatures[threshold];
-  memset(used_signatures, 0, threshold);
+  // Keep track of the public keys that already have a matching signature, this is
+  // indexed by public key position. pubkeys_cnt is a uint8_t, at most it is 255,
+  // meaning this array will definitely have a reasonable upper bound. Also this
+  // code uses C99's new feature to allocate a variable length array.
+  uint8_t used_signatures[pubkeys_cnt];
+  memset(used_signatures, 0, pubkeys_cnt);
 
   // We are using bitcoin's [secp256k1 library](https://github.com/bitcoin-core/secp256k1)
   // for signature verification here. To the best of our knowledge, this is an unmatched
   // advantage of CKB: you can ship cryptographic algorithm within your smart contract,
   // you don't have to wait for the foundation to ship a new cryptographic algorithm. You
   // can just build and ship your own.
+  //
+  // The precomputed secp256k1 data is looked up in cell deps, we first try where the
+  // genesis dep group puts it, and only scan all cell deps when it is not there. The
+  // data is then mapped into a static page aligned region instead of being copied to
+  // the stack, leaving the stack for witnesses.
   secp256k1_context context;
-  uint8_t secp_data[CKB_SECP256K1_DATA_SIZE];
-  ret = ckb_secp256k1_custom_verify_only_initialize(&context, secp_data);
+  ret = ckb_secp256k1_custom_verify_only_initialize_mapped(
+      &context, CKB_SECP256K1_DATA_DEP_INDEX_HINT);
   if (ret != 0) {
     return ret;
   }
+  CKB_PROFILE_PHASE("secp256k1_init");
 
-  // We will perform *threshold* number of signature verifications here.
-  for (size_t i = 0; i < threshold; i++) {
-    // Load signature
-    secp256k1_ecdsa_recoverable_signature signature;
-    size_t signature_offset = multisig_script_len + i * SIGNATURE_SIZE;
-    if (secp256k1_ecdsa_recoverable_signature_parse_compact(
-            &context, &signature, &lock_bytes[signature_offset],
-            lock_bytes[signature_offset + RECID_INDEX]) == 0) {
-      return ERROR_SECP_PARSE_SIGNATURE;
-    }
+  // We will perform *threshold* number of signature verifications here. All signatures
+  // sign the same message, so we first try to recover all the public keys in one batch,
+  // which shares the inversions between signatures. If the batch fails for any reason,
+  // we recover the signatures one by one again, so the failing signature surfaces with
+  // its precise error code.
+  uint8_t(*recovered_pubkeys)[PUBKEY_SIZE] =
+      ckb_arena_alloc(threshold * PUBKEY_SIZE);
+  if (recovered_pubkeys == NULL) {
+    return CKB_ARENA_ERROR_EXHAUSTED;
+  }
+  if (ckb_secp256k1_batch_recover(&context, &lock_bytes[multisig_script_len],
+                                  threshold, message, recovered_pubkeys) != 1) {
+    for (size_t i = 0; i < threshold; i++) {
+      // Load signature
+      secp256k1_ecdsa_recoverable_signature signature;
+      size_t signature_offset = multisig_script_len + i * SIGNATURE_SIZE;
+      if (secp256k1_ecdsa_recoverable_signature_parse_compact(
+              &context, &signature, &lock_bytes[signature_offset],
+              lock_bytes[signature_offset + RECID_INDEX]) == 0) {
+        return ERROR_SECP_PARSE_SIGNATURE;
+      }
 
-    // verifiy signature and Recover pubkey
-    secp256k1_pubkey pubkey;
-    if (secp256k1_ecdsa_recover(&context, &pubkey, &signature, message) != 1) {
-      return ERROR_SECP_RECOVER_PUBKEY;
-    }
+      // verifiy signature and Recover pubkey
+      secp256k1_pubkey pubkey;
+      if (secp256k1_ecdsa_recover(&context, &pubkey, &signature, message) != 1) {
+        return ERROR_SECP_RECOVER_PUBKEY;
+      }
 
-    // Calculate the blake160 hash of the derived public key
-    size_t pubkey_size = PUBKEY_SIZE;
-    if (secp256k1_ec_pubkey_serialize(&context, temp, &pubkey_size, &pubkey,
-                                      SECP256K1_EC_COMPRESSED) != 1) {
-      return ERROR_SECP_SERIALIZE_PUBKEY;
+      size_t pubkey_size = PUBKEY_SIZE;
+      if (secp256k1_ec_pubkey_serialize(&context, recovered_pubkeys[i],
+                                        &pubkey_size, &pubkey,
+                                        SECP256K1_EC_COMPRESSED) != 1) {
+        return ERROR_SECP_SERIALIZE_PUBKEY;
+      }
     }
+  }
+  CKB_PROFILE_PHASE("recover");
 
+  size_t next_pubkey = 0;
+  for (size_t i = 0; i < threshold; i++) {
+    // Calculate the blake160 hash of the derived public key
     unsigned char calculated_pubkey_hash[BLAKE2B_BLOCK_SIZE];
-    blake2b_state blake2b_ctx;
-    blake2b_init(&blake2b_ctx, BLAKE2B_BLOCK_SIZE);
-    blake2b_update(&blake2b_ctx, temp, PUBKEY_SIZE);
-    blake2b_final(&blake2b_ctx, calculated_pubkey_hash, BLAKE2B_BLOCK_SIZE);
+    blake2b_ckb_hash_block(calculated_pubkey_hash, recovered_pubkeys[i],
+                           PUBKEY_SIZE);
 
     // Check if this signature is signed with one of the provided public key.
     uint8_t matched = 0;
-    for (size_t i = 0; i < pubkeys_cnt; i++) {
-      if (used_signatures[i] == 1) {
-        continue;
+    if (mode == MULTISIG_MODE_SORTED) {
+      // Signatures follow the order of public keys, so matching resumes right after
+      // the public key matched by the previous signature. Once there are fewer public
+      // keys left than signatures, the remaining signatures can never all match.
+      while (next_pubkey < pubkeys_cnt) {
+        if (pubkeys_cnt - next_pubkey < threshold - i) {
+          return ERROR_VERIFICATION;
+        }
+        size_t j = next_pubkey++;
+        if (memcmp(&lock_bytes[FLAGS_SIZE + j * BLAKE160_SIZE],
+                   calculated_pubkey_hash, BLAKE160_SIZE) == 0) {
+          matched = 1;
+          used_signatures[j] = 1;
+          break;
+        }
       }
-      if (memcmp(&lock_bytes[FLAGS_SIZE + i * BLAKE160_SIZE],
-                 calculated_pubkey_hash, BLAKE160_SIZE) != 0) {
-        continue;
+    } else {
+      for (size_t j = 0; j < pubkeys_cnt; j++) {
+        if (used_signatures[j] == 1) {
+          continue;
+        }
+        if (memcmp(&lock_bytes[FLAGS_SIZE + j * BLAKE160_SIZE],
+                   calculated_pubkey_hash, BLAKE160_SIZE) != 0) {
+          continue;
+        }
+        matched = 1;
+        used_signatures[j] = 1;
+        break;
       }
-      matched = 1;
-      used_signatures[i] = 1;
-      break;
     }
 
     // If the signature doesn't match any of the provided public key, the script
@@ -351,6 +359,7 @@ int main() {
       return ERROR_VERIFICATION;
     }
   }
+  CKB_PROFILE_PHASE("pubkey_hash");
 
   // The above scheme just ensures that a *threshold* number of signatures have
   // successfully been verified, and they all come from the provided public keys.
@@ -0,0 +1,160 @@
+// # secp256k1-blake160-pubkey-sighash-all
+//
+// This is a variant of the [single signing script](./secp256k1_blake160_sighash_all),
+// it uses the same script args, the blake160 hash of a compressed public key, and the
+// same signing message. The only difference is what the lock field of the first witness
+// holds:
+//
+// PubKey | Signature
+//
+// +-----------+------------------------------------+-------+
+// |           |           Description              | Bytes |
+// +-----------+------------------------------------+-------+
+// | PubKey    | compressed public key              |    33 |
+// | Signature | compact signature, no recovery ID  |    64 |
+// +-----------+------------------------------------+-------+
+//
+// Since the public key is provided, it doesn't have to be recovered from the signature.
+// Public key recovery needs to decompress the R point of the signature, which costs a
+// square root on top of what a plain signature verification does. Here the public key
+// is checked against script args first, which is just one blake2b block and rejects a
+// wrong public key before any signature work, then the signature is verified with
+// `secp256k1_ecdsa_verify`. The price is a witness 32 bytes longer.
+//
+// The whole lock field, public key included, is filled with zeros when the signing
+// message is prepared, so a signer only has to know the length of the lock field.
+//
+// This variant is not part of the deployed scripts, `make pubkey-sighash-all` builds
+// it into build/, and `make bench-pubkey-sighash-all` compares its cycles with the
+// single signing script.
+#include "blake2b.h"
+#include "ckb_syscalls.h"
+#include "common.h"
+#include "protocol.h"
+#include "secp256k1_helper.h"
+
+// Common definitions here, the same limits as the single signing script apply.
+#define BLAKE2B_BLOCK_SIZE 32
+#define BLAKE160_SIZE 20
+#define PUBKEY_SIZE 33
+#define TEMP_SIZE 32768
+/* 32 KB */
+#define MAX_WITNESS_SIZE 32768
+#define SCRIPT_SIZE 32768
+#define COMPACT_SIGNATURE_SIZE 64
+#define LOCK_SIZE (PUBKEY_SIZE + COMPACT_SIGNATURE_SIZE)
+
+// Compile-time guard against buffer abuse
+#if (MAX_WITNESS_SIZE > TEMP_SIZE) || (SCRIPT_SIZE > TEMP_SIZE)
+#error "Temp buffer is not big enough!"
+#endif
+
+int main() {
+  int ret;
+  uint64_t len = 0;
+
+  // Load the script args, the blake160 hash of the public key, the same way as the
+  // single signing script does.
+  size_t arena_mark = ckb_arena_mark();
+  unsigned char *script = ckb_arena_alloc(SCRIPT_SIZE);
+  if (script == NULL) {
+    return CKB_ARENA_ERROR_EXHAUSTED;
+  }
+  len = SCRIPT_SIZE;
+  ret = ckb_load_script(script, &len, 0);
+  if (ret != CKB_SUCCESS) {
+    return ERROR_SYSCALL;
+  }
+  if (len > SCRIPT_SIZE) {
+    return ERROR_SCRIPT_TOO_LONG;
+  }
+  mol_seg_t script_seg;
+  script_seg.ptr = (uint8_t *)script;
+  script_seg.size = len;
+
+  mol_seg_t args_seg;
+  if (MolLazyReader_Script_get_args(&script_seg, &args_seg) != MOL_OK ||
+      MolReader_Bytes_verify(&args_seg, false) != MOL_OK) {
+    return ERROR_ENCODING;
+  }
+  mol_seg_t args_bytes_seg = MolReader_Bytes_raw_bytes(&args_seg);
+  if (args_bytes_seg.size != BLAKE160_SIZE) {
+    return ERROR_ARGUMENTS_LEN;
+  }
+  unsigned char pubkey_hash[BLAKE160_SIZE];
+  memcpy(pubkey_hash, args_bytes_seg.ptr, BLAKE160_SIZE);
+  ckb_arena_release(arena_mark);
+  CKB_PROFILE_PHASE("script");
+
+  unsigned char *temp = ckb_arena_alloc(TEMP_SIZE);
+  if (temp == NULL) {
+    return CKB_ARENA_ERROR_EXHAUSTED;
+  }
+
+  uint64_t witness_len = MAX_WITNESS_SIZE;
+  ret = ckb_load_witness(temp, &witness_len, 0, 0, CKB_SOURCE_GROUP_INPUT);
+  if (ret != CKB_SUCCESS) {
+    return ERROR_SYSCALL;
+  }
+  if (witness_len > MAX_WITNESS_SIZE) {
+    return ERROR_WITNESS_SIZE;
+  }
+
+  mol_seg_t lock_bytes_seg;
+  ret = extract_witness_lock(temp, witness_len, &lock_bytes_seg);
+  if (ret != 0) {
+    return ERROR_ENCODING;
+  }
+  if (lock_bytes_seg.size != LOCK_SIZE) {
+    return ERROR_ARGUMENTS_LEN;
+  }
+  const unsigned char *lock_bytes = lock_bytes_seg.ptr;
+  CKB_PROFILE_PHASE("witness");
+
+  // The public key is checked before anything else is done with the witnesses, a
+  // compressed public key fits in a single blake2b block, so it is hashed in one shot.
+  unsigned char calculated_pubkey_hash[BLAKE2B_BLOCK_SIZE];
+  blake2b_ckb_hash_block(calculated_pubkey_hash, lock_bytes, PUBKEY_SIZE);
+  if (memcmp(pubkey_hash, calculated_pubkey_hash, BLAKE160_SIZE) != 0) {
+    return ERROR_PUBKEY_BLAKE160_HASH;
+  }
+  CKB_PROFILE_PHASE("pubkey_hash");
+
+  // The signing message is built by the same message builder as the single signing
+  // script, with the whole lock field hashed as all zeros.
+  unsigned char message[BLAKE2B_BLOCK_SIZE];
+  tx_shape_t shape;
+  tx_shape_init(&shape);
+  ret = calculate_sighash_all_message(&shape, temp, witness_len,
+                                      lock_bytes - temp, LOCK_SIZE, message);
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+
+  secp256k1_context context;
+  ret = ckb_secp256k1_custom_verify_only_initialize_mapped(
+      &context, CKB_SECP256K1_DATA_DEP_INDEX_HINT);
+  if (ret != 0) {
+    return ret;
+  }
+  CKB_PROFILE_PHASE("secp256k1_init");
+
+  secp256k1_pubkey pubkey;
+  if (secp256k1_ec_pubkey_parse(&context, &pubkey, lock_bytes, PUBKEY_SIZE) !=
+      1) {
+    return ERROR_SECP_PARSE_PUBKEY;
+  }
+  secp256k1_ecdsa_signature signature;
+  if (secp256k1_ecdsa_signature_parse_compact(&context, &signature,
+                                              &lock_bytes[PUBKEY_SIZE]) != 1) {
+    return ERROR_SECP_PARSE_SIGNATURE;
+  }
+  // secp256k1 only accepts signatures in lower-S form here, which is the form it
+  // signs in, so a malleated signature is rejected as well.
+  if (secp256k1_ecdsa_verify(&context, &signature, message, &pubkey) != 1) {
+    return ERROR_SECP_VERIFICATION;
+  }
+  CKB_PROFILE_PHASE("verify");
+
+  return 0;
+}
@@ -46,8 +46,9 @@
 #include "secp256k1_helper.h"
 
 // Common definitions here, one important limitation, is that this lock script only works
-// with scripts and witnesses that are no larger than 32KB. We believe this should be enough
-// for most cases.
+// with scripts and a first witness that are no larger than 32KB. The remaining witnesses
+// are streamed into the hasher, so they are only limited by cycles. We believe this should
+// be enough for most cases.
 //
 // Here we are also employing a common convention: we append the recovery ID to the end of
 // the 64-byte compact recoverable signature.
@@ -79,12 +80,17 @@
 int main() {
   int ret;
   uint64_t len = 0;
-  unsigned char temp[TEMP_SIZE];
-  unsigned char lock_bytes[SIGNATURE_SIZE];
 
+  // Large buffers are allocated from a static arena instead of the stack. A buffer is
+  // released as soon as it is no longer needed, so the next one can reuse its memory.
+  //
   // First let's load and extract script args part, which is also the blake160 hash of public
   // key from current running script.
-  unsigned char script[SCRIPT_SIZE];
+  size_t arena_mark = ckb_arena_mark();
+  unsigned char *script = ckb_arena_alloc(SCRIPT_SIZE);
+  if (script == NULL) {
+    return CKB_ARENA_ERROR_EXHAUSTED;
+  }
   len = SCRIPT_SIZE;
   ret = ckb_load_script(script, &len, 0);
   if (ret != CKB_SUCCESS) {
@@ -97,15 +103,25 @@ int main() {
   script_seg.ptr = (uint8_t *)script;
   script_seg.size = len;
 
-  if (MolReader_Script_verify(&script_seg, false) != MOL_OK) {
+  mol_seg_t args_seg;
+  if (MolLazyReader_Script_get_args(&script_seg, &args_seg) != MOL_OK ||
+      MolReader_Bytes_verify(&args_seg, false) != MOL_OK) {
     return ERROR_ENCODING;
   }
-
-  mol_seg_t args_seg = MolReader_Script_get_args(&script_seg);
   mol_seg_t args_bytes_seg = MolReader_Bytes_raw_bytes(&args_seg);
   if (args_bytes_seg.size != BLAKE160_SIZE) {
     return ERROR_ARGUMENTS_LEN;
   }
+  // Only the pubkey hash is needed from now on, keep it and release the script buffer.
+  unsigned char pubkey_hash[BLAKE160_SIZE];
+  memcpy(pubkey_hash, args_bytes_seg.ptr, BLAKE160_SIZE);
+  ckb_arena_release(arena_mark);
+  CKB_PROFILE_PHASE("script");
+
+  unsigned char *temp = ckb_arena_alloc(TEMP_SIZE);
+  if (temp == NULL) {
+    return CKB_ARENA_ERROR_EXHAUSTED;
+  }
 
   // Load the first witness, or the witness of the same index as the first input using
   // current script.
@@ -131,104 +147,77 @@ int main() {
   if (lock_bytes_seg.size != SIGNATURE_SIZE) {
     return ERROR_ARGUMENTS_LEN;
   }
-  // We keep the signature in the temporary location, since later we will modify the
-  // WitnessArgs object in place for message hashing.
-  memcpy(lock_bytes, lock_bytes_seg.ptr, lock_bytes_seg.size);
+  // The signature stays in the witness buffer, since the message builder below does not
+  // modify the witness object: it hashes all zeros in the place where the signature is
+  // presented instead.
+  const unsigned char *lock_bytes = lock_bytes_seg.ptr;
+  CKB_PROFILE_PHASE("witness");
 
-  // Load the current transaction hash.
-  unsigned char tx_hash[BLAKE2B_BLOCK_SIZE];
-  len = BLAKE2B_BLOCK_SIZE;
-  ret = ckb_load_tx_hash(tx_hash, &len, 0);
+  // Here we prepare the message used in signature verification. It is the blake2b hash
+  // of the following components, each witness is preceded by its length as a 64-bit
+  // unsigned little endian integer:
+  //
+  // * The current transaction hash;
+  // * The first witness, with the signature part filled with all zeros;
+  // * All the witnesses with the same indices as the remaining input cells using current
+  // running lock script. Those witnesses are streamed into the hasher chunk by chunk, so
+  // they are not limited to 32KB;
+  // * For safety consideration, all witnesses that have index values equal to or larger
+  // than the number of input cells. It assumes all witnesses that do have an input cell
+  // with the same index, will be guarded by the lock script of the input cell.
+  //
+  // The same message builder is shared with the multisig lock script.
+  unsigned char message[BLAKE2B_BLOCK_SIZE];
+  tx_shape_t shape;
+  tx_shape_init(&shape);
+  ret = calculate_sighash_all_message(&shape, temp, witness_len,
+                                      lock_bytes - temp, SIGNATURE_SIZE,
+                                      message);
   if (ret != CKB_SUCCESS) {
     return ret;
   }
-  if (len != BLAKE2B_BLOCK_SIZE) {
-    return ERROR_SYSCALL;
-  }
-
-  // Here we start to prepare the message used in signature verification. First, let's
-  // hash the just loaded transaction hash.
-  unsigned char message[BLAKE2B_BLOCK_SIZE];
-  blake2b_state blake2b_ctx;
-  blake2b_init(&blake2b_ctx, BLAKE2B_BLOCK_SIZE);
-  blake2b_update(&blake2b_ctx, tx_hash, BLAKE2B_BLOCK_SIZE);
-
-  // We've already saved the signature above to a different location. We can then modify
-  // the witness object in place to save both memory usage and runtime cycles. The message
-  // requires us to use all zeros in the place where a signature should be presented.
-  memset((void *)lock_bytes_seg.ptr, 0, lock_bytes_seg.size);
-  // Before hashing each witness, we need to hash the witness length first as a 64-bit
-  // unsigned little endian integer.
-  blake2b_update(&blake2b_ctx, (char *)&witness_len, sizeof(uint64_t));
-  // Now let's hash the first modified witness.
-  blake2b_update(&blake2b_ctx, temp, witness_len);
-
-  // Let's loop and hash all witnesses with the same indices as the remaining input cells
-  // using current running lock script.
-  size_t i = 1;
-  while (1) {
-    len = MAX_WITNESS_SIZE;
-    // Using *CKB_SOURCE_GROUP_INPUT* as the source value provides us with a quick way to
-    // loop through all input cells using current running lock script. We don't have to
-    // loop and check each individual cell by ourselves.
-    ret = ckb_load_witness(temp, &len, 0, i, CKB_SOURCE_GROUP_INPUT);
-    if (ret == CKB_INDEX_OUT_OF_BOUND) {
-      break;
-    }
-    if (ret != CKB_SUCCESS) {
-      return ERROR_SYSCALL;
-    }
-    if (len > MAX_WITNESS_SIZE) {
-      return ERROR_WITNESS_SIZE;
-    }
-    // Before hashing each witness, we need to hash the witness length first as a 64-bit
-    // unsigned little endian integer.
-    blake2b_update(&blake2b_ctx, (char *)&len, sizeof(uint64_t));
-    blake2b_update(&blake2b_ctx, temp, len);
-    i += 1;
-  }
-  // For safety consideration, this lock script will also hash and guard all witnesses that
-  // have index values equal to or larger than the number of input cells. It assumes all
-  // witnesses that do have an input cell with the same index, will be guarded by the lock
-  // script of the input cell.
-  //
-  // For convenience reason, we provide a utility function here to calculate the number of
-  // input cells in a transaction.
-  i = calculate_inputs_len();
-  while (1) {
-    len = MAX_WITNESS_SIZE;
-    // Here we are guarding input cells with any arbitrary lock script, hence we are using
-    // the plain *CKB_SOURCE_INPUT* source to loop all witnesses.
-    ret = ckb_load_witness(temp, &len, 0, i, CKB_SOURCE_INPUT);
-    if (ret == CKB_INDEX_OUT_OF_BOUND) {
-      break;
-    }
-    if (ret != CKB_SUCCESS) {
-      return ERROR_SYSCALL;
-    }
-    if (len > MAX_WITNESS_SIZE) {
-      return ERROR_WITNESS_SIZE;
-    }
-    // Before hashing each witness, we need to hash the witness length first as a 64-bit
-    // unsigned little endian integer.
-    blake2b_update(&blake2b_ctx, (char *)&len, sizeof(uint64_t));
-    blake2b_update(&blake2b_ctx, temp, len);
-    i += 1;
-  }
-  // Now the message preparation is completed.
-  blake2b_final(&blake2b_ctx, message, BLAKE2B_BLOCK_SIZE);
 
   // We are using bitcoin's [secp256k1 library](https://github.com/bitcoin-core/secp256k1)
   // for signature verification here. To the best of our knowledge, this is an unmatched
   // advantage of CKB: you can ship cryptographic algorithm within your smart contract,
   // you don't have to wait for the foundation to ship a new cryptographic algorithm. You
   // can just build and ship your own.
+  //
+  // The precomputed secp256k1 data is looked up in cell deps, we first try where the
+  // genesis dep group puts it, and only scan all cell deps when it is not there. The
+  // data is then mapped into a static page aligned region instead of being copied to
+  // the stack, leaving the stack for witnesses.
+  size_t pubkey_size = PUBKEY_SIZE;
+#ifdef CKB_SECP256K1_USE_CRYPTO_LIB
+  // In the crypto library build, the secp256k1 code is not compiled in, it is mapped
+  // from the crypto library cell in cell deps instead, see crypto_lib.h.
+  ckb_crypto_lib_t lib;
+  ret = ckb_crypto_lib_load(&lib, CKB_CRYPTO_LIB_DEP_INDEX_HINT);
+  if (ret != 0) {
+    return ret;
+  }
+  const void *secp256k1_data = NULL;
+  ret = ckb_secp256k1_map_data(CKB_SECP256K1_DATA_DEP_INDEX_HINT, &secp256k1_data);
+  if (ret != 0) {
+    return ret;
+  }
+  CKB_PROFILE_PHASE("secp256k1_init");
+
+  // The library parses the signature, recovers the public key and serializes it in
+  // compressed form, returning the same errors as the code below.
+  ret = lib.secp256k1_recover_compressed(secp256k1_data, lock_bytes, message, temp);
+  if (ret != 0) {
+    return ret;
+  }
+  CKB_PROFILE_PHASE("recover");
+#else
   secp256k1_context context;
-  uint8_t secp_data[CKB_SECP256K1_DATA_SIZE];
-  ret = ckb_secp256k1_custom_verify_only_initialize(&context, secp_data);
+  ret = ckb_secp256k1_custom_verify_only_initialize_mapped(
+      &context, CKB_SECP256K1_DATA_DEP_INDEX_HINT);
   if (ret != 0) {
     return ret;
   }
+  CKB_PROFILE_PHASE("secp256k1_init");
 
   secp256k1_ecdsa_recoverable_signature signature;
   if (secp256k1_ecdsa_recoverable_signature_parse_compact(
@@ -241,24 +230,27 @@ int main() {
   if (secp256k1_ecdsa_recover(&context, &pubkey, &signature, message) != 1) {
     return ERROR_SECP_RECOVER_PUBKEY;
   }
+  CKB_PROFILE_PHASE("recover");
 
-  // Let's serialize the signature first, then generate the blake2b hash.
-  size_t pubkey_size = PUBKEY_SIZE;
+  // Let's serialize the signature first, then generate the blake2b hash. The signature
+  // has already been parsed, so the witness in the temporary buffer can be overwritten.
   if (secp256k1_ec_pubkey_serialize(&context, temp, &pubkey_size, &pubkey,
                                     SECP256K1_EC_COMPRESSED) != 1) {
     return ERROR_SECP_SERIALIZE_PUBKEY;
   }
+#endif
 
-  blake2b_init(&blake2b_ctx, BLAKE2B_BLOCK_SIZE);
-  blake2b_update(&blake2b_ctx, temp, pubkey_size);
-  blake2b_final(&blake2b_ctx, temp, BLAKE2B_BLOCK_SIZE);
+  // A compressed public key fits in a single blake2b block, so it is hashed in one
+  // shot.
+  blake2b_ckb_hash_block(temp, temp, pubkey_size);
 
   // As mentioned above, we are only using the first 160 bits(20 bytes), if they match
   // the value provided as the first 20 bytes of script args, the signature verification
   // is considered to be successful.
-  if (memcmp(args_bytes_seg.ptr, temp, BLAKE160_SIZE) != 0) {
+  if (memcmp(pubkey_hash, temp, BLAKE160_SIZE) != 0) {
     return ERROR_PUBKEY_BLAKE160_HASH;
   }
+  CKB_PROFILE_PHASE("pubkey_hash");
 
   return 0;
 }
@@ -0,0 +1,208 @@
+#ifndef CKB_SECP256K1_FIELD_5X52_RISCV64_H_
+#define CKB_SECP256K1_FIELD_5X52_RISCV64_H_
+
+/*
+ * secp256k1_fe_mul_inner and secp256k1_fe_sqr_inner for the 5x52 field, in
+ * place of the generic __int128 code of field_5x52_int128_impl.h. It is
+ * included before secp256k1.c when CKB_SECP256K1_FIELD_RISCV64 is defined,
+ * and defines the include guard of the generic code so that one is skipped.
+ *
+ * The computation is the same as the generic code, step by step, so the
+ * results are identical limb for limb. What differs is how the 128-bit
+ * accumulators are kept: as a pair of 64-bit words, each product being a
+ * mul and a mulhu of the same operands, added with a single carry. Most
+ * accumulators are shifted by 52 bits at a time, which is two shifts and an
+ * or on the pair. gcc lowers the __int128 version to generic double word
+ * arithmetic instead, with more moves and carry handling than needed.
+ *
+ * The file builds on other targets too, mulhu is then taken from __int128,
+ * so c/check_secp256k1_field.c can compare it with the generic code on the
+ * host.
+ */
+
+#include <stdint.h>
+#include "util.h"
+
+#if !defined(USE_FIELD_5X52) || defined(USE_ASM_X86_64)
+#error "secp256k1 must be configured with --with-field=64bit --with-asm=no"
+#endif
+
+#define SECP256K1_FIELD_INNER5X52_IMPL_H
+/* Guard spelling of older secp256k1 revisions */
+#define _SECP256K1_FIELD_INNER5X52_IMPL_H_
+
+typedef struct {
+  uint64_t lo;
+  uint64_t hi;
+} ckb_fe_acc_t;
+
+static SECP256K1_INLINE uint64_t ckb_fe_mulhu(uint64_t a, uint64_t b) {
+#if defined(__riscv) && __riscv_xlen == 64
+  uint64_t r;
+  __asm__("mulhu %0, %1, %2" : "=r"(r) : "r"(a), "r"(b));
+  return r;
+#else
+  return (uint64_t)(((unsigned __int128)a * b) >> 64);
+#endif
+}
+
+/* acc = a * b */
+static SECP256K1_INLINE void ckb_fe_acc_mul(ckb_fe_acc_t *acc, uint64_t a,
+                                            uint64_t b) {
+  acc->hi = ckb_fe_mulhu(a, b);
+  acc->lo = a * b;
+}
+
+/* acc += a * b */
+static SECP256K1_INLINE void ckb_fe_acc_add_mul(ckb_fe_acc_t *acc, uint64_t a,
+                                                uint64_t b) {
+  uint64_t hi = ckb_fe_mulhu(a, b);
+  uint64_t lo = a * b;
+  acc->lo += lo;
+  acc->hi += hi + (acc->lo < lo);
+}
+
+/* acc += a */
+static SECP256K1_INLINE void ckb_fe_acc_add(ckb_fe_acc_t *acc, uint64_t a) {
+  acc->lo += a;
+  acc->hi += (acc->lo < a);
+}
+
+/* acc >>= 52 */
+static SECP256K1_INLINE void ckb_fe_acc_shr52(ckb_fe_acc_t *acc) {
+  acc->lo = (acc->lo >> 52) | (acc->hi << 12);
+  acc->hi >>= 52;
+}
+
+/*
+ * The comments of the generic code about what each step keeps in c and d
+ * apply here. Wherever the generic code multiplies c or d by R, they are
+ * already below 2^64, so only their low words are used.
+ */
+SECP256K1_INLINE static void secp256k1_fe_mul_inner(
+    uint64_t *r, const uint64_t *a, const uint64_t *SECP256K1_RESTRICT b) {
+  ckb_fe_acc_t c, d;
+  uint64_t t3, t4, tx, u0;
+  uint64_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3], a4 = a[4];
+  const uint64_t M = 0xFFFFFFFFFFFFFULL, R = 0x1000003D10ULL;
+
+  ckb_fe_acc_mul(&d, a0, b[3]);
+  ckb_fe_acc_add_mul(&d, a1, b[2]);
+  ckb_fe_acc_add_mul(&d, a2, b[1]);
+  ckb_fe_acc_add_mul(&d, a3, b[0]);
+  ckb_fe_acc_mul(&c, a4, b[4]);
+  ckb_fe_acc_add_mul(&d, c.lo & M, R);
+  ckb_fe_acc_shr52(&c);
+  t3 = d.lo & M;
+  ckb_fe_acc_shr52(&d);
+
+  ckb_fe_acc_add_mul(&d, a0, b[4]);
+  ckb_fe_acc_add_mul(&d, a1, b[3]);
+  ckb_fe_acc_add_mul(&d, a2, b[2]);
+  ckb_fe_acc_add_mul(&d, a3, b[1]);
+  ckb_fe_acc_add_mul(&d, a4, b[0]);
+  ckb_fe_acc_add_mul(&d, c.lo, R);
+  t4 = d.lo & M;
+  ckb_fe_acc_shr52(&d);
+  tx = (t4 >> 48);
+  t4 &= (M >> 4);
+
+  ckb_fe_acc_mul(&c, a0, b[0]);
+  ckb_fe_acc_add_mul(&d, a1, b[4]);
+  ckb_fe_acc_add_mul(&d, a2, b[3]);
+  ckb_fe_acc_add_mul(&d, a3, b[2]);
+  ckb_fe_acc_add_mul(&d, a4, b[1]);
+  u0 = d.lo & M;
+  ckb_fe_acc_shr52(&d);
+  u0 = (u0 << 4) | tx;
+  ckb_fe_acc_add_mul(&c, u0, R >> 4);
+  r[0] = c.lo & M;
+  ckb_fe_acc_shr52(&c);
+
+  ckb_fe_acc_add_mul(&c, a0, b[1]);
+  ckb_fe_acc_add_mul(&c, a1, b[0]);
+  ckb_fe_acc_add_mul(&d, a2, b[4]);
+  ckb_fe_acc_add_mul(&d, a3, b[3]);
+  ckb_fe_acc_add_mul(&d, a4, b[2]);
+  ckb_fe_acc_add_mul(&c, d.lo & M, R);
+  ckb_fe_acc_shr52(&d);
+  r[1] = c.lo & M;
+  ckb_fe_acc_shr52(&c);
+
+  ckb_fe_acc_add_mul(&c, a0, b[2]);
+  ckb_fe_acc_add_mul(&c, a1, b[1]);
+  ckb_fe_acc_add_mul(&c, a2, b[0]);
+  ckb_fe_acc_add_mul(&d, a3, b[4]);
+  ckb_fe_acc_add_mul(&d, a4, b[3]);
+  ckb_fe_acc_add_mul(&c, d.lo & M, R);
+  ckb_fe_acc_shr52(&d);
+  r[2] = c.lo & M;
+  ckb_fe_acc_shr52(&c);
+
+  ckb_fe_acc_add_mul(&c, d.lo, R);
+  ckb_fe_acc_add(&c, t3);
+  r[3] = c.lo & M;
+  ckb_fe_acc_shr52(&c);
+  r[4] = c.lo + t4;
+}
+
+SECP256K1_INLINE static void secp256k1_fe_sqr_inner(uint64_t *r,
+                                                    const uint64_t *a) {
+  ckb_fe_acc_t c, d;
+  uint64_t t3, t4, tx, u0;
+  uint64_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3], a4 = a[4];
+  const uint64_t M = 0xFFFFFFFFFFFFFULL, R = 0x1000003D10ULL;
+
+  ckb_fe_acc_mul(&d, a0 * 2, a3);
+  ckb_fe_acc_add_mul(&d, a1 * 2, a2);
+  ckb_fe_acc_mul(&c, a4, a4);
+  ckb_fe_acc_add_mul(&d, c.lo & M, R);
+  ckb_fe_acc_shr52(&c);
+  t3 = d.lo & M;
+  ckb_fe_acc_shr52(&d);
+
+  a4 *= 2;
+  ckb_fe_acc_add_mul(&d, a0, a4);
+  ckb_fe_acc_add_mul(&d, a1 * 2, a3);
+  ckb_fe_acc_add_mul(&d, a2, a2);
+  ckb_fe_acc_add_mul(&d, c.lo, R);
+  t4 = d.lo & M;
+  ckb_fe_acc_shr52(&d);
+  tx = (t4 >> 48);
+  t4 &= (M >> 4);
+
+  ckb_fe_acc_mul(&c, a0, a0);
+  ckb_fe_acc_add_mul(&d, a1, a4);
+  ckb_fe_acc_add_mul(&d, a2 * 2, a3);
+  u0 = d.lo & M;
+  ckb_fe_acc_shr52(&d);
+  u0 = (u0 << 4) | tx;
+  ckb_fe_acc_add_mul(&c, u0, R >> 4);
+  r[0] = c.lo & M;
+  ckb_fe_acc_shr52(&c);
+
+  a0 *= 2;
+  ckb_fe_acc_add_mul(&c, a0, a1);
+  ckb_fe_acc_add_mul(&d, a2, a4);
+  ckb_fe_acc_add_mul(&d, a3, a3);
+  ckb_fe_acc_add_mul(&c, d.lo & M, R);
+  ckb_fe_acc_shr52(&d);
+  r[1] = c.lo & M;
+  ckb_fe_acc_shr52(&c);
+
+  ckb_fe_acc_add_mul(&c, a0, a2);
+  ckb_fe_acc_add_mul(&c, a1, a1);
+  ckb_fe_acc_add_mul(&d, a3, a4);
+  ckb_fe_acc_add_mul(&c, d.lo & M, R);
+  ckb_fe_acc_shr52(&d);
+  r[2] = c.lo & M;
+  ckb_fe_acc_shr52(&c);
+
+  ckb_fe_acc_add_mul(&c, d.lo, R);
+  ckb_fe_acc_add(&c, t3);
+  r[3] = c.lo & M;
+  ckb_fe_acc_shr52(&c);
+  r[4] = c.lo + t4;
+}
+
+#endif /* CKB_SECP256K1_FIELD_5X52_RISCV64_H_ */
@@ -7,6 +7,14 @@
 #define CKB_SECP256K1_HELPER_ERROR_LOADING_DATA -101
 #define CKB_SECP256K1_HELPER_ERROR_ILLEGAL_CALLBACK -102
 #define CKB_SECP256K1_HELPER_ERROR_ERROR_CALLBACK -103
+#define CKB_SECP256K1_HELPER_ERROR_LOADING_LIBRARY -104
+
+/*
+ * With CKB_SECP256K1_USE_CRYPTO_LIB defined, secp256k1 is not compiled in:
+ * the secp256k1 data is only mapped here, and the code comes from the crypto
+ * library cell loaded by ckb_crypto_lib_load below.
+ */
+#ifndef CKB_SECP256K1_USE_CRYPTO_LIB
 
 /*
  * We are including secp256k1 implementation directly so gcc can strip
@@ -15,8 +23,20 @@
  */
 #define HAVE_CONFIG_H 1
 #define USE_EXTERNAL_DEFAULT_CALLBACKS
+#ifdef CKB_SECP256K1_FIELD_RISCV64
+#include "secp256k1_field_5x52_riscv64.h"
+#endif
 #include <secp256k1.c>
 
+/*
+ * secp256k1_data variants can be generated with different window sizes, the
+ * verifier must be compiled with the same window size as the loaded table.
+ */
+#if defined(CKB_SECP256K1_DATA_WINDOW_SIZE) && \
+    CKB_SECP256K1_DATA_WINDOW_SIZE != WINDOW_G
+#error "secp256k1 data is generated with a different ecmult window size!"
+#endif
+
 void secp256k1_default_illegal_callback_fn(const char* str, void* data) {
   (void)str;
   (void)data;
@@ -29,45 +49,105 @@ void secp256k1_default_error_callback_fn(const char* str, void* data) {
   ckb_exit(CKB_SECP256K1_HELPER_ERROR_ERROR_CALLBACK);
 }
 
+#endif /* CKB_SECP256K1_USE_CRYPTO_LIB */
+
 /*
- * data should at least be CKB_SECP256K1_DATA_SIZE big
- * so as to hold all loaded data.
+ * Pass this as the dep index hint when the caller has no idea where the
+ * secp256k1 data cell is, the cell deps are scanned from the start then.
  */
-int ckb_secp256k1_custom_verify_only_initialize(secp256k1_context* context,
-                                                void* data) {
-  size_t index = 0;
-  int running = 1;
-  while (running && index < SIZE_MAX) {
-    uint64_t len = 32;
-    uint8_t hash[32];
-
-    int ret = ckb_load_cell_by_field(hash, &len, 0, index, CKB_SOURCE_CELL_DEP,
-                                     CKB_CELL_FIELD_DATA_HASH);
-    switch (ret) {
-      case CKB_ITEM_MISSING:
-        break;
-      case CKB_SUCCESS:
-        if (memcmp(ckb_secp256k1_data_hash, hash, 32) == 0) {
-          /* Found a match, load data here */
-          len = CKB_SECP256K1_DATA_SIZE;
-          ret = ckb_load_cell_data(data, &len, 0, index, CKB_SOURCE_CELL_DEP);
-          if (ret != CKB_SUCCESS || len != CKB_SECP256K1_DATA_SIZE) {
-            return CKB_SECP256K1_HELPER_ERROR_LOADING_DATA;
-          }
-          running = 0;
-        }
-        break;
-      default:
-        return CKB_SECP256K1_HELPER_ERROR_LOADING_DATA;
+#define CKB_SECP256K1_NO_DEP_INDEX_HINT SIZE_MAX
+
+/*
+ * Index of the secp256k1 data cell in cell deps. In the genesis dep group,
+ * the data cell is listed before the lock scripts, so a transaction putting
+ * the dep group first gets the data at index 0.
+ */
+#ifndef CKB_SECP256K1_DATA_DEP_INDEX_HINT
+#define CKB_SECP256K1_DATA_DEP_INDEX_HINT 0
+#endif
+
+/*
+ * Cell dep index of the secp256k1 data cell found by a previous lookup in
+ * current script run.
+ */
+static size_t ckb_secp256k1_data_dep_index = SIZE_MAX;
+
+/*
+ * Checks if the cell dep at index contains data with the given hash, matched
+ * is set to 1 when it does. A missing cell dep data is not an error here.
+ */
+static int ckb_secp256k1_check_data_dep(const uint8_t* data_hash, size_t index,
+                                        int* matched) {
+  uint64_t len = 32;
+  uint8_t hash[32];
+
+  *matched = 0;
+  int ret = ckb_load_cell_by_field(hash, &len, 0, index, CKB_SOURCE_CELL_DEP,
+                                   CKB_CELL_FIELD_DATA_HASH);
+  if (ret == CKB_SUCCESS && len == 32 && memcmp(data_hash, hash, 32) == 0) {
+    *matched = 1;
+  }
+  return ret;
+}
+
+/*
+ * Looks up the cell dep index of the data with the given hash. The hint is
+ * checked first with a single hash load, only when it misses are the cell
+ * deps scanned in order.
+ */
+static int ckb_secp256k1_scan_data_dep(const uint8_t* data_hash, size_t hint,
+                                       size_t* index) {
+  int matched = 0;
+  if (hint != CKB_SECP256K1_NO_DEP_INDEX_HINT) {
+    ckb_secp256k1_check_data_dep(data_hash, hint, &matched);
+    if (matched) {
+      *index = hint;
+      return CKB_SUCCESS;
     }
-    if (running) {
-      index++;
+  }
+  size_t i = 0;
+  while (i < SIZE_MAX) {
+    /* The hint has already been checked above */
+    if (i != hint) {
+      int ret = ckb_secp256k1_check_data_dep(data_hash, i, &matched);
+      if (ret != CKB_SUCCESS && ret != CKB_ITEM_MISSING) {
+        return ret;
+      }
+      if (matched) {
+        *index = i;
+        return CKB_SUCCESS;
+      }
     }
+    i++;
   }
-  if (index == SIZE_MAX) {
+  return CKB_INDEX_OUT_OF_BOUND;
+}
+
+/*
+ * Looks up the cell dep index of the secp256k1 data, the cached index from
+ * a previous lookup is used first.
+ */
+static int ckb_secp256k1_find_data_dep(size_t hint, size_t* index) {
+  if (ckb_secp256k1_data_dep_index != SIZE_MAX) {
+    *index = ckb_secp256k1_data_dep_index;
+    return CKB_SUCCESS;
+  }
+  if (ckb_secp256k1_scan_data_dep(ckb_secp256k1_data_hash, hint, index) !=
+      CKB_SUCCESS) {
     return CKB_SECP256K1_HELPER_ERROR_LOADING_DATA;
   }
+  ckb_secp256k1_data_dep_index = *index;
+  return CKB_SUCCESS;
+}
+
+#ifndef CKB_SECP256K1_USE_CRYPTO_LIB
 
+/*
+ * Points the verify only context to the precomputed tables in data, which
+ * holds pre_g followed by pre_g_128.
+ */
+static void ckb_secp256k1_setup_context(secp256k1_context* context,
+                                        void* data) {
   context->illegal_callback = default_illegal_callback;
   context->error_callback = default_error_callback;
 
@@ -81,8 +161,153 @@ int ckb_secp256k1_custom_verify_only_initialize(secp256k1_context* context,
       (secp256k1_ge_storage(*)[])(&p[CKB_SECP256K1_DATA_PRE_SIZE]);
   context->ecmult_ctx.pre_g = pre_g;
   context->ecmult_ctx.pre_g_128 = pre_g_128;
+}
+
+/*
+ * data should at least be CKB_SECP256K1_DATA_SIZE big
+ * so as to hold all loaded data.
+ *
+ * dep_index_hint is the cell dep index where the caller expects the
+ * secp256k1 data to be, use CKB_SECP256K1_NO_DEP_INDEX_HINT if unknown.
+ */
+int ckb_secp256k1_custom_verify_only_initialize_with_hint(
+    secp256k1_context* context, void* data, size_t dep_index_hint) {
+  size_t index = 0;
+  int ret = ckb_secp256k1_find_data_dep(dep_index_hint, &index);
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  uint64_t len = CKB_SECP256K1_DATA_SIZE;
+  ret = ckb_load_cell_data(data, &len, 0, index, CKB_SOURCE_CELL_DEP);
+  if (ret != CKB_SUCCESS || len != CKB_SECP256K1_DATA_SIZE) {
+    return CKB_SECP256K1_HELPER_ERROR_LOADING_DATA;
+  }
 
+  ckb_secp256k1_setup_context(context, data);
   return 0;
 }
 
+/*
+ * data should at least be CKB_SECP256K1_DATA_SIZE big
+ * so as to hold all loaded data.
+ */
+int ckb_secp256k1_custom_verify_only_initialize(secp256k1_context* context,
+                                                void* data) {
+  return ckb_secp256k1_custom_verify_only_initialize_with_hint(
+      context, data, CKB_SECP256K1_NO_DEP_INDEX_HINT);
+}
+
+#endif /* CKB_SECP256K1_USE_CRYPTO_LIB */
+
+/*
+ * load_cell_data_as_code works on whole pages of VM memory.
+ */
+#define CKB_SECP256K1_PAGE_SIZE 4096
+
+#if CKB_SECP256K1_DATA_SIZE % CKB_SECP256K1_PAGE_SIZE != 0
+#error "secp256k1 data size must be a multiple of the page size!"
+#endif
+
+/*
+ * Page aligned region the secp256k1 data gets mapped to. Mapped pages are
+ * frozen by the VM, so the data is mapped at most once per script run.
+ */
+static uint8_t ckb_secp256k1_data_region[CKB_SECP256K1_DATA_SIZE]
+    __attribute__((aligned(CKB_SECP256K1_PAGE_SIZE)));
+static int ckb_secp256k1_data_region_mapped = 0;
+
+/*
+ * Maps the secp256k1 data into a static page aligned region with
+ * load_cell_data_as_code, data is set to the region. Later calls in the same
+ * script run reuse the mapped data directly.
+ *
+ * Note secp256k1_ecmult reads from the whole of both pre_g and pre_g_128
+ * tables, so there are no parts that can be skipped when mapping.
+ */
+int ckb_secp256k1_map_data(size_t dep_index_hint, const void** data) {
+  if (!ckb_secp256k1_data_region_mapped) {
+    size_t index = 0;
+    int ret = ckb_secp256k1_find_data_dep(dep_index_hint, &index);
+    if (ret != CKB_SUCCESS) {
+      return ret;
+    }
+    ret = ckb_load_cell_code(ckb_secp256k1_data_region, CKB_SECP256K1_DATA_SIZE,
+                             0, CKB_SECP256K1_DATA_SIZE, index,
+                             CKB_SOURCE_CELL_DEP);
+    if (ret != CKB_SUCCESS) {
+      return CKB_SECP256K1_HELPER_ERROR_LOADING_DATA;
+    }
+    ckb_secp256k1_data_region_mapped = 1;
+  }
+  *data = ckb_secp256k1_data_region;
+  return 0;
+}
+
+#ifndef CKB_SECP256K1_USE_CRYPTO_LIB
+
+/*
+ * Same as ckb_secp256k1_custom_verify_only_initialize_with_hint, except
+ * that the secp256k1 data is mapped with ckb_secp256k1_map_data, instead of
+ * being copied into a caller provided buffer. This keeps the 1MB table off
+ * the stack.
+ */
+int ckb_secp256k1_custom_verify_only_initialize_mapped(
+    secp256k1_context* context, size_t dep_index_hint) {
+  const void* data = NULL;
+  int ret = ckb_secp256k1_map_data(dep_index_hint, &data);
+  if (ret != 0) {
+    return ret;
+  }
+  ckb_secp256k1_setup_context(context, (void*)data);
+  return 0;
+}
+
+#else
+
+#include "crypto_lib.h"
+#include "crypto_lib_info.h"
+
+/*
+ * Cell dep index of the crypto library cell, it is not part of the genesis
+ * dep group, so by default the cell deps are scanned for it.
+ */
+#ifndef CKB_CRYPTO_LIB_DEP_INDEX_HINT
+#define CKB_CRYPTO_LIB_DEP_INDEX_HINT CKB_SECP256K1_NO_DEP_INDEX_HINT
+#endif
+
+#define CKB_CRYPTO_LIB_MEMORY_SIZE                                \
+  ((CKB_CRYPTO_LIB_SIZE + CKB_SECP256K1_PAGE_SIZE - 1) /          \
+   CKB_SECP256K1_PAGE_SIZE * CKB_SECP256K1_PAGE_SIZE)
+
+static uint8_t ckb_crypto_lib_region[CKB_CRYPTO_LIB_MEMORY_SIZE]
+    __attribute__((aligned(CKB_SECP256K1_PAGE_SIZE)));
+
+/*
+ * Maps the crypto library cell with load_cell_data_as_code, and fills in
+ * lib from its entry function. The cell is looked up by the data hash the
+ * lock is compiled with, so only the exact library built along with the lock
+ * is ever run. Like the secp256k1 data, the library can only be mapped once
+ * per script run.
+ */
+int ckb_crypto_lib_load(ckb_crypto_lib_t* lib, size_t dep_index_hint) {
+  size_t index = 0;
+  int ret = ckb_secp256k1_scan_data_dep(ckb_crypto_lib_data_hash,
+                                        dep_index_hint, &index);
+  if (ret != CKB_SUCCESS) {
+    return CKB_SECP256K1_HELPER_ERROR_LOADING_LIBRARY;
+  }
+  ret = ckb_load_cell_code(ckb_crypto_lib_region, CKB_CRYPTO_LIB_MEMORY_SIZE, 0,
+                           CKB_CRYPTO_LIB_SIZE, index, CKB_SOURCE_CELL_DEP);
+  if (ret != CKB_SUCCESS) {
+    return CKB_SECP256K1_HELPER_ERROR_LOADING_LIBRARY;
+  }
+  ckb_crypto_lib_entry_t entry = (ckb_crypto_lib_entry_t)ckb_crypto_lib_region;
+  if (entry(lib, CKB_CRYPTO_LIB_VERSION) != 0) {
+    return CKB_SECP256K1_HELPER_ERROR_LOADING_LIBRARY;
+  }
+  return 0;
+}
+
+#endif /* CKB_SECP256K1_USE_CRYPTO_LIB */
+
 #endif
@@ -0,0 +1,209 @@
+/*
+trace.h
+
+Call stack tracing for the native replay builds of the scripts, enabled by
+building with CKB_SCRIPT_TRACE and -finstrument-functions, with this header
+included ahead of the script by -include (see `make trace` and
+CMakeLists.txt). gcc then calls the two hooks below on entry and exit of
+every function which is not excluded, and the time spent between two hooks
+is added to the call stack running at that time. The time of the hooks
+themselves is left out.
+
+Call stacks are kept as a tree, a node per function and call site under its
+caller. When the script returns, each node is printed with ckb_debug as one
+line, from the outermost frame to the node itself:
+
+  trace <function>@<call site>;... <nanoseconds> <calls>
+
+Addresses are hexadecimal, they are turned into function names and source
+lines with the symbols of the traced binary, see src/tests/trace.rs. Calls
+beyond the node or depth limit are counted in their deepest traced caller.
+
+The times come from the monotonic clock, as in profile.h: CKB-VM at the ckb
+version pinned in Cargo.toml has no cycle CSRs for rdcycle to read, nor a
+hook into the verifier to sample, so this mode is refused in RISC-V builds.
+The replay file is read before tracing starts.
+
+Unlike profile.h, this needs no markers in the scripts, which are also left
+untouched when CKB_SCRIPT_TRACE is not defined.
+*/
+
+#ifndef CKB_TRACE_H_
+#define CKB_TRACE_H_
+
+#ifdef CKB_SCRIPT_TRACE
+
+#if defined(__riscv)
+#error "CKB_SCRIPT_TRACE needs a cycle source CKB-VM lacks, trace the native replay build"
+#endif
+
+#ifdef CKB_SCRIPT_PROFILE
+#error "CKB_SCRIPT_TRACE and CKB_SCRIPT_PROFILE both wrap main"
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+#include "ckb_syscalls.h"
+
+#define CKB_TRACE_MAX_NODES 2048
+#define CKB_TRACE_MAX_DEPTH 32
+#define CKB_TRACE_MESSAGE_SIZE 1024
+
+#define CKB_TRACE_HOOK __attribute__((no_instrument_function))
+
+typedef struct {
+  uintptr_t fn;
+  uintptr_t call_site;
+  uint32_t parent;
+  /* 0 ends both lists, the root is never a child */
+  uint32_t first_child;
+  uint32_t next_sibling;
+  uint32_t depth;
+  uint64_t cycles;
+  uint64_t calls;
+} ckb_trace_node_t;
+
+/* node 0 is the root, whose time is the one outside of the script main */
+static ckb_trace_node_t ckb_trace_nodes[CKB_TRACE_MAX_NODES];
+static uint32_t ckb_trace_nodes_len = 1;
+static uint32_t ckb_trace_current = 0;
+/* frames entered without a node of their own, on top of the current node */
+static uint32_t ckb_trace_untracked = 0;
+static uint64_t ckb_trace_last = 0;
+/* the hooks do nothing before main and while the trace is printed */
+static int ckb_trace_enabled = 0;
+
+static inline CKB_TRACE_HOOK uint64_t ckb_trace_cycles() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void CKB_TRACE_HOOK __cyg_profile_func_enter(void *fn, void *call_site) {
+  if (!ckb_trace_enabled) {
+    return;
+  }
+  ckb_trace_node_t *current = &ckb_trace_nodes[ckb_trace_current];
+  current->cycles += ckb_trace_cycles() - ckb_trace_last;
+
+  if (ckb_trace_untracked > 0 || current->depth + 1 >= CKB_TRACE_MAX_DEPTH) {
+    ckb_trace_untracked++;
+  } else {
+    uint32_t child = current->first_child;
+    while (child != 0 && (ckb_trace_nodes[child].fn != (uintptr_t)fn ||
+                          ckb_trace_nodes[child].call_site !=
+                              (uintptr_t)call_site)) {
+      child = ckb_trace_nodes[child].next_sibling;
+    }
+    if (child == 0 && ckb_trace_nodes_len < CKB_TRACE_MAX_NODES) {
+      child = ckb_trace_nodes_len++;
+      ckb_trace_node_t *node = &ckb_trace_nodes[child];
+      node->fn = (uintptr_t)fn;
+      node->call_site = (uintptr_t)call_site;
+      node->parent = ckb_trace_current;
+      node->depth = current->depth + 1;
+      node->next_sibling = current->first_child;
+      current->first_child = child;
+    }
+    if (child != 0) {
+      ckb_trace_nodes[child].calls++;
+      ckb_trace_current = child;
+    } else {
+      ckb_trace_untracked++;
+    }
+  }
+  ckb_trace_last = ckb_trace_cycles();
+}
+
+void CKB_TRACE_HOOK __cyg_profile_func_exit(void *fn, void *call_site) {
+  (void)fn;
+  (void)call_site;
+  if (!ckb_trace_enabled) {
+    return;
+  }
+  ckb_trace_node_t *current = &ckb_trace_nodes[ckb_trace_current];
+  current->cycles += ckb_trace_cycles() - ckb_trace_last;
+  if (ckb_trace_untracked > 0) {
+    ckb_trace_untracked--;
+  } else if (ckb_trace_current != 0) {
+    ckb_trace_current = current->parent;
+  }
+  ckb_trace_last = ckb_trace_cycles();
+}
+
+static CKB_TRACE_HOOK size_t ckb_trace_append_char(char *message, size_t pos,
+                                                   char c) {
+  if (pos + 1 < CKB_TRACE_MESSAGE_SIZE) {
+    message[pos++] = c;
+  }
+  return pos;
+}
+
+static CKB_TRACE_HOOK size_t ckb_trace_append_number(char *message,
+                                                     size_t pos,
+                                                     uint64_t value,
+                                                     uint64_t base) {
+  char digits[20];
+  size_t n = 0;
+  do {
+    digits[n++] = "0123456789abcdef"[value % base];
+    value /= base;
+  } while (value > 0);
+  while (n > 0) {
+    pos = ckb_trace_append_char(message, pos, digits[--n]);
+  }
+  return pos;
+}
+
+static CKB_TRACE_HOOK void ckb_trace_report() {
+  char message[CKB_TRACE_MESSAGE_SIZE];
+  uint32_t stack[CKB_TRACE_MAX_DEPTH];
+  for (uint32_t i = 1; i < ckb_trace_nodes_len; i++) {
+    size_t depth = 0;
+    for (uint32_t n = i; n != 0; n = ckb_trace_nodes[n].parent) {
+      stack[depth++] = n;
+    }
+    size_t pos = 0;
+    const char *prefix = "trace ";
+    while (*prefix) {
+      pos = ckb_trace_append_char(message, pos, *prefix++);
+    }
+    while (depth > 0) {
+      const ckb_trace_node_t *node = &ckb_trace_nodes[stack[--depth]];
+      pos = ckb_trace_append_number(message, pos, node->fn, 16);
+      pos = ckb_trace_append_char(message, pos, '@');
+      pos = ckb_trace_append_number(message, pos, node->call_site, 16);
+      if (depth > 0) {
+        pos = ckb_trace_append_char(message, pos, ';');
+      }
+    }
+    pos = ckb_trace_append_char(message, pos, ' ');
+    pos = ckb_trace_append_number(message, pos, ckb_trace_nodes[i].cycles, 10);
+    pos = ckb_trace_append_char(message, pos, ' ');
+    pos = ckb_trace_append_number(message, pos, ckb_trace_nodes[i].calls, 10);
+    message[pos] = '\0';
+    ckb_debug(message);
+  }
+}
+
+/*
+ * The script's main is wrapped the same way as in profile.h, so the trace is
+ * printed on every return path of the script.
+ */
+#define main() ckb_trace_script_main()
+int ckb_trace_script_main();
+
+CKB_TRACE_HOOK int(main)() {
+  ckb_replay_load();
+  ckb_trace_enabled = 1;
+  ckb_trace_last = ckb_trace_cycles();
+  int ret = ckb_trace_script_main();
+  ckb_trace_enabled = 0;
+  ckb_trace_report();
+  return ret;
+}
+
+#endif /* CKB_SCRIPT_TRACE */
+
+#endif /* CKB_TRACE_H_ */
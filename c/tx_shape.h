@@ -0,0 +1,127 @@
+/*
+tx_shape.h
+
+Keeps the number of inputs, outputs, witnesses and group inputs of current
+transaction, so each of them is only figured out once per script run. A count
+is either recorded by a loop which already walks to the end of its source, or
+probed lazily with a doubling and binary search when it is first needed.
+*/
+
+#ifndef CKB_TX_SHAPE_H_
+#define CKB_TX_SHAPE_H_
+
+#include "ckb_syscalls.h"
+
+/* a count which is not known yet */
+#define TX_SHAPE_UNKNOWN SIZE_MAX
+
+typedef struct {
+  size_t inputs_len;
+  size_t outputs_len;
+  size_t witnesses_len;
+  size_t group_inputs_len;
+} tx_shape_t;
+
+void tx_shape_init(tx_shape_t *shape) {
+  shape->inputs_len = TX_SHAPE_UNKNOWN;
+  shape->outputs_len = TX_SHAPE_UNKNOWN;
+  shape->witnesses_len = TX_SHAPE_UNKNOWN;
+  shape->group_inputs_len = TX_SHAPE_UNKNOWN;
+}
+
+typedef int (*tx_shape_probe_t)(size_t index, size_t source);
+
+static int tx_shape_probe_input(size_t index, size_t source) {
+  uint64_t len = 0;
+  return ckb_load_input_by_field(NULL, &len, 0, index, source,
+                                 CKB_INPUT_FIELD_SINCE);
+}
+
+static int tx_shape_probe_cell(size_t index, size_t source) {
+  uint64_t len = 0;
+  return ckb_load_cell_by_field(NULL, &len, 0, index, source,
+                                CKB_CELL_FIELD_CAPACITY);
+}
+
+static int tx_shape_probe_witness(size_t index, size_t source) {
+  uint64_t len = 0;
+  return ckb_load_witness(NULL, &len, 0, index, source);
+}
+
+/* count the items of a source, first keep doubling the higher bound until
+ probing fails, then binary search between the lower and higher bound */
+static int tx_shape_count(tx_shape_probe_t probe, size_t source,
+                          size_t *count) {
+  int ret = probe(0, source);
+  if (ret == CKB_INDEX_OUT_OF_BOUND) {
+    *count = 0;
+    return CKB_SUCCESS;
+  }
+  if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+  /* lo is always an existing index, hi is always a missing one */
+  size_t lo = 0;
+  size_t hi = 4;
+  while (1) {
+    ret = probe(hi, source);
+    if (ret == CKB_INDEX_OUT_OF_BOUND) {
+      break;
+    }
+    if (ret != CKB_SUCCESS) {
+      return ret;
+    }
+    lo = hi;
+    hi *= 2;
+  }
+  while (lo + 1 != hi) {
+    size_t i = (lo + hi) / 2;
+    ret = probe(i, source);
+    if (ret == CKB_SUCCESS) {
+      lo = i;
+    } else if (ret == CKB_INDEX_OUT_OF_BOUND) {
+      hi = i;
+    } else {
+      return ret;
+    }
+  }
+  *count = hi;
+  return CKB_SUCCESS;
+}
+
+static int tx_shape_load(size_t *field, tx_shape_probe_t probe, size_t source,
+                         size_t *len) {
+  if (*field == TX_SHAPE_UNKNOWN) {
+    int ret = tx_shape_count(probe, source, field);
+    if (ret != CKB_SUCCESS) {
+      *field = TX_SHAPE_UNKNOWN;
+      return ret;
+    }
+  }
+  *len = *field;
+  return CKB_SUCCESS;
+}
+
+int tx_shape_load_inputs_len(tx_shape_t *shape, size_t *len) {
+  return tx_shape_load(&shape->inputs_len, tx_shape_probe_input,
+                       CKB_SOURCE_INPUT, len);
+}
+
+int tx_shape_load_outputs_len(tx_shape_t *shape, size_t *len) {
+  return tx_shape_load(&shape->outputs_len, tx_shape_probe_cell,
+                       CKB_SOURCE_OUTPUT, len);
+}
+
+/* witnesses are counted through the plain input source, which indexes all
+ witnesses of the transaction, including the ones beyond the inputs */
+int tx_shape_load_witnesses_len(tx_shape_t *shape, size_t *len) {
+  return tx_shape_load(&shape->witnesses_len, tx_shape_probe_witness,
+                       CKB_SOURCE_INPUT, len);
+}
+
+int tx_shape_load_group_inputs_len(tx_shape_t *shape, size_t *len) {
+  return tx_shape_load(&shape->group_inputs_len, tx_shape_probe_input,
+                       CKB_SOURCE_GROUP_INPUT, len);
+}
+
+#endif /* CKB_TX_SHAPE_H_ */
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blake2b.h"
+
+/*
+ * Rewrites the code hashes build.rs checks the bundled binaries against,
+ * from the binaries themselves: each binary is hashed the way build.rs does,
+ * and the hash following its name in build.rs is replaced. Run by
+ * `make update-code-hashes` after the binaries are rebuilt.
+ */
+
+#define ERROR_IO -1
+#define ERROR_ARGUMENTS -2
+#define ERROR_NOT_FOUND -3
+
+#define HASH_SIZE 32
+#define HEX_HASH_SIZE (HASH_SIZE * 2)
+#define BUF_SIZE (8 * 1024)
+
+static char *read_file(const char *path, size_t *size) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return NULL;
+  }
+  fseek(fp, 0, SEEK_END);
+  long len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *content = malloc(len + 1);
+  if (content == NULL || fread(content, 1, len, fp) != (size_t)len) {
+    fclose(fp);
+    free(content);
+    return NULL;
+  }
+  fclose(fp);
+  content[len] = '\0';
+  *size = len;
+  return content;
+}
+
+static int hash_file(const char *path, char *hex) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return ERROR_IO;
+  }
+  blake2b_state blake2b_ctx;
+  uint8_t buf[BUF_SIZE];
+  uint8_t hash[HASH_SIZE];
+  blake2b_init(&blake2b_ctx, HASH_SIZE);
+  size_t n;
+  while ((n = fread(buf, 1, BUF_SIZE, fp)) > 0) {
+    blake2b_update(&blake2b_ctx, buf, n);
+  }
+  fclose(fp);
+  blake2b_final(&blake2b_ctx, hash, HASH_SIZE);
+  for (int i = 0; i < HASH_SIZE; i++) {
+    sprintf(&hex[i * 2], "%02x", hash[i]);
+  }
+  return 0;
+}
+
+/*
+ * The entries of BINARIES in build.rs are a quoted name followed by the
+ * quoted hash, which is the next string literal after the name.
+ */
+static char *find_hash(char *content, const char *name) {
+  char quoted[256];
+  if (snprintf(quoted, sizeof(quoted), "\"%s\",", name) >=
+      (int)sizeof(quoted)) {
+    return NULL;
+  }
+  char *entry = strstr(content, quoted);
+  if (entry == NULL) {
+    return NULL;
+  }
+  char *hash = strchr(entry + strlen(quoted), '"');
+  if (hash == NULL || strlen(hash) < HEX_HASH_SIZE + 2 ||
+      hash[HEX_HASH_SIZE + 1] != '"') {
+    return NULL;
+  }
+  return hash + 1;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s <build.rs> <binary>...\n", argv[0]);
+    return ERROR_ARGUMENTS;
+  }
+  size_t size;
+  char *content = read_file(argv[1], &size);
+  if (content == NULL) {
+    fprintf(stderr, "cannot read %s\n", argv[1]);
+    return ERROR_IO;
+  }
+  for (int i = 2; i < argc; i++) {
+    const char *name = strrchr(argv[i], '/');
+    name = name ? name + 1 : argv[i];
+    char hex[HEX_HASH_SIZE + 1];
+    if (hash_file(argv[i], hex) != 0) {
+      fprintf(stderr, "cannot read %s\n", argv[i]);
+      return ERROR_IO;
+    }
+    char *hash = find_hash(content, name);
+    if (hash == NULL) {
+      fprintf(stderr, "no code hash of %s in %s\n", name, argv[1]);
+      return ERROR_NOT_FOUND;
+    }
+    if (memcmp(hash, hex, HEX_HASH_SIZE) != 0) {
+      printf("%s: %.*s -> %s\n", name, HEX_HASH_SIZE, hash, hex);
+      memcpy(hash, hex, HEX_HASH_SIZE);
+    }
+  }
+  FILE *fp = fopen(argv[1], "wb");
+  if (!fp || fwrite(content, 1, size, fp) != size) {
+    fprintf(stderr, "cannot write %s\n", argv[1]);
+    return ERROR_IO;
+  }
+  fclose(fp);
+  return 0;
+}
@@ -0,0 +1,103 @@
+//! Verification of many transactions at once, for indexers re-verifying history.
+//!
+//! The crate doesn't depend on the verifier, so `verify_batch` takes the verification
+//! of one item as a closure, typically a `TransactionScriptsVerifier` run returning its
+//! cycles or error. What is shared between the items is the bundled script data:
+//! `shared_cell_data` decodes each bundled binary once per process, a cell meta built
+//! with `Bytes::from_static` on it then points every transaction at the same copy of
+//! the binaries and of secp256k1_data.
+
+use lazy_static::lazy_static;
+use std::{
+    borrow::Cow,
+    collections::HashMap,
+    panic,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc,
+    },
+    thread,
+};
+
+lazy_static! {
+    static ref SHARED_CELLS: HashMap<&'static str, &'static [u8]> = crate::BUNDLED_CELL
+        .files
+        .keys()
+        .map(|path| {
+            let data: &'static [u8] = match crate::BUNDLED_CELL.get(path) {
+                Ok(Cow::Borrowed(data)) => data,
+                Ok(Cow::Owned(data)) => Box::leak(data.into_boxed_slice()),
+                Err(err) => panic!("decode bundled {}: {}", path, err),
+            };
+            (*path, data)
+        })
+        .collect();
+}
+
+/// Returns the bundled binary at `path`, such as `"specs/cells/secp256k1_data"`.
+///
+/// All the bundled binaries are decoded on the first call and kept for the lifetime
+/// of the process, later calls from any thread return the same slices. With the
+/// `uncompressed` feature nothing is decoded, the slices are the ones in the
+/// executable image.
+pub fn shared_cell_data(path: &str) -> Option<&'static [u8]> {
+    SHARED_CELLS.get(path).cloned()
+}
+
+/// Runs `verify` on every item of `items` on `threads` threads, and returns the
+/// results in the order of `items`.
+///
+/// Each thread takes the next item not taken yet, so a thread stuck on an expensive
+/// transaction doesn't hold up the items behind it. A panic in `verify` is resumed in
+/// the calling thread once all threads have stopped.
+pub fn verify_batch<T, R, F>(items: Vec<T>, threads: usize, verify: F) -> Vec<R>
+where
+    T: Send + Sync + 'static,
+    R: Send + 'static,
+    F: Fn(&T) -> R + Send + Sync + 'static,
+{
+    assert!(threads > 0, "verify_batch needs at least one thread");
+    let len = items.len();
+    let items = Arc::new(items);
+    let verify = Arc::new(verify);
+    let next = Arc::new(AtomicUsize::new(0));
+
+    let handles: Vec<_> = (0..threads.min(len))
+        .map(|_| {
+            let items = Arc::clone(&items);
+            let verify = Arc::clone(&verify);
+            let next = Arc::clone(&next);
+            thread::spawn(move || {
+                let mut results = Vec::new();
+                loop {
+                    let i = next.fetch_add(1, Ordering::Relaxed);
+                    if i >= items.len() {
+                        break;
+                    }
+                    results.push((i, verify(&items[i])));
+                }
+                results
+            })
+        })
+        .collect();
+
+    let mut results: Vec<Option<R>> = (0..len).map(|_| None).collect();
+    let mut panicked = None;
+    for handle in handles {
+        match handle.join() {
+            Ok(thread_results) => {
+                for (i, result) in thread_results {
+                    results[i] = Some(result);
+                }
+            }
+            Err(payload) => panicked = Some(payload),
+        }
+    }
+    if let Some(payload) = panicked {
+        panic::resume_unwind(payload);
+    }
+    results
+        .into_iter()
+        .map(|result| result.expect("verified item"))
+        .collect()
+}
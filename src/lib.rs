@@ -2,11 +2,31 @@
 //! pub use const CODE_HASH_DAO: [u8; 32]
 //! pub use const CODE_HASH_SECP256K1_BLAKE160_SIGHASH_ALL: [u8; 32]
 //! pub use const CODE_HASH_SECP256K1_RIPEMD160_SHA256_SIGHASH_ALL: [u8; 32]
+//! pub use fn bundled_cell_data(path: &str) -> Option<&'static [u8]>, with the
+//! `uncompressed` feature
+//! pub use fn shared_cell_data(path: &str) -> Option<&'static [u8]>
+//! pub use fn verify_batch<T, R, F>(items: Vec<T>, threads: usize, verify: F) -> Vec<R>
+//! pub use struct SigningMessages, signing messages of the lock groups of a transaction
 
 #![allow(clippy::unreadable_literal)]
 
 include!(concat!(env!("OUT_DIR"), "/bundled.rs"));
 include!(concat!(env!("OUT_DIR"), "/code_hashes.rs"));
 
+mod batch;
+mod signing;
+
+pub use batch::{shared_cell_data, verify_batch};
+pub use signing::{SigningError, SigningMessages, SIGNATURE_SIZE};
+
+/// Returns the bundled binary at `path`, such as `"specs/cells/dao"`, as it is
+/// stored in the executable image. Unlike `BUNDLED_CELL.get`, there is neither
+/// decompression nor allocation involved, since the binaries are bundled
+/// uncompressed with the `uncompressed` feature.
+#[cfg(feature = "uncompressed")]
+pub fn bundled_cell_data(path: &str) -> Option<&'static [u8]> {
+    BUNDLED_CELL.files.get(path).map(|(_, data)| *data)
+}
+
 #[cfg(test)]
 mod tests;
@@ -0,0 +1,231 @@
+//! Signing messages of the lock scripts, for signers outside of a CKB node.
+//!
+//! The message is the one `calculate_sighash_all_message` in `c/common.h` computes:
+//! the blake2b hash of the tx hash, then each witness preceded by its length as a
+//! 64-bit little endian integer: the first witness of the lock group with the
+//! signatures part of its lock hashed as zeros, the other witnesses of the group, and
+//! all witnesses without a matching input. The witnesses are hashed from the slices
+//! given to `SigningMessages::new`, nothing is copied.
+//!
+//! Because the witnesses without a matching input come last in every message, their
+//! hashing cannot be shared between the groups of a transaction. What is worked out
+//! once per transaction is which witnesses they are; each group then only hashes its
+//! own witnesses in front of them.
+
+use blake2b_rs::{Blake2b, Blake2bBuilder};
+use std::{error::Error, fmt};
+
+/// Size of a recoverable secp256k1 signature in a lock.
+pub const SIGNATURE_SIZE: usize = 65;
+
+const MESSAGE_SIZE: usize = 32;
+const CKB_HASH_PERSONALIZATION: &[u8] = b"ckb-default-hash";
+// The lock scripts load the first witness of a group in one go, into a buffer of
+// this size.
+const MAX_WITNESS_SIZE: usize = 32768;
+const MOL_NUM_SIZE: usize = 4;
+const WITNESS_ARGS_FIELD_COUNT: usize = 3;
+const MULTISIG_FLAGS_SIZE: usize = 4;
+const MULTISIG_MODE_SORTED: u8 = 1;
+const BLAKE160_SIZE: usize = 20;
+
+static ZEROS: [u8; 128] = [0; 128];
+
+/// Why a lock group cannot be signed, each is a transaction its lock script rejects.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum SigningError {
+    /// The group has no input, its inputs are not in input order, or its first input
+    /// has no witness.
+    InvalidGroup,
+    /// The first witness of the group is larger than the lock scripts load.
+    WitnessSize,
+    /// The first witness of the group is not a `WitnessArgs` with a lock.
+    Encoding,
+    /// The lock field is not as long as the lock script requires.
+    LockSize,
+    /// The flags of the multisig script in the lock field are invalid.
+    MultisigScript,
+}
+
+impl fmt::Display for SigningError {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        let reason = match self {
+            SigningError::InvalidGroup => "invalid lock group",
+            SigningError::WitnessSize => "first witness too large",
+            SigningError::Encoding => "first witness is not a WitnessArgs with a lock",
+            SigningError::LockSize => "wrong lock field size",
+            SigningError::MultisigScript => "invalid multisig script",
+        };
+        f.write_str(reason)
+    }
+}
+
+impl Error for SigningError {}
+
+/// Builds the signing messages of the lock groups of one transaction.
+pub struct SigningMessages<'a> {
+    tx_hash: &'a [u8; 32],
+    witnesses: &'a [&'a [u8]],
+    trailing_witnesses: &'a [&'a [u8]],
+}
+
+impl<'a> SigningMessages<'a> {
+    /// Takes the hash of the transaction, its number of inputs and its witnesses,
+    /// which are only borrowed.
+    pub fn new(
+        tx_hash: &'a [u8; 32],
+        inputs_len: usize,
+        witnesses: &'a [&'a [u8]],
+    ) -> SigningMessages<'a> {
+        let trailing_start = inputs_len.min(witnesses.len());
+        SigningMessages {
+            tx_hash,
+            witnesses,
+            trailing_witnesses: &witnesses[trailing_start..],
+        }
+    }
+
+    /// The message signed for `secp256k1_blake160_sighash_all`, and for
+    /// `secp256k1_blake160_multi_args_sighash_all` by the first input of a group of
+    /// inputs sharing a key. `group` is the indices of the group inputs in input
+    /// order, the lock of the first witness must be `SIGNATURE_SIZE` bytes long,
+    /// whatever they hold now.
+    pub fn sighash_all(&self, group: &[usize]) -> Result<[u8; 32], SigningError> {
+        self.zeroed_lock(group, SIGNATURE_SIZE)
+    }
+
+    /// Same as `sighash_all`, for the locks hashed as `lock_len` zeros, such as the
+    /// public key and signature lock of `secp256k1_blake160_pubkey_sighash_all`.
+    pub fn zeroed_lock(&self, group: &[usize], lock_len: usize) -> Result<[u8; 32], SigningError> {
+        let first_witness = self.first_witness(group)?;
+        let (lock_offset, lock) = witness_lock(first_witness)?;
+        if lock.len() != lock_len {
+            return Err(SigningError::LockSize);
+        }
+        Ok(self.message(group, first_witness, lock_offset, lock_len))
+    }
+
+    /// The message signed for `secp256k1_blake160_multisig_all`. The lock of the first
+    /// witness must hold the multisig script, followed by room for the threshold
+    /// number of signatures, which are hashed as zeros.
+    pub fn multisig_all(&self, group: &[usize]) -> Result<[u8; 32], SigningError> {
+        let first_witness = self.first_witness(group)?;
+        let (lock_offset, lock) = witness_lock(first_witness)?;
+        if lock.len() < MULTISIG_FLAGS_SIZE {
+            return Err(SigningError::LockSize);
+        }
+        let (mode, require_first_n, threshold, pubkeys_cnt) = (lock[0], lock[1], lock[2], lock[3]);
+        if mode > MULTISIG_MODE_SORTED
+            || pubkeys_cnt == 0
+            || threshold == 0
+            || threshold > pubkeys_cnt
+            || require_first_n > threshold
+        {
+            return Err(SigningError::MultisigScript);
+        }
+        let multisig_script_len = MULTISIG_FLAGS_SIZE + BLAKE160_SIZE * pubkeys_cnt as usize;
+        let signatures_len = SIGNATURE_SIZE * threshold as usize;
+        if lock.len() != multisig_script_len + signatures_len {
+            return Err(SigningError::LockSize);
+        }
+        Ok(self.message(
+            group,
+            first_witness,
+            lock_offset + multisig_script_len,
+            signatures_len,
+        ))
+    }
+
+    fn first_witness(&self, group: &[usize]) -> Result<&'a [u8], SigningError> {
+        if group.is_empty() || group.windows(2).any(|pair| pair[0] >= pair[1]) {
+            return Err(SigningError::InvalidGroup);
+        }
+        let first_witness = self
+            .witnesses
+            .get(group[0])
+            .cloned()
+            .ok_or(SigningError::InvalidGroup)?;
+        if first_witness.len() > MAX_WITNESS_SIZE {
+            return Err(SigningError::WitnessSize);
+        }
+        Ok(first_witness)
+    }
+
+    fn message(
+        &self,
+        group: &[usize],
+        first_witness: &[u8],
+        zero_offset: usize,
+        zero_len: usize,
+    ) -> [u8; 32] {
+        let mut blake2b = Blake2bBuilder::new(MESSAGE_SIZE)
+            .personal(CKB_HASH_PERSONALIZATION)
+            .build();
+        blake2b.update(self.tx_hash);
+
+        update_len(&mut blake2b, first_witness);
+        blake2b.update(&first_witness[..zero_offset]);
+        let mut remaining = zero_len;
+        while remaining > 0 {
+            let n = remaining.min(ZEROS.len());
+            blake2b.update(&ZEROS[..n]);
+            remaining -= n;
+        }
+        blake2b.update(&first_witness[zero_offset + zero_len..]);
+
+        // Like the scripts, stop at the first group input without a witness.
+        let group_witnesses = group[1..]
+            .iter()
+            .take_while(|&&i| i < self.witnesses.len())
+            .map(|&i| self.witnesses[i]);
+        for witness in group_witnesses {
+            update_len(&mut blake2b, witness);
+            blake2b.update(witness);
+        }
+        for witness in self.trailing_witnesses {
+            update_len(&mut blake2b, witness);
+            blake2b.update(witness);
+        }
+
+        let mut message = [0u8; MESSAGE_SIZE];
+        blake2b.finalize(&mut message);
+        message
+    }
+}
+
+fn update_len(blake2b: &mut Blake2b, witness: &[u8]) {
+    blake2b.update(&(witness.len() as u64).to_le_bytes());
+}
+
+fn read_num(data: &[u8], offset: usize) -> usize {
+    let mut buf = [0u8; MOL_NUM_SIZE];
+    buf.copy_from_slice(&data[offset..offset + MOL_NUM_SIZE]);
+    u32::from_le_bytes(buf) as usize
+}
+
+// Offset and content of the lock field of a `WitnessArgs`, checked the way
+// `extract_witness_lock` in `c/common.h` does: only the table header and the lock
+// field are verified.
+fn witness_lock(witness: &[u8]) -> Result<(usize, &[u8]), SigningError> {
+    if witness.len() < MOL_NUM_SIZE * 2 || read_num(witness, 0) != witness.len() {
+        return Err(SigningError::Encoding);
+    }
+    let first_offset = read_num(witness, MOL_NUM_SIZE);
+    // The header is the total size then one offset per field, and WitnessArgs has
+    // no extra fields.
+    if first_offset != MOL_NUM_SIZE * (WITNESS_ARGS_FIELD_COUNT + 1) || first_offset > witness.len()
+    {
+        return Err(SigningError::Encoding);
+    }
+    let start = first_offset;
+    let end = read_num(witness, MOL_NUM_SIZE * 2);
+    if start > end || end > witness.len() {
+        return Err(SigningError::Encoding);
+    }
+    // A lock of None is empty, Some is a Bytes: its length then its content.
+    let lock = &witness[start..end];
+    if lock.len() < MOL_NUM_SIZE || read_num(lock, 0) != lock.len() - MOL_NUM_SIZE {
+        return Err(SigningError::Encoding);
+    }
+    Ok((start + MOL_NUM_SIZE, &lock[MOL_NUM_SIZE..]))
+}
@@ -0,0 +1,90 @@
+use super::{
+    cycles::{dao_withdraw_tx, multisig_all_tx, sighash_all_tx, sighash_all_tx_with},
+    sign_tx_by_input_group, DummyDataLoader, MAX_CYCLES, SECP256K1_DATA_BIN, SIGHASH_ALL_BIN,
+};
+use crate::{shared_cell_data, verify_batch};
+use ckb_crypto::secp::Generator;
+use ckb_script::TransactionScriptsVerifier;
+use ckb_types::{bytes::Bytes, core::cell::ResolvedTransaction};
+use std::{sync::Arc, time::Instant};
+
+const BENCH_TRANSACTIONS: usize = 256;
+const BENCH_THREADS: &[usize] = &[1, 2, 4, 8];
+
+type Item = (DummyDataLoader, ResolvedTransaction);
+
+fn shared_bin(path: &str) -> Bytes {
+    Bytes::from_static(shared_cell_data(path).expect("bundled binary"))
+}
+
+fn verify(item: &Item) -> Result<u64, String> {
+    let (data_loader, resolved_tx) = item;
+    TransactionScriptsVerifier::new(resolved_tx, data_loader)
+        .verify(MAX_CYCLES)
+        .map_err(|err| err.to_string())
+}
+
+#[test]
+fn test_shared_cell_data() {
+    let data = shared_cell_data("specs/cells/secp256k1_data").expect("bundled binary");
+    assert_eq!(data, &SECP256K1_DATA_BIN[..]);
+    let again = shared_cell_data("specs/cells/secp256k1_data").expect("bundled binary");
+    assert_eq!(data.as_ptr(), again.as_ptr());
+    assert_eq!(
+        shared_cell_data("specs/cells/secp256k1_blake160_sighash_all").expect("bundled binary"),
+        &SIGHASH_ALL_BIN[..]
+    );
+    assert!(shared_cell_data("specs/cells/missing").is_none());
+}
+
+#[test]
+fn test_verify_batch() {
+    let sighash_all = shared_bin("specs/cells/secp256k1_blake160_sighash_all");
+    let multisig_all = shared_bin("specs/cells/secp256k1_blake160_multisig_all");
+    let secp256k1_data = shared_bin("specs/cells/secp256k1_data");
+    let other_key = Generator::random_privkey();
+
+    let mut items: Vec<Item> = (1..=4)
+        .map(|inputs| sighash_all_tx(inputs, 32, &sighash_all, &secp256k1_data))
+        .collect();
+    items.push(multisig_all_tx(2, 3, 2, &multisig_all, &secp256k1_data));
+    items.push(dao_withdraw_tx(2, 1));
+    items.push(sighash_all_tx_with(
+        1,
+        32,
+        &sighash_all,
+        &secp256k1_data,
+        |tx, _| sign_tx_by_input_group(tx, &other_key, 0, 1),
+    ));
+
+    let expected: Vec<_> = items.iter().map(verify).collect();
+    assert!(expected[..expected.len() - 1].iter().all(Result::is_ok));
+    assert!(expected[expected.len() - 1].is_err());
+
+    assert_eq!(verify_batch(items, 3, verify), expected);
+}
+
+#[test]
+#[ignore]
+fn bench_batch_verify() {
+    let sighash_all = shared_bin("specs/cells/secp256k1_blake160_sighash_all");
+    let secp256k1_data = shared_bin("specs/cells/secp256k1_data");
+    let items: Vec<Arc<Item>> = (0..BENCH_TRANSACTIONS)
+        .map(|i| Arc::new(sighash_all_tx(1 + i % 4, 32, &sighash_all, &secp256k1_data)))
+        .collect();
+
+    for &threads in BENCH_THREADS {
+        let start = Instant::now();
+        let results = verify_batch(items.clone(), threads, |item: &Arc<Item>| verify(item));
+        let elapsed = start.elapsed();
+        assert!(results.iter().all(Result::is_ok));
+        let seconds = elapsed.as_secs() as f64 + f64::from(elapsed.subsec_nanos()) / 1e9;
+        println!(
+            "{} threads: {} transactions in {:?}, {:.1} transactions/s",
+            threads,
+            BENCH_TRANSACTIONS,
+            elapsed,
+            BENCH_TRANSACTIONS as f64 / seconds
+        );
+    }
+}
@@ -0,0 +1,847 @@
+//! Cycle benchmarks for the bundled scripts.
+//!
+//! The benchmarks are ignored in a normal `cargo test` run, use `make bench-cycles`
+//! to run them. Every case is verified with `TransactionScriptsVerifier`, the consumed
+//! cycles are written as a CSV table to `target/cycles.csv`, then compared with the
+//! checked-in baseline at `src/tests/cycles_baseline.csv`. A case fails when it gets
+//! more than `CKB_CYCLES_TOLERANCE` percent (5 by default) slower than its baseline,
+//! and when it has no baseline at all. Run `make bench-cycles-update` to record a new
+//! baseline after an intended change or a new case.
+//!
+//! `make bench-window-sizes` runs the same single-sig and 3-of-5 multisig cases against
+//! each secp256k1_data window size variant built by `make window-variants`, and writes
+//! the result to `target/window_sizes.csv`.
+//!
+//! `make bench-pubkey-sighash-all` compares the single-sig cases with the variant
+//! taking the public key from the witness, built by `make pubkey-sighash-all`, and
+//! writes the result to `target/pubkey_sighash_all.csv`.
+//!
+//! `make bench-multi-args-sighash-all` compares consolidating one input from each of
+//! several keys with the single signing script, and from as many addresses of one key
+//! with the multi-args variant built by `make multi-args-sighash-all`, and writes the
+//! result to `target/multi_args_sighash_all.csv`.
+//!
+//! The DAO cases withdraw all inputs against one shared deposit header, and compare
+//! with the same withdrawal against a distinct deposit header per input.
+//!
+//! Note the verifier reports the cycles of the whole transaction, so the DAO cases
+//! also include the single sighash lock group guarding the DAO inputs.
+
+use super::{
+    blake160,
+    dao::{cell_output_with_only_capacity, complete_tx, gen_dao_cell, gen_header, gen_lock},
+    secp256k1_blake160_multisig_all::{
+        build_resolved_tx as build_multisig_resolved_tx, gen_multi_sign_script,
+        gen_tx_with_binaries as gen_multisig_tx_with_binaries, generate_keys, multi_sign_tx,
+    },
+    secp256k1_blake160_sighash_all::{build_resolved_tx, gen_tx_with_binaries},
+    sign_tx, sign_tx_by_input_group, sign_tx_by_input_group_with, DummyDataLoader, MAX_CYCLES,
+    MULTISIG_ALL_BIN, SECP256K1_DATA_BIN, SIGHASH_ALL_BIN, SIGNATURE_SIZE,
+};
+use byteorder::{ByteOrder, LittleEndian};
+use ckb_crypto::secp::{Generator, Privkey};
+use ckb_error::assert_error_eq;
+use ckb_script::{ScriptError, TransactionScriptsVerifier};
+use ckb_types::{
+    bytes::Bytes,
+    core::{
+        cell::{CellMetaBuilder, ResolvedTransaction},
+        Capacity, EpochNumberWithFraction, TransactionBuilder, TransactionInfo, TransactionView,
+    },
+    packed::{CellInput, WitnessArgs},
+    prelude::*,
+    H256,
+};
+use rand::{rngs::SmallRng, SeedableRng};
+use std::{collections::HashMap, env, fs};
+
+const OUTPUT_PATH: &str = "target/cycles.csv";
+const WINDOW_SIZES_OUTPUT_PATH: &str = "target/window_sizes.csv";
+const PUBKEY_SIGHASH_ALL_OUTPUT_PATH: &str = "target/pubkey_sighash_all.csv";
+const PUBKEY_SIGHASH_ALL_PATH: &str = "build/secp256k1_blake160_pubkey_sighash_all";
+const MULTI_ARGS_SIGHASH_ALL_OUTPUT_PATH: &str = "target/multi_args_sighash_all.csv";
+const MULTI_ARGS_SIGHASH_ALL_PATH: &str = "build/secp256k1_blake160_multi_args_sighash_all";
+const BASELINE_PATH: &str = "src/tests/cycles_baseline.csv";
+const CSV_HEADER: &str = "script,case,param,cycles";
+const DEFAULT_TOLERANCE_PERCENT: u64 = 5;
+
+const ERROR_SECP_VERIFICATION: i8 = -12;
+const ERROR_PUBKEY_BLAKE160_HASH: i8 = -31;
+
+// Same limit as MAX_WITNESS_SIZE in the C scripts.
+pub const MAX_WITNESS_SIZE: usize = 32768;
+
+const SIGHASH_ALL_INPUTS: &[usize] = &[1, 2, 4, 8, 16, 32, 64];
+const MULTISIG_ALL_INPUTS: &[usize] = &[1, 2, 4, 8, 16];
+const MULTISIG_ALL_THRESHOLDS: &[(usize, usize)] = &[
+    (1, 1),
+    (1, 3),
+    (2, 3),
+    (3, 5),
+    (5, 7),
+    (7, 10),
+    (10, 15),
+    (15, 20),
+];
+const DAO_WITHDRAW_INPUTS: &[usize] = &[1, 2, 4, 8, 16, 32, 64];
+const MULTI_ARGS_GROUPS: &[usize] = &[1, 2, 4, 8, 16, 32];
+// Window size of the bundled secp256k1_data.
+const DEFAULT_WINDOW_SIZES: &str = "15";
+
+pub struct Record {
+    pub script: &'static str,
+    pub case: &'static str,
+    pub param: String,
+    pub cycles: u64,
+}
+
+impl Record {
+    pub fn new(script: &'static str, case: &'static str, param: String, cycles: u64) -> Self {
+        Record {
+            script,
+            case,
+            param,
+            cycles,
+        }
+    }
+
+    fn key(&self) -> String {
+        format!("{},{},{}", self.script, self.case, self.param)
+    }
+}
+
+// Size of the `extra` field which makes a signed sighash witness exactly
+// MAX_WITNESS_SIZE bytes long.
+pub fn max_extra_size() -> usize {
+    let witness = WitnessArgs::new_builder()
+        .lock(Bytes::from(vec![0u8; SIGNATURE_SIZE]).pack())
+        .extra(Bytes::new().pack())
+        .build();
+    MAX_WITNESS_SIZE - witness.as_bytes().len()
+}
+
+pub fn sighash_all_cycles(inputs: usize, extra_size: usize) -> u64 {
+    sighash_all_cycles_with_binaries(inputs, extra_size, &SIGHASH_ALL_BIN, &SECP256K1_DATA_BIN)
+}
+
+pub fn sighash_all_cycles_with_binaries(
+    inputs: usize,
+    extra_size: usize,
+    lock_bin: &Bytes,
+    secp256k1_data_bin: &Bytes,
+) -> u64 {
+    let (data_loader, resolved_tx) =
+        sighash_all_tx(inputs, extra_size, lock_bin, secp256k1_data_bin);
+    TransactionScriptsVerifier::new(&resolved_tx, &data_loader)
+        .verify(MAX_CYCLES)
+        .expect("pass verification")
+}
+
+// The signed transaction measured by `sighash_all_cycles_with_binaries`.
+pub fn sighash_all_tx(
+    inputs: usize,
+    extra_size: usize,
+    lock_bin: &Bytes,
+    secp256k1_data_bin: &Bytes,
+) -> (DummyDataLoader, ResolvedTransaction) {
+    sighash_all_tx_with(
+        inputs,
+        extra_size,
+        lock_bin,
+        secp256k1_data_bin,
+        |tx, privkey| sign_tx_by_input_group(tx, privkey, 0, inputs),
+    )
+}
+
+// Same transaction as `sighash_all_tx`, signed by `sign` with the private key its
+// lock args are derived from.
+pub fn sighash_all_tx_with<F>(
+    inputs: usize,
+    extra_size: usize,
+    lock_bin: &Bytes,
+    secp256k1_data_bin: &Bytes,
+    sign: F,
+) -> (DummyDataLoader, ResolvedTransaction)
+where
+    F: Fn(TransactionView, &Privkey) -> TransactionView,
+{
+    let mut data_loader = DummyDataLoader::new();
+    let mut generator = Generator::non_crypto_safe_prng(42);
+    let mut rng = SmallRng::seed_from_u64(42);
+    let privkey = generator.gen_privkey();
+    let pubkey = privkey.pubkey().expect("pubkey");
+    let pubkey_hash = blake160(&pubkey.serialize());
+
+    let tx = gen_tx_with_binaries(
+        &mut data_loader,
+        vec![(pubkey_hash, inputs)],
+        lock_bin,
+        secp256k1_data_bin,
+        &mut rng,
+    );
+    let witnesses = (0..inputs)
+        .map(|_| {
+            WitnessArgs::new_builder()
+                .extra(Bytes::from(vec![0x42u8; extra_size]).pack())
+                .build()
+                .as_bytes()
+                .pack()
+        })
+        .collect();
+    let tx = tx.as_advanced_builder().set_witnesses(witnesses).build();
+    let tx = sign(tx, &privkey);
+
+    let resolved_tx = build_resolved_tx(&data_loader, &tx);
+    (data_loader, resolved_tx)
+}
+
+pub fn multisig_all_cycles(threshold: usize, pubkeys_cnt: usize, inputs: usize) -> u64 {
+    multisig_all_cycles_with_binaries(
+        threshold,
+        pubkeys_cnt,
+        inputs,
+        &MULTISIG_ALL_BIN,
+        &SECP256K1_DATA_BIN,
+    )
+}
+
+pub fn multisig_all_cycles_with_binaries(
+    threshold: usize,
+    pubkeys_cnt: usize,
+    inputs: usize,
+    lock_bin: &Bytes,
+    secp256k1_data_bin: &Bytes,
+) -> u64 {
+    let (data_loader, resolved_tx) =
+        multisig_all_tx(threshold, pubkeys_cnt, inputs, lock_bin, secp256k1_data_bin);
+    TransactionScriptsVerifier::new(&resolved_tx, &data_loader)
+        .verify(MAX_CYCLES)
+        .expect("pass verification")
+}
+
+// The signed transaction measured by `multisig_all_cycles_with_binaries`.
+pub fn multisig_all_tx(
+    threshold: usize,
+    pubkeys_cnt: usize,
+    inputs: usize,
+    lock_bin: &Bytes,
+    secp256k1_data_bin: &Bytes,
+) -> (DummyDataLoader, ResolvedTransaction) {
+    let mut data_loader = DummyDataLoader::new();
+    let keys = generate_keys(pubkeys_cnt);
+    let multi_sign_script = gen_multi_sign_script(&keys, threshold as u8, 0);
+    let args = blake160(&multi_sign_script);
+    let tx = gen_multisig_tx_with_binaries(
+        &mut data_loader,
+        args,
+        (inputs - 1) as u32,
+        lock_bin,
+        secp256k1_data_bin,
+    );
+    let signers: Vec<&Privkey> = keys.iter().take(threshold).collect();
+    let tx = multi_sign_tx(tx, &multi_sign_script, &signers);
+    let resolved_tx = build_multisig_resolved_tx(&data_loader, &tx);
+    (data_loader, resolved_tx)
+}
+
+// Withdraws `inputs` deposited cells in one transaction, all of them share the
+// same deposit header and withdraw header.
+pub fn dao_withdraw_cycles(inputs: usize) -> u64 {
+    dao_withdraw_cycles_with_deposit_headers(inputs, 1)
+}
+
+// Same as `dao_withdraw_cycles`, but the inputs are spread over `deposit_headers`
+// distinct deposit headers. The headers only differ in timestamp, so they lead to
+// the same withdraw capacity.
+pub fn dao_withdraw_cycles_with_deposit_headers(inputs: usize, deposit_headers: usize) -> u64 {
+    let (data_loader, rtx) = dao_withdraw_tx(inputs, deposit_headers);
+    TransactionScriptsVerifier::new(&rtx, &data_loader)
+        .verify(MAX_CYCLES)
+        .expect("pass verification")
+}
+
+// The signed transaction measured by `dao_withdraw_cycles_with_deposit_headers`.
+pub fn dao_withdraw_tx(
+    inputs: usize,
+    deposit_headers: usize,
+) -> (DummyDataLoader, ResolvedTransaction) {
+    dao_withdraw_tx_with(inputs, deposit_headers, 0x2003e8022a0002f3, 123468105678)
+}
+
+// Same as `dao_withdraw_tx`, with the since value of every input and the capacity
+// of every output given, so invalid withdrawals can be built as well.
+pub fn dao_withdraw_tx_with(
+    inputs: usize,
+    deposit_headers: usize,
+    since: u64,
+    output_capacity: u64,
+) -> (DummyDataLoader, ResolvedTransaction) {
+    let mut data_loader = DummyDataLoader::new();
+    let (privkey, lock_args) = gen_lock();
+
+    let (deposit_header, deposit_epoch) = gen_header(1554, 10000000, 35, 1000, 1000);
+    let (withdraw_header, withdraw_epoch) = gen_header(2000610, 10001000, 575, 2000000, 1100);
+    data_loader
+        .headers
+        .insert(withdraw_header.hash(), withdraw_header.clone());
+    data_loader
+        .epoches
+        .insert(withdraw_header.hash(), withdraw_epoch);
+
+    let mut builder = TransactionBuilder::default().header_dep(withdraw_header.hash());
+    for i in 0..deposit_headers {
+        let header = deposit_header
+            .as_advanced_builder()
+            .timestamp((i as u64).pack())
+            .build();
+        data_loader.headers.insert(header.hash(), header.clone());
+        data_loader
+            .epoches
+            .insert(header.hash(), deposit_epoch.clone());
+        builder = builder.header_dep(header.hash());
+    }
+
+    let mut b = [0; 8];
+    LittleEndian::write_u64(&mut b, 1554);
+    let deposited_block_number = Bytes::from(&b[..]);
+
+    let mut resolved_inputs = vec![];
+    for i in 0..inputs {
+        // Deposit headers follow the withdraw header in header deps.
+        let mut b = [0; 8];
+        LittleEndian::write_u64(&mut b, (1 + i % deposit_headers) as u64);
+        let witness = WitnessArgs::new_builder()
+            .type_(Bytes::from(&b[..]).pack())
+            .build();
+        let (cell, previous_out_point) = gen_dao_cell(
+            &mut data_loader,
+            Capacity::shannons(123456780000),
+            lock_args.clone(),
+        );
+        resolved_inputs.push(
+            CellMetaBuilder::from_cell_output(cell, deposited_block_number.clone())
+                .out_point(previous_out_point.clone())
+                .transaction_info(TransactionInfo {
+                    block_hash: withdraw_header.hash(),
+                    block_number: withdraw_header.number(),
+                    block_epoch: EpochNumberWithFraction::new(575, 610, 1100),
+                    index: 0,
+                })
+                .build(),
+        );
+        builder = builder
+            .input(CellInput::new(previous_out_point, since))
+            .output(cell_output_with_only_capacity(output_capacity))
+            .output_data(Bytes::new().pack())
+            .witness(witness.as_bytes().pack());
+    }
+    let (tx, resolved_cell_deps) = complete_tx(&mut data_loader, builder);
+    let tx = sign_tx(tx, &privkey);
+    let rtx = ResolvedTransaction {
+        transaction: tx,
+        resolved_inputs,
+        resolved_cell_deps,
+        resolved_dep_groups: vec![],
+    };
+    (data_loader, rtx)
+}
+
+pub fn collect_records() -> Vec<Record> {
+    let mut records = Vec::new();
+
+    for &inputs in SIGHASH_ALL_INPUTS {
+        records.push(Record::new(
+            "secp256k1_blake160_sighash_all",
+            "inputs",
+            inputs.to_string(),
+            sighash_all_cycles(inputs, 32),
+        ));
+    }
+    let max_extra = max_extra_size();
+    for &size in &[0, 1024, 4096, 16384, max_extra] {
+        let witness_size = MAX_WITNESS_SIZE - max_extra + size;
+        records.push(Record::new(
+            "secp256k1_blake160_sighash_all",
+            "witness_size",
+            witness_size.to_string(),
+            sighash_all_cycles(1, size),
+        ));
+    }
+
+    for &inputs in MULTISIG_ALL_INPUTS {
+        records.push(Record::new(
+            "secp256k1_blake160_multisig_all",
+            "inputs",
+            inputs.to_string(),
+            multisig_all_cycles(2, 3, inputs),
+        ));
+    }
+    for &(threshold, pubkeys_cnt) in MULTISIG_ALL_THRESHOLDS {
+        records.push(Record::new(
+            "secp256k1_blake160_multisig_all",
+            "m_of_n",
+            format!("{}-of-{}", threshold, pubkeys_cnt),
+            multisig_all_cycles(threshold, pubkeys_cnt, 1),
+        ));
+    }
+
+    for &inputs in DAO_WITHDRAW_INPUTS {
+        records.push(Record::new(
+            "dao",
+            "withdraw_inputs",
+            inputs.to_string(),
+            dao_withdraw_cycles(inputs),
+        ));
+        // The cost of header loading without any header shared between inputs, the
+        // difference to the case above is what the header cache saves.
+        records.push(Record::new(
+            "dao",
+            "withdraw_inputs_distinct_deposit_headers",
+            inputs.to_string(),
+            dao_withdraw_cycles_with_deposit_headers(inputs, inputs),
+        ));
+    }
+
+    records
+}
+
+pub fn to_csv(records: &[Record]) -> String {
+    let mut csv = String::from(CSV_HEADER);
+    csv.push('\n');
+    for record in records {
+        csv.push_str(&format!("{},{}\n", record.key(), record.cycles));
+    }
+    csv
+}
+
+fn load_baseline() -> HashMap<String, u64> {
+    let content = fs::read_to_string(BASELINE_PATH).unwrap_or_default();
+    content
+        .lines()
+        .filter(|line| !line.is_empty() && *line != CSV_HEADER)
+        .map(|line| {
+            let pos = line.rfind(',').expect("baseline line format");
+            let cycles = line[pos + 1..].parse().expect("baseline cycles");
+            (line[..pos].to_string(), cycles)
+        })
+        .collect()
+}
+
+fn tolerance_percent() -> u64 {
+    env::var("CKB_CYCLES_TOLERANCE")
+        .ok()
+        .map(|value| {
+            value
+                .parse()
+                .expect("CKB_CYCLES_TOLERANCE must be an integer")
+        })
+        .unwrap_or(DEFAULT_TOLERANCE_PERCENT)
+}
+
+#[test]
+#[ignore]
+fn bench_cycles() {
+    let records = collect_records();
+    let csv = to_csv(&records);
+    fs::create_dir_all("target").expect("create target dir");
+    fs::write(OUTPUT_PATH, &csv).expect("write cycles table");
+
+    if env::var("CKB_CYCLES_UPDATE").is_ok() {
+        fs::write(BASELINE_PATH, &csv).expect("write cycles baseline");
+        return;
+    }
+
+    let baseline = load_baseline();
+    let tolerance = tolerance_percent();
+    let mut regressions = Vec::new();
+    let mut missing = Vec::new();
+    for record in &records {
+        match baseline.get(&record.key()) {
+            Some(&expected) => {
+                let limit = expected + expected * tolerance / 100;
+                println!(
+                    "{}: {} (baseline {})",
+                    record.key(),
+                    record.cycles,
+                    expected
+                );
+                if record.cycles > limit {
+                    regressions.push(format!(
+                        "{}: {} cycles, baseline {} cycles",
+                        record.key(),
+                        record.cycles,
+                        expected
+                    ));
+                }
+            }
+            None => {
+                println!("{}: {} (no baseline)", record.key(), record.cycles);
+                missing.push(record.key());
+            }
+        }
+    }
+    if !missing.is_empty() {
+        panic!(
+            "no baseline for {} cases, run `make bench-cycles-update`:\n{}",
+            missing.len(),
+            missing.join("\n")
+        );
+    }
+    if !regressions.is_empty() {
+        panic!(
+            "cycles regressed more than {}%:\n{}",
+            tolerance,
+            regressions.join("\n")
+        );
+    }
+}
+
+// Window sizes to benchmark, `make bench-window-sizes` passes the ones built by
+// `make window-variants`.
+fn window_sizes() -> Vec<String> {
+    env::var("CKB_WINDOW_SIZES")
+        .unwrap_or_else(|_| DEFAULT_WINDOW_SIZES.to_string())
+        .split_whitespace()
+        .map(|size| size.to_string())
+        .collect()
+}
+
+fn load_window_variant(size: &str, name: &str) -> Option<Bytes> {
+    fs::read(format!("build/window-{}/{}", size, name))
+        .ok()
+        .map(Bytes::from)
+}
+
+#[test]
+#[ignore]
+fn bench_window_sizes() {
+    let mut records = Vec::new();
+    let mut best: Option<(String, u64)> = None;
+    for size in window_sizes() {
+        let (data, sighash_all, multisig_all) = match (
+            load_window_variant(&size, "secp256k1_data"),
+            load_window_variant(&size, "secp256k1_blake160_sighash_all"),
+            load_window_variant(&size, "secp256k1_blake160_multisig_all"),
+        ) {
+            (Some(data), Some(sighash_all), Some(multisig_all)) => {
+                (data, sighash_all, multisig_all)
+            }
+            _ => {
+                println!("window {}: not built, run `make window-variants`", size);
+                continue;
+            }
+        };
+        let single = sighash_all_cycles_with_binaries(1, 32, &sighash_all, &data);
+        let multisig = multisig_all_cycles_with_binaries(3, 5, 1, &multisig_all, &data);
+        println!(
+            "window {}: table {} bytes, single-sig {} cycles, 3-of-5 multisig {} cycles",
+            size,
+            data.len(),
+            single,
+            multisig
+        );
+        if best
+            .as_ref()
+            .map(|(_, cycles)| single + multisig < *cycles)
+            .unwrap_or(true)
+        {
+            best = Some((size.clone(), single + multisig));
+        }
+        records.push(Record::new(
+            "secp256k1_blake160_sighash_all",
+            "window_size",
+            size.clone(),
+            single,
+        ));
+        records.push(Record::new(
+            "secp256k1_blake160_multisig_all",
+            "window_size_3_of_5",
+            size,
+            multisig,
+        ));
+    }
+
+    fs::create_dir_all("target").expect("create target dir");
+    fs::write(WINDOW_SIZES_OUTPUT_PATH, to_csv(&records)).expect("write window sizes table");
+    if let Some((size, cycles)) = best {
+        println!("best window size: {} ({} cycles in total)", size, cycles);
+    }
+}
+
+// Signs the lock group of `inputs` inputs for the pubkey sighash variant, with the
+// public key of `pubkey_key` and a signature of `sig_key`.
+fn sign_pubkey_sighash_all(
+    tx: TransactionView,
+    pubkey_key: &Privkey,
+    sig_key: &Privkey,
+    inputs: usize,
+) -> TransactionView {
+    let pubkey = pubkey_key.pubkey().expect("pubkey").serialize();
+    sign_tx_by_input_group_with(tx, 0, inputs, pubkey.len() + 64, |message| {
+        let sig = sig_key.sign_recoverable(message).expect("sign").serialize();
+        let mut lock = pubkey.clone();
+        lock.extend_from_slice(&sig[..64]);
+        lock.into()
+    })
+}
+
+#[test]
+#[ignore]
+fn bench_pubkey_sighash_all() {
+    let pubkey_sighash_all = match fs::read(PUBKEY_SIGHASH_ALL_PATH) {
+        Ok(data) => Bytes::from(data),
+        Err(_) => {
+            println!(
+                "{} not built, run `make pubkey-sighash-all`",
+                PUBKEY_SIGHASH_ALL_PATH
+            );
+            return;
+        }
+    };
+    let verify = |(data_loader, resolved_tx): (DummyDataLoader, ResolvedTransaction)| {
+        TransactionScriptsVerifier::new(&resolved_tx, &data_loader).verify(MAX_CYCLES)
+    };
+
+    let mut records = Vec::new();
+    for &inputs in SIGHASH_ALL_INPUTS {
+        let recover = sighash_all_cycles(inputs, 32);
+        let pubkey = verify(sighash_all_tx_with(
+            inputs,
+            32,
+            &pubkey_sighash_all,
+            &SECP256K1_DATA_BIN,
+            |tx, privkey| sign_pubkey_sighash_all(tx, privkey, privkey, inputs),
+        ))
+        .expect("pass verification");
+        println!(
+            "{} inputs: recovery {} cycles, pubkey in witness {} cycles",
+            inputs, recover, pubkey
+        );
+        records.push(Record::new(
+            "secp256k1_blake160_sighash_all",
+            "inputs",
+            inputs.to_string(),
+            recover,
+        ));
+        records.push(Record::new(
+            "secp256k1_blake160_pubkey_sighash_all",
+            "inputs",
+            inputs.to_string(),
+            pubkey,
+        ));
+    }
+
+    // A public key not matching script args, and a signature from another key.
+    let other_key = Generator::random_privkey();
+    let result = verify(sighash_all_tx_with(
+        1,
+        32,
+        &pubkey_sighash_all,
+        &SECP256K1_DATA_BIN,
+        |tx, _| sign_pubkey_sighash_all(tx, &other_key, &other_key, 1),
+    ));
+    assert_error_eq!(
+        result.unwrap_err(),
+        ScriptError::ValidationFailure(ERROR_PUBKEY_BLAKE160_HASH)
+    );
+    let result = verify(sighash_all_tx_with(
+        1,
+        32,
+        &pubkey_sighash_all,
+        &SECP256K1_DATA_BIN,
+        |tx, privkey| sign_pubkey_sighash_all(tx, privkey, &other_key, 1),
+    ));
+    assert_error_eq!(
+        result.unwrap_err(),
+        ScriptError::ValidationFailure(ERROR_SECP_VERIFICATION)
+    );
+
+    fs::create_dir_all("target").expect("create target dir");
+    fs::write(PUBKEY_SIGHASH_ALL_OUTPUT_PATH, to_csv(&records))
+        .expect("write pubkey sighash table");
+}
+
+// A transaction with one input for each of `args`, each input being its own lock group,
+// signed by `sign`.
+fn grouped_inputs_tx<F>(
+    lock_bin: &Bytes,
+    args: Vec<Bytes>,
+    sign: F,
+) -> (DummyDataLoader, ResolvedTransaction)
+where
+    F: FnOnce(TransactionView) -> TransactionView,
+{
+    let mut data_loader = DummyDataLoader::new();
+    let mut rng = SmallRng::seed_from_u64(42);
+    let tx = gen_tx_with_binaries(
+        &mut data_loader,
+        args.into_iter().map(|args| (args, 1)).collect(),
+        lock_bin,
+        &SECP256K1_DATA_BIN,
+        &mut rng,
+    );
+    let tx = sign(tx);
+    let resolved_tx = build_resolved_tx(&data_loader, &tx);
+    (data_loader, resolved_tx)
+}
+
+// Signs for the multi-args variant, `indices` are the inputs locked with the public key
+// hash of `key`, the first one being the leading input.
+fn sign_multi_args_sighash_all(
+    tx: TransactionView,
+    key: &Privkey,
+    indices: &[usize],
+) -> TransactionView {
+    let mut blake2b = ckb_hash::new_blake2b();
+    blake2b.update(&tx.hash().raw_data());
+    let first = WitnessArgs::new_unchecked(tx.witnesses().get(indices[0]).unwrap().unpack());
+    let zeroed = first
+        .clone()
+        .as_builder()
+        .lock(Bytes::from(vec![0u8; SIGNATURE_SIZE]).pack())
+        .build();
+    blake2b.update(&(zeroed.as_bytes().len() as u64).to_le_bytes());
+    blake2b.update(&zeroed.as_bytes());
+    for &i in &indices[1..] {
+        let witness = tx.witnesses().get(i).unwrap().raw_data();
+        blake2b.update(&(witness.len() as u64).to_le_bytes());
+        blake2b.update(&witness);
+    }
+    for i in tx.inputs().len()..tx.witnesses().len() {
+        let witness = tx.witnesses().get(i).unwrap().raw_data();
+        blake2b.update(&(witness.len() as u64).to_le_bytes());
+        blake2b.update(&witness);
+    }
+    let mut message = [0u8; 32];
+    blake2b.finalize(&mut message);
+    let sig = key
+        .sign_recoverable(&H256::from(message))
+        .expect("sign")
+        .serialize();
+    let mut witnesses: Vec<_> = tx.witnesses().into_iter().collect();
+    witnesses[indices[0]] = first
+        .as_builder()
+        .lock(Bytes::from(sig).pack())
+        .build()
+        .as_bytes()
+        .pack();
+    tx.as_advanced_builder().set_witnesses(witnesses).build()
+}
+
+fn multi_args(pubkey_hash: &Bytes, suffix: usize) -> Bytes {
+    let mut args = pubkey_hash.to_vec();
+    args.extend_from_slice(&(suffix as u32).to_le_bytes());
+    args.into()
+}
+
+#[test]
+#[ignore]
+fn bench_multi_args_sighash_all() {
+    let multi_args_sighash_all = match fs::read(MULTI_ARGS_SIGHASH_ALL_PATH) {
+        Ok(data) => Bytes::from(data),
+        Err(_) => {
+            println!(
+                "{} not built, run `make multi-args-sighash-all`",
+                MULTI_ARGS_SIGHASH_ALL_PATH
+            );
+            return;
+        }
+    };
+    let verify = |(data_loader, resolved_tx): (DummyDataLoader, ResolvedTransaction)| {
+        TransactionScriptsVerifier::new(&resolved_tx, &data_loader).verify(MAX_CYCLES)
+    };
+    let mut generator = Generator::non_crypto_safe_prng(42);
+    let key = generator.gen_privkey();
+    let pubkey_hash = blake160(&key.pubkey().expect("pubkey").serialize());
+
+    let mut records = Vec::new();
+    for &groups in MULTI_ARGS_GROUPS {
+        // Today each address needs a key of its own, and each group its own signature.
+        let keys: Vec<Privkey> = (0..groups).map(|_| generator.gen_privkey()).collect();
+        let args = keys
+            .iter()
+            .map(|key| blake160(&key.pubkey().expect("pubkey").serialize()))
+            .collect();
+        let per_key = verify(grouped_inputs_tx(&SIGHASH_ALL_BIN, args, |tx| {
+            keys.iter()
+                .enumerate()
+                .fold(tx, |tx, (i, key)| sign_tx_by_input_group(tx, key, i, 1))
+        }))
+        .expect("pass verification");
+
+        let args = (0..groups).map(|i| multi_args(&pubkey_hash, i)).collect();
+        let indices: Vec<usize> = (0..groups).collect();
+        let shared = verify(grouped_inputs_tx(&multi_args_sighash_all, args, |tx| {
+            sign_multi_args_sighash_all(tx, &key, &indices)
+        }))
+        .expect("pass verification");
+        println!(
+            "{} groups: one key each {} cycles, one shared key {} cycles",
+            groups, per_key, shared
+        );
+        records.push(Record::new(
+            "secp256k1_blake160_sighash_all",
+            "groups",
+            groups.to_string(),
+            per_key,
+        ));
+        records.push(Record::new(
+            "secp256k1_blake160_multi_args_sighash_all",
+            "groups",
+            groups.to_string(),
+            shared,
+        ));
+    }
+
+    // Two keys interleaved, each leading its own inputs.
+    let other_key = generator.gen_privkey();
+    let other_pubkey_hash = blake160(&other_key.pubkey().expect("pubkey").serialize());
+    let mixed_args = || {
+        vec![
+            multi_args(&pubkey_hash, 0),
+            multi_args(&other_pubkey_hash, 0),
+            multi_args(&pubkey_hash, 1),
+        ]
+    };
+    verify(grouped_inputs_tx(
+        &multi_args_sighash_all,
+        mixed_args(),
+        |tx| {
+            let tx = sign_multi_args_sighash_all(tx, &key, &[0, 2]);
+            sign_multi_args_sighash_all(tx, &other_key, &[1])
+        },
+    ))
+    .expect("pass verification");
+
+    // The witness of a following group is not covered by the signature.
+    let result = verify(grouped_inputs_tx(
+        &multi_args_sighash_all,
+        mixed_args(),
+        |tx| {
+            let tx = sign_multi_args_sighash_all(tx, &key, &[0]);
+            sign_multi_args_sighash_all(tx, &other_key, &[1])
+        },
+    ));
+    assert_error_eq!(
+        result.unwrap_err(),
+        ScriptError::ValidationFailure(ERROR_PUBKEY_BLAKE160_HASH)
+    );
+
+    // A following group can't take the lead by signing with another key.
+    let result = verify(grouped_inputs_tx(
+        &multi_args_sighash_all,
+        mixed_args(),
+        |tx| {
+            let tx = sign_multi_args_sighash_all(tx, &other_key, &[0, 2]);
+            sign_multi_args_sighash_all(tx, &other_key, &[1])
+        },
+    ));
+    assert_error_eq!(
+        result.unwrap_err(),
+        ScriptError::ValidationFailure(ERROR_PUBKEY_BLAKE160_HASH)
+    );
+
+    fs::create_dir_all("target").expect("create target dir");
+    fs::write(MULTI_ARGS_SIGHASH_ALL_OUTPUT_PATH, to_csv(&records))
+        .expect("write multi-args sighash table");
+}
@@ -18,6 +18,8 @@ use ckb_types::{
 use rand::{thread_rng, Rng};
 
 const ERROR_SYSCALL: i8 = -4;
+const ERROR_ENCODING: i8 = -11;
+const ERROR_WITNESS_TOO_LONG: i8 = -12;
 const ERROR_INVALID_WITHDRAW_BLOCK: i8 = -14;
 const ERROR_INCORRECT_CAPACITY: i8 = -15;
 const ERROR_INCORRECT_SINCE: i8 = -17;
@@ -25,7 +27,7 @@ const ERROR_TOO_MANY_OUTPUT_CELLS: i8 = -18;
 const ERROR_NEWLY_CREATED_CELL: i8 = -19;
 const ERROR_INVALID_WITHDRAWING_CELL: i8 = -20;
 
-fn cell_output_with_only_capacity(shannons: u64) -> CellOutput {
+pub fn cell_output_with_only_capacity(shannons: u64) -> CellOutput {
     CellOutput::new_builder()
         .capacity(Capacity::shannons(shannons).pack())
         .build()
@@ -86,7 +88,7 @@ fn gen_normal_cell(
     (cell, out_point)
 }
 
-fn gen_dao_cell(
+pub fn gen_dao_cell(
     dummy: &mut DummyDataLoader,
     capacity: Capacity,
     lock_args: Bytes,
@@ -115,7 +117,7 @@ fn gen_dao_cell(
     (cell, out_point)
 }
 
-fn gen_header(
+pub fn gen_header(
     number: BlockNumber,
     ar: u64,
     epoch_number: EpochNumber,
@@ -140,7 +142,7 @@ fn gen_header(
     (header, epoch_ext)
 }
 
-fn gen_lock() -> (Privkey, Bytes) {
+pub fn gen_lock() -> (Privkey, Bytes) {
     let privkey = Generator::random_privkey();
     let pubkey = privkey.pubkey().expect("pubkey");
     // compute pubkey hash
@@ -152,7 +154,7 @@ fn gen_lock() -> (Privkey, Bytes) {
     (privkey, lock_args)
 }
 
-fn complete_tx(
+pub fn complete_tx(
     dummy: &mut DummyDataLoader,
     builder: TransactionBuilder,
 ) -> (TransactionView, Vec<CellMeta>) {
@@ -1380,6 +1382,60 @@ fn test_dao_create_withdrawing_cell() {
     verify_result.expect("pass verification");
 }
 
+#[test]
+fn test_dao_create_more_than_64_withdrawing_cells() {
+    let mut data_loader = DummyDataLoader::new();
+    let (privkey, lock_args) = gen_lock();
+
+    let (deposit_header, deposit_epoch) = gen_header(1554, 10000000, 35, 1000, 1000);
+    data_loader
+        .headers
+        .insert(deposit_header.hash(), deposit_header.clone());
+    data_loader
+        .epoches
+        .insert(deposit_header.hash(), deposit_epoch.clone());
+
+    let mut b = [0; 8];
+    LittleEndian::write_u64(&mut b, 1554);
+    let witness = WitnessArgs::new_builder().build();
+    let mut resolved_inputs = vec![];
+    let mut builder = TransactionBuilder::default().header_dep(deposit_header.hash());
+    for _ in 0..100 {
+        let (cell, previous_out_point) = gen_dao_cell(
+            &mut data_loader,
+            Capacity::shannons(123456780000),
+            lock_args.clone(),
+        );
+        resolved_inputs.push(
+            CellMetaBuilder::from_cell_output(cell.clone(), Bytes::from(&[0; 8][..]))
+                .out_point(previous_out_point.clone())
+                .transaction_info(TransactionInfo {
+                    block_hash: deposit_header.hash(),
+                    block_number: deposit_header.number(),
+                    block_epoch: EpochNumberWithFraction::new(35, 554, 1000),
+                    index: 0,
+                })
+                .build(),
+        );
+        builder = builder
+            .input(CellInput::new(previous_out_point, 0))
+            .output(cell)
+            .output_data(Bytes::from(&b[..]).pack())
+            .witness(witness.as_bytes().pack());
+    }
+    let (tx, resolved_cell_deps) = complete_tx(&mut data_loader, builder);
+    let tx = sign_tx(tx, &privkey);
+    let rtx = ResolvedTransaction {
+        transaction: tx,
+        resolved_inputs,
+        resolved_cell_deps,
+        resolved_dep_groups: vec![],
+    };
+
+    let verify_result = TransactionScriptsVerifier::new(&rtx, &data_loader).verify(MAX_CYCLES);
+    verify_result.expect("pass verification");
+}
+
 #[test]
 fn test_dao_create_withdrawing_cell_with_different_lock() {
     let mut data_loader = DummyDataLoader::new();
@@ -1680,8 +1736,8 @@ fn test_dao_too_many_output_cells() {
     let resolved_inputs = vec![input_cell_meta];
     let mut resolved_cell_deps = vec![];
 
-    let outputs = vec![cell_output_with_only_capacity(123468105678); 65];
-    let outputs_data = vec![Bytes::new().pack(); 65];
+    let outputs = vec![cell_output_with_only_capacity(123468105678); 1025];
+    let outputs_data = vec![Bytes::new().pack(); 1025];
 
     let mut b = [0; 8];
     LittleEndian::write_u64(&mut b, 1);
@@ -1817,3 +1873,121 @@ fn test_dao_all_dao_actions() {
     let verify_result = TransactionScriptsVerifier::new(&rtx, &data_loader).verify(MAX_CYCLES);
     verify_result.expect("pass verification");
 }
+
+// The withdrawal of test_dao_single_cell, with `witness` as the witness of the
+// withdrawing input, before it is signed.
+fn single_cell_withdraw_tx(witness: WitnessArgs) -> (DummyDataLoader, ResolvedTransaction) {
+    let mut data_loader = DummyDataLoader::new();
+    let (privkey, lock_args) = gen_lock();
+
+    let (deposit_header, deposit_epoch) = gen_header(1554, 10000000, 35, 1000, 1000);
+    let (withdraw_header, withdraw_epoch) = gen_header(2000610, 10001000, 575, 2000000, 1100);
+    let (cell, previous_out_point) = gen_dao_cell(
+        &mut data_loader,
+        Capacity::shannons(123456780000),
+        lock_args,
+    );
+
+    data_loader
+        .headers
+        .insert(deposit_header.hash(), deposit_header.clone());
+    data_loader
+        .headers
+        .insert(withdraw_header.hash(), withdraw_header.clone());
+    data_loader
+        .epoches
+        .insert(deposit_header.hash(), deposit_epoch.clone());
+    data_loader
+        .epoches
+        .insert(withdraw_header.hash(), withdraw_epoch.clone());
+
+    let mut b = [0; 8];
+    LittleEndian::write_u64(&mut b, 1554);
+    let input_cell_meta = CellMetaBuilder::from_cell_output(cell, Bytes::from(&b[..]))
+        .out_point(previous_out_point.clone())
+        .transaction_info(TransactionInfo {
+            block_hash: withdraw_header.hash(),
+            block_number: withdraw_header.number(),
+            block_epoch: EpochNumberWithFraction::new(575, 610, 1100),
+            index: 0,
+        })
+        .build();
+
+    let builder = TransactionBuilder::default()
+        .input(CellInput::new(previous_out_point, 0x2003e8022a0002f3))
+        .output(cell_output_with_only_capacity(123468105678))
+        .output_data(Bytes::new().pack())
+        .header_dep(withdraw_header.hash())
+        .header_dep(deposit_header.hash())
+        .witness(witness.as_bytes().pack());
+    let (tx, resolved_cell_deps) = complete_tx(&mut data_loader, builder);
+    let tx = sign_tx(tx, &privkey);
+    let rtx = ResolvedTransaction {
+        transaction: tx,
+        resolved_inputs: vec![input_cell_meta],
+        resolved_cell_deps,
+        resolved_dep_groups: vec![],
+    };
+    (data_loader, rtx)
+}
+
+fn deposit_header_index_witness(index: u64) -> WitnessArgs {
+    let mut b = [0; 8];
+    LittleEndian::write_u64(&mut b, index);
+    WitnessArgs::new_builder()
+        .type_(Bytes::from(&b[..]).pack())
+        .build()
+}
+
+#[test]
+fn test_dao_withdraw_with_large_witness() {
+    let witness = deposit_header_index_witness(1)
+        .as_builder()
+        .output_type(Bytes::from(vec![0x42u8; 30000]).pack())
+        .build();
+    let (data_loader, rtx) = single_cell_withdraw_tx(witness);
+    let verify_result = TransactionScriptsVerifier::new(&rtx, &data_loader).verify(MAX_CYCLES);
+    verify_result.expect("pass verification");
+}
+
+#[test]
+fn test_dao_deposit_header_index_uses_low_byte() {
+    // Only the low byte of the index is used, 0x101 points to the deposit header.
+    let (data_loader, rtx) = single_cell_withdraw_tx(deposit_header_index_witness(0x101));
+    let verify_result = TransactionScriptsVerifier::new(&rtx, &data_loader).verify(MAX_CYCLES);
+    verify_result.expect("pass verification");
+}
+
+#[test]
+fn test_dao_withdraw_with_too_long_witness() {
+    let witness = deposit_header_index_witness(1)
+        .as_builder()
+        .output_type(Bytes::from(vec![0x42u8; 32768]).pack())
+        .build();
+    let (data_loader, rtx) = single_cell_withdraw_tx(witness);
+    let verify_result = TransactionScriptsVerifier::new(&rtx, &data_loader).verify(MAX_CYCLES);
+    assert_error_eq!(
+        verify_result.unwrap_err(),
+        ScriptError::ValidationFailure(ERROR_WITNESS_TOO_LONG),
+    );
+}
+
+#[test]
+fn test_dao_invalid_deposit_header_index() {
+    let witness = WitnessArgs::new_builder()
+        .type_(Bytes::from(vec![1u8, 0, 0, 0]).pack())
+        .build();
+    let (data_loader, rtx) = single_cell_withdraw_tx(witness);
+    let verify_result = TransactionScriptsVerifier::new(&rtx, &data_loader).verify(MAX_CYCLES);
+    assert_error_eq!(
+        verify_result.unwrap_err(),
+        ScriptError::ValidationFailure(ERROR_ENCODING),
+    );
+
+    let (data_loader, rtx) = single_cell_withdraw_tx(WitnessArgs::default());
+    let verify_result = TransactionScriptsVerifier::new(&rtx, &data_loader).verify(MAX_CYCLES);
+    assert_error_eq!(
+        verify_result.unwrap_err(),
+        ScriptError::ValidationFailure(ERROR_ENCODING),
+    );
+}
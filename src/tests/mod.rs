@@ -1,6 +1,12 @@
+mod batch;
+mod cycles;
 mod dao;
+mod replay;
 mod secp256k1_blake160_multisig_all;
 mod secp256k1_blake160_sighash_all;
+mod signing;
+mod trace;
+mod worst_case;
 
 use ckb_crypto::secp::Privkey;
 use ckb_script::DataLoader;
@@ -18,13 +24,15 @@ pub const MAX_CYCLES: u64 = std::u64::MAX;
 pub const SIGNATURE_SIZE: usize = 65;
 
 lazy_static! {
-    pub static ref SIGHASH_ALL_BIN: Bytes =
-        Bytes::from(&include_bytes!("../../specs/cells/secp256k1_blake160_sighash_all")[..]);
+    pub static ref SIGHASH_ALL_BIN: Bytes = Bytes::from_static(include_bytes!(
+        "../../specs/cells/secp256k1_blake160_sighash_all"
+    ));
     pub static ref SECP256K1_DATA_BIN: Bytes =
-        Bytes::from(&include_bytes!("../../specs/cells/secp256k1_data")[..]);
-    pub static ref DAO_BIN: Bytes = Bytes::from(&include_bytes!("../../specs/cells/dao")[..]);
-    pub static ref MULTISIG_ALL_BIN: Bytes =
-        Bytes::from(&include_bytes!("../../specs/cells/secp256k1_blake160_multisig_all")[..]);
+        Bytes::from_static(include_bytes!("../../specs/cells/secp256k1_data"));
+    pub static ref DAO_BIN: Bytes = Bytes::from_static(include_bytes!("../../specs/cells/dao"));
+    pub static ref MULTISIG_ALL_BIN: Bytes = Bytes::from_static(include_bytes!(
+        "../../specs/cells/secp256k1_blake160_multisig_all"
+    ));
 }
 
 #[derive(Default)]
@@ -80,6 +88,24 @@ pub fn sign_tx_by_input_group(
     begin_index: usize,
     len: usize,
 ) -> TransactionView {
+    sign_tx_by_input_group_with(tx, begin_index, len, SIGNATURE_SIZE, |message| {
+        let sig = key.sign_recoverable(message).expect("sign");
+        sig.serialize().into()
+    })
+}
+
+// Signs the input group starting at `begin_index` with the lock field filled by
+// `sign`, which gets the signing message of a `lock_len` bytes long lock field.
+pub fn sign_tx_by_input_group_with<F>(
+    tx: TransactionView,
+    begin_index: usize,
+    len: usize,
+    lock_len: usize,
+    sign: F,
+) -> TransactionView
+where
+    F: Fn(&H256) -> Bytes,
+{
     let tx_hash = tx.hash();
     let mut signed_witnesses: Vec<packed::Bytes> = tx
         .inputs()
@@ -94,7 +120,7 @@ pub fn sign_tx_by_input_group(
                 let witness = WitnessArgs::new_unchecked(tx.witnesses().get(i).unwrap().unpack());
                 let zero_lock: Bytes = {
                     let mut buf = Vec::new();
-                    buf.resize(SIGNATURE_SIZE, 0);
+                    buf.resize(lock_len, 0);
                     buf.into()
                 };
                 let witness_for_digest =
@@ -110,10 +136,9 @@ pub fn sign_tx_by_input_group(
                 });
                 blake2b.finalize(&mut message);
                 let message = H256::from(message);
-                let sig = key.sign_recoverable(&message).expect("sign");
                 witness
                     .as_builder()
-                    .lock(sig.serialize().pack())
+                    .lock(sign(&message).pack())
                     .build()
                     .as_bytes()
                     .pack()
@@ -130,3 +155,29 @@ pub fn sign_tx_by_input_group(
         .set_witnesses(signed_witnesses)
         .build()
 }
+
+#[cfg(feature = "uncompressed")]
+#[test]
+fn test_bundled_cell_data() {
+    let binaries = [
+        (
+            "specs/cells/secp256k1_blake160_sighash_all",
+            &*SIGHASH_ALL_BIN,
+        ),
+        ("specs/cells/secp256k1_data", &*SECP256K1_DATA_BIN),
+        ("specs/cells/dao", &*DAO_BIN),
+        (
+            "specs/cells/secp256k1_blake160_multisig_all",
+            &*MULTISIG_ALL_BIN,
+        ),
+    ];
+    for (path, bin) in binaries.iter() {
+        let data = crate::bundled_cell_data(path).expect("bundled binary");
+        assert_eq!(data, &bin[..]);
+        assert_eq!(
+            &crate::BUNDLED_CELL.get(path).expect("bundled binary")[..],
+            data
+        );
+    }
+    assert!(crate::bundled_cell_data("specs/cells/missing").is_none());
+}
@@ -0,0 +1,342 @@
+//! Syscall replay files for the native host build of the scripts.
+//!
+//! A replay file holds the answer of every syscall a script can make while
+//! verifying one script group of a transaction, in the format read by
+//! `c/ckb_syscall_replay.h`. `make replay-files` records the files of the
+//! benchmark transactions in `cycles.rs` to `target/replay`, which can then be
+//! fed to the native builds from `CMakeLists.txt` via `CKB_REPLAY_FILE`.
+
+use super::{
+    cycles::{dao_withdraw_tx, multisig_all_tx, sighash_all_tx},
+    DummyDataLoader, MULTISIG_ALL_BIN, SECP256K1_DATA_BIN, SIGHASH_ALL_BIN,
+};
+use ckb_script::DataLoader;
+use ckb_types::{
+    bytes::Bytes,
+    core::{cell::ResolvedTransaction, Capacity, HeaderView},
+    packed::{Byte32, CellOutput, Script},
+    prelude::*,
+};
+use std::fs;
+
+const OUTPUT_DIR: &str = "target/replay";
+const MAGIC: &[u8] = b"CKBRPLY1";
+
+// Values from `c/ckb_consts.h`
+const SYS_CKB_LOAD_SCRIPT: u64 = 2052;
+const SYS_CKB_LOAD_TX_HASH: u64 = 2061;
+const SYS_CKB_LOAD_SCRIPT_HASH: u64 = 2062;
+const SYS_CKB_LOAD_CELL: u64 = 2071;
+const SYS_CKB_LOAD_HEADER: u64 = 2072;
+const SYS_CKB_LOAD_INPUT: u64 = 2073;
+const SYS_CKB_LOAD_WITNESS: u64 = 2074;
+const SYS_CKB_LOAD_CELL_BY_FIELD: u64 = 2081;
+const SYS_CKB_LOAD_HEADER_BY_FIELD: u64 = 2082;
+const SYS_CKB_LOAD_INPUT_BY_FIELD: u64 = 2083;
+const SYS_CKB_LOAD_CELL_DATA: u64 = 2092;
+
+const CKB_SUCCESS: u64 = 0;
+const CKB_ITEM_MISSING: u64 = 2;
+
+const SOURCE_INPUT: u64 = 1;
+const SOURCE_OUTPUT: u64 = 2;
+const SOURCE_CELL_DEP: u64 = 3;
+const SOURCE_HEADER_DEP: u64 = 4;
+const SOURCE_GROUP_INPUT: u64 = 0x0100_0000_0000_0001;
+const SOURCE_GROUP_OUTPUT: u64 = 0x0100_0000_0000_0002;
+
+const CELL_FIELD_CAPACITY: u64 = 0;
+const CELL_FIELD_DATA_HASH: u64 = 1;
+const CELL_FIELD_LOCK: u64 = 2;
+const CELL_FIELD_LOCK_HASH: u64 = 3;
+const CELL_FIELD_TYPE: u64 = 4;
+const CELL_FIELD_TYPE_HASH: u64 = 5;
+const CELL_FIELD_OCCUPIED_CAPACITY: u64 = 6;
+
+const HEADER_FIELD_EPOCH_NUMBER: u64 = 0;
+const HEADER_FIELD_EPOCH_START_BLOCK_NUMBER: u64 = 1;
+const HEADER_FIELD_EPOCH_LENGTH: u64 = 2;
+
+const INPUT_FIELD_OUT_POINT: u64 = 0;
+const INPUT_FIELD_SINCE: u64 = 1;
+
+// Which script of the transaction is run, this decides the cells in the group
+// sources.
+pub enum ScriptGroup {
+    Lock(Script),
+    Type(Script),
+}
+
+#[derive(Default)]
+pub struct Recorder {
+    buf: Vec<u8>,
+}
+
+impl Recorder {
+    fn entry(&mut self, syscall: u64, index: u64, source: u64, field: u64, ret: u64, data: &[u8]) {
+        for value in &[syscall, index, source, field, ret, data.len() as u64] {
+            self.buf.extend_from_slice(&value.to_le_bytes());
+        }
+        self.buf.extend_from_slice(data);
+    }
+
+    fn data(&mut self, syscall: u64, index: u64, source: u64, field: u64, data: &[u8]) {
+        self.entry(syscall, index, source, field, CKB_SUCCESS, data);
+    }
+
+    fn missing(&mut self, syscall: u64, index: u64, source: u64, field: u64) {
+        self.entry(syscall, index, source, field, CKB_ITEM_MISSING, &[]);
+    }
+
+    fn cell(&mut self, index: u64, source: u64, output: &CellOutput, data: &Bytes) {
+        let occupied: Capacity = output
+            .occupied_capacity(Capacity::bytes(data.len()).expect("data capacity"))
+            .expect("occupied capacity");
+        self.data(SYS_CKB_LOAD_CELL, index, source, 0, output.as_slice());
+        self.data(SYS_CKB_LOAD_CELL_DATA, index, source, 0, data);
+        let by_field = SYS_CKB_LOAD_CELL_BY_FIELD;
+        let capacity: u64 = output.capacity().unpack();
+        self.data(
+            by_field,
+            index,
+            source,
+            CELL_FIELD_CAPACITY,
+            &capacity.to_le_bytes(),
+        );
+        let data_hash = CellOutput::calc_data_hash(data);
+        self.data(
+            by_field,
+            index,
+            source,
+            CELL_FIELD_DATA_HASH,
+            data_hash.as_slice(),
+        );
+        self.data(
+            by_field,
+            index,
+            source,
+            CELL_FIELD_LOCK,
+            output.lock().as_slice(),
+        );
+        let lock_hash = output.calc_lock_hash();
+        self.data(
+            by_field,
+            index,
+            source,
+            CELL_FIELD_LOCK_HASH,
+            lock_hash.as_slice(),
+        );
+        match output.type_().to_opt() {
+            Some(type_) => {
+                self.data(by_field, index, source, CELL_FIELD_TYPE, type_.as_slice());
+                let type_hash = type_.calc_script_hash();
+                self.data(
+                    by_field,
+                    index,
+                    source,
+                    CELL_FIELD_TYPE_HASH,
+                    type_hash.as_slice(),
+                );
+            }
+            None => {
+                self.missing(by_field, index, source, CELL_FIELD_TYPE);
+                self.missing(by_field, index, source, CELL_FIELD_TYPE_HASH);
+            }
+        }
+        let occupied = occupied.as_u64().to_le_bytes();
+        self.data(
+            by_field,
+            index,
+            source,
+            CELL_FIELD_OCCUPIED_CAPACITY,
+            &occupied,
+        );
+    }
+
+    fn header(&mut self, index: u64, source: u64, data_loader: &DummyDataLoader, hash: &Byte32) {
+        let header: Option<HeaderView> = data_loader.get_header(hash);
+        match header {
+            Some(header) => self.data(
+                SYS_CKB_LOAD_HEADER,
+                index,
+                source,
+                0,
+                header.data().as_slice(),
+            ),
+            None => self.missing(SYS_CKB_LOAD_HEADER, index, source, 0),
+        }
+        let by_field = SYS_CKB_LOAD_HEADER_BY_FIELD;
+        match data_loader.get_block_epoch(hash) {
+            Some(epoch) => {
+                let fields = [
+                    (HEADER_FIELD_EPOCH_NUMBER, epoch.number()),
+                    (HEADER_FIELD_EPOCH_START_BLOCK_NUMBER, epoch.start_number()),
+                    (HEADER_FIELD_EPOCH_LENGTH, epoch.length()),
+                ];
+                for (field, value) in fields.iter() {
+                    self.data(by_field, index, source, *field, &value.to_le_bytes());
+                }
+            }
+            None => {
+                for field in &[
+                    HEADER_FIELD_EPOCH_NUMBER,
+                    HEADER_FIELD_EPOCH_START_BLOCK_NUMBER,
+                    HEADER_FIELD_EPOCH_LENGTH,
+                ] {
+                    self.missing(by_field, index, source, *field);
+                }
+            }
+        }
+    }
+
+    // Records everything a script of `group` can load from `rtx`.
+    pub fn record(
+        data_loader: &DummyDataLoader,
+        rtx: &ResolvedTransaction,
+        group: &ScriptGroup,
+    ) -> Vec<u8> {
+        let mut recorder = Recorder::default();
+        let tx = &rtx.transaction;
+        let script = match group {
+            ScriptGroup::Lock(script) | ScriptGroup::Type(script) => script,
+        };
+        let script_hash = script.calc_script_hash();
+        recorder.data(SYS_CKB_LOAD_SCRIPT, 0, 0, 0, script.as_slice());
+        recorder.data(SYS_CKB_LOAD_SCRIPT_HASH, 0, 0, 0, script_hash.as_slice());
+        recorder.data(SYS_CKB_LOAD_TX_HASH, 0, 0, 0, tx.hash().as_slice());
+
+        let in_group = |output: &CellOutput| match group {
+            ScriptGroup::Lock(_) => output.calc_lock_hash() == script_hash,
+            ScriptGroup::Type(_) => output
+                .type_()
+                .to_opt()
+                .map(|type_| type_.calc_script_hash() == script_hash)
+                .unwrap_or(false),
+        };
+
+        let witnesses: Vec<Bytes> = tx.witnesses().into_iter().map(|w| w.raw_data()).collect();
+        for (i, witness) in witnesses.iter().enumerate() {
+            recorder.data(SYS_CKB_LOAD_WITNESS, i as u64, SOURCE_INPUT, 0, witness);
+            recorder.data(SYS_CKB_LOAD_WITNESS, i as u64, SOURCE_OUTPUT, 0, witness);
+        }
+
+        let mut group_inputs = 0u64;
+        for (i, (input, cell)) in tx
+            .inputs()
+            .into_iter()
+            .zip(rtx.resolved_inputs.iter())
+            .enumerate()
+        {
+            let data = data_loader.load_cell_data(cell).expect("input data").0;
+            let mut sources = vec![(i as u64, SOURCE_INPUT)];
+            if in_group(&cell.cell_output) {
+                sources.push((group_inputs, SOURCE_GROUP_INPUT));
+                if let Some(witness) = witnesses.get(i) {
+                    recorder.data(
+                        SYS_CKB_LOAD_WITNESS,
+                        group_inputs,
+                        SOURCE_GROUP_INPUT,
+                        0,
+                        witness,
+                    );
+                }
+                group_inputs += 1;
+            }
+            for &(index, source) in &sources {
+                recorder.cell(index, source, &cell.cell_output, &data);
+                recorder.data(SYS_CKB_LOAD_INPUT, index, source, 0, input.as_slice());
+                let by_field = SYS_CKB_LOAD_INPUT_BY_FIELD;
+                let out_point = input.previous_output();
+                recorder.data(
+                    by_field,
+                    index,
+                    source,
+                    INPUT_FIELD_OUT_POINT,
+                    out_point.as_slice(),
+                );
+                let since: u64 = input.since().unpack();
+                recorder.data(
+                    by_field,
+                    index,
+                    source,
+                    INPUT_FIELD_SINCE,
+                    &since.to_le_bytes(),
+                );
+                if let Some(info) = &cell.transaction_info {
+                    recorder.header(index, source, data_loader, &info.block_hash);
+                }
+            }
+        }
+
+        let mut group_outputs = 0u64;
+        for (i, (output, data)) in tx
+            .outputs()
+            .into_iter()
+            .zip(tx.outputs_data().into_iter())
+            .enumerate()
+        {
+            let data = data.raw_data();
+            recorder.cell(i as u64, SOURCE_OUTPUT, &output, &data);
+            if let ScriptGroup::Type(_) = group {
+                if in_group(&output) {
+                    recorder.cell(group_outputs, SOURCE_GROUP_OUTPUT, &output, &data);
+                    if let Some(witness) = witnesses.get(i) {
+                        recorder.data(
+                            SYS_CKB_LOAD_WITNESS,
+                            group_outputs,
+                            SOURCE_GROUP_OUTPUT,
+                            0,
+                            witness,
+                        );
+                    }
+                    group_outputs += 1;
+                }
+            }
+        }
+
+        for (i, cell) in rtx.resolved_cell_deps.iter().enumerate() {
+            let data = data_loader.load_cell_data(cell).expect("cell dep data").0;
+            recorder.cell(i as u64, SOURCE_CELL_DEP, &cell.cell_output, &data);
+        }
+
+        for (i, hash) in tx.header_deps().into_iter().enumerate() {
+            recorder.header(i as u64, SOURCE_HEADER_DEP, data_loader, &hash);
+        }
+
+        let mut file = MAGIC.to_vec();
+        file.extend_from_slice(&recorder.buf);
+        file
+    }
+}
+
+fn write_replay_file(name: &str, content: &[u8]) {
+    fs::create_dir_all(OUTPUT_DIR).expect("create replay dir");
+    let path = format!("{}/{}.bin", OUTPUT_DIR, name);
+    fs::write(&path, content).expect("write replay file");
+    println!("{}: {} bytes", path, content.len());
+}
+
+fn first_input_lock(rtx: &ResolvedTransaction) -> ScriptGroup {
+    ScriptGroup::Lock(rtx.resolved_inputs[0].cell_output.lock())
+}
+
+#[test]
+#[ignore]
+fn record_replay_files() {
+    let (data_loader, rtx) = sighash_all_tx(1, 32, &SIGHASH_ALL_BIN, &SECP256K1_DATA_BIN);
+    let content = Recorder::record(&data_loader, &rtx, &first_input_lock(&rtx));
+    write_replay_file("secp256k1_blake160_sighash_all", &content);
+
+    let (data_loader, rtx) = multisig_all_tx(3, 5, 1, &MULTISIG_ALL_BIN, &SECP256K1_DATA_BIN);
+    let content = Recorder::record(&data_loader, &rtx, &first_input_lock(&rtx));
+    write_replay_file("secp256k1_blake160_multisig_all", &content);
+
+    let (data_loader, rtx) = dao_withdraw_tx(4, 1);
+    let dao_script = rtx.resolved_inputs[0]
+        .cell_output
+        .type_()
+        .to_opt()
+        .expect("dao type script");
+    let content = Recorder::record(&data_loader, &rtx, &ScriptGroup::Type(dao_script));
+    write_replay_file("dao", &content);
+}
@@ -17,7 +17,9 @@ use rand::{thread_rng, Rng};
 
 const SIGNATURE_SIZE: usize = 65;
 
+const ERROR_SECP_PARSE_SIGNATURE: i8 = -14;
 const ERROR_WITNESS_SIZE: i8 = -22;
+const ERROR_INVALID_RESERVE_FIELD: i8 = -41;
 const ERROR_INVALID_PUBKEYS_CNT: i8 = -42;
 const ERROR_INVALID_THRESHOLD: i8 = -43;
 const ERROR_INVALID_REQUIRE_FIRST_N: i8 = -44;
@@ -26,6 +28,9 @@ const ERROR_VERIFICATION: i8 = -52;
 const ERROR_INCORRECT_SINCE_FLAG: i8 = -23;
 const ERROR_INCORRECT_SINCE_VALUE: i8 = -24;
 
+pub const MULTISIG_MODE_ANY_ORDER: u8 = 0;
+pub const MULTISIG_MODE_SORTED: u8 = 1;
+
 #[test]
 fn test_multisig_script_hash() {
     let mut data_loader = DummyDataLoader::new();
@@ -168,6 +173,34 @@ fn test_multisig_0_2_3_unlock() {
     }
 }
 
+#[test]
+fn test_multisig_0_2_3_invalid_recovery_id() {
+    let mut data_loader = DummyDataLoader::new();
+    let keys = generate_keys(3);
+    let multi_sign_script = gen_multi_sign_script(&keys, 2, 0);
+    let args = blake160(&multi_sign_script);
+    let raw_tx = gen_tx(&mut data_loader, args);
+    let tx = multi_sign_tx(raw_tx, &multi_sign_script, &[&keys[0], &keys[1]]);
+
+    // Break the recovery ID of the last signature, the batched recovery fails, and
+    // the per signature fallback reports the parsing error.
+    let witness =
+        WitnessArgs::new_unchecked(Unpack::<Bytes>::unpack(&tx.witnesses().get(0).unwrap()));
+    let mut lock = Unpack::<Bytes>::unpack(&witness.lock().to_opt().unwrap()).to_vec();
+    let last = lock.len() - 1;
+    lock[last] = 4;
+    let witness = witness.as_builder().lock(Bytes::from(lock).pack()).build();
+    let tx = tx
+        .as_advanced_builder()
+        .set_witnesses(vec![witness.as_bytes().pack()])
+        .build();
+    let verify_result = verify(&data_loader, &tx);
+    assert_error_eq!(
+        verify_result.unwrap_err(),
+        ScriptError::ValidationFailure(ERROR_SECP_PARSE_SIGNATURE),
+    );
+}
+
 #[test]
 fn test_multisig_1_2_3_unlock() {
     let mut data_loader = DummyDataLoader::new();
@@ -286,6 +319,40 @@ fn test_multisig_0_1_1_unlock() {
     }
 }
 
+#[test]
+fn test_multisig_script_around_one_block_unlock() {
+    // `multisig_script` of 6 public keys fits in one blake2b block, 7 public keys
+    // need two blocks.
+    for keys_len in 6..=7 {
+        let mut data_loader = DummyDataLoader::new();
+        let keys = generate_keys(keys_len);
+        let multi_sign_script = gen_multi_sign_script(&keys, 2, 0);
+        let args = blake160(&multi_sign_script);
+        let raw_tx = gen_tx(&mut data_loader, args);
+        {
+            let tx = multi_sign_tx(
+                raw_tx.clone(),
+                &multi_sign_script,
+                &[&keys[0], &keys[keys_len - 1]],
+            );
+            verify(&data_loader, &tx).expect("pass verification");
+        }
+        {
+            let wrong_multi_sign_script = gen_multi_sign_script(&keys, 2, 1);
+            let tx = multi_sign_tx(
+                raw_tx.clone(),
+                &wrong_multi_sign_script,
+                &[&keys[0], &keys[keys_len - 1]],
+            );
+            let verify_result = verify(&data_loader, &tx);
+            assert_error_eq!(
+                verify_result.unwrap_err(),
+                ScriptError::ValidationFailure(ERROR_MULTSIG_SCRIPT_HASH),
+            );
+        }
+    }
+}
+
 #[test]
 fn test_multisig_0_2_2_unlock() {
     let mut data_loader = DummyDataLoader::new();
@@ -312,7 +379,147 @@ fn test_multisig_0_2_2_unlock() {
     }
 }
 
-fn multi_sign_tx(
+#[test]
+fn test_multisig_0_1_3_unlock_with_last_key() {
+    let mut data_loader = DummyDataLoader::new();
+    let keys = generate_keys(3);
+    let multi_sign_script = gen_multi_sign_script(&keys, 1, 0);
+    let args = blake160(&multi_sign_script);
+    let raw_tx = gen_tx(&mut data_loader, args);
+    let tx = multi_sign_tx(raw_tx.clone(), &multi_sign_script, &[&keys[2]]);
+    verify(&data_loader, &tx).expect("pass verification");
+}
+
+#[test]
+fn test_multisig_invalid_mode() {
+    let mut data_loader = DummyDataLoader::new();
+    let keys = generate_keys(3);
+    let multi_sign_script = gen_multi_sign_script_with_mode(&keys, 2, 2, 0);
+    let args = blake160(&multi_sign_script);
+    let raw_tx = gen_tx(&mut data_loader, args);
+    let tx = multi_sign_tx(raw_tx.clone(), &multi_sign_script, &[&keys[0], &keys[1]]);
+    let verify_result = verify(&data_loader, &tx);
+    assert_error_eq!(
+        verify_result.unwrap_err(),
+        ScriptError::ValidationFailure(ERROR_INVALID_RESERVE_FIELD),
+    );
+}
+
+#[test]
+fn test_multisig_sorted_0_3_5_unlock() {
+    let mut data_loader = DummyDataLoader::new();
+    let keys = generate_keys(5);
+    let multi_sign_script = gen_multi_sign_script_with_mode(&keys, MULTISIG_MODE_SORTED, 3, 0);
+    let args = blake160(&multi_sign_script);
+    let raw_tx = gen_tx(&mut data_loader, args);
+    {
+        let tx = multi_sign_tx(
+            raw_tx.clone(),
+            &multi_sign_script,
+            &[&keys[0], &keys[1], &keys[2]],
+        );
+        verify(&data_loader, &tx).expect("pass verification");
+    }
+    {
+        let tx = multi_sign_tx(
+            raw_tx.clone(),
+            &multi_sign_script,
+            &[&keys[0], &keys[2], &keys[4]],
+        );
+        verify(&data_loader, &tx).expect("pass verification");
+    }
+    {
+        let tx = multi_sign_tx(
+            raw_tx.clone(),
+            &multi_sign_script,
+            &[&keys[2], &keys[3], &keys[4]],
+        );
+        verify(&data_loader, &tx).expect("pass verification");
+    }
+
+    // Signatures out of public key order
+    {
+        let tx = multi_sign_tx(
+            raw_tx.clone(),
+            &multi_sign_script,
+            &[&keys[1], &keys[0], &keys[2]],
+        );
+        let verify_result = verify(&data_loader, &tx);
+        assert_error_eq!(
+            verify_result.unwrap_err(),
+            ScriptError::ValidationFailure(ERROR_VERIFICATION),
+        );
+    }
+    {
+        let tx = multi_sign_tx(
+            raw_tx.clone(),
+            &multi_sign_script,
+            &[&keys[0], &keys[4], &keys[3]],
+        );
+        let verify_result = verify(&data_loader, &tx);
+        assert_error_eq!(
+            verify_result.unwrap_err(),
+            ScriptError::ValidationFailure(ERROR_VERIFICATION),
+        );
+    }
+    // The same key signing twice
+    {
+        let tx = multi_sign_tx(
+            raw_tx.clone(),
+            &multi_sign_script,
+            &[&keys[0], &keys[1], &keys[1]],
+        );
+        let verify_result = verify(&data_loader, &tx);
+        assert_error_eq!(
+            verify_result.unwrap_err(),
+            ScriptError::ValidationFailure(ERROR_VERIFICATION),
+        );
+    }
+    let wrong_keys = generate_keys(1);
+    {
+        let tx = multi_sign_tx(
+            raw_tx.clone(),
+            &multi_sign_script,
+            &[&keys[0], &wrong_keys[0], &keys[4]],
+        );
+        let verify_result = verify(&data_loader, &tx);
+        assert_error_eq!(
+            verify_result.unwrap_err(),
+            ScriptError::ValidationFailure(ERROR_VERIFICATION),
+        );
+    }
+}
+
+#[test]
+fn test_multisig_sorted_2_3_5_unlock() {
+    let mut data_loader = DummyDataLoader::new();
+    let keys = generate_keys(5);
+    let multi_sign_script = gen_multi_sign_script_with_mode(&keys, MULTISIG_MODE_SORTED, 3, 2);
+    let args = blake160(&multi_sign_script);
+    let raw_tx = gen_tx(&mut data_loader, args);
+    {
+        let tx = multi_sign_tx(
+            raw_tx.clone(),
+            &multi_sign_script,
+            &[&keys[0], &keys[1], &keys[3]],
+        );
+        verify(&data_loader, &tx).expect("pass verification");
+    }
+    {
+        let tx = multi_sign_tx(
+            raw_tx.clone(),
+            &multi_sign_script,
+            &[&keys[0], &keys[2], &keys[3]],
+        );
+        let verify_result = verify(&data_loader, &tx);
+        assert_error_eq!(
+            verify_result.unwrap_err(),
+            ScriptError::ValidationFailure(ERROR_VERIFICATION),
+        );
+    }
+}
+
+pub fn multi_sign_tx(
     tx: TransactionView,
     multi_sign_script: &Bytes,
     keys: &[&Privkey],
@@ -668,22 +875,49 @@ fn test_genesis_time_locked_cell() {
     }
 }
 
-fn gen_multi_sign_script(keys: &[Privkey], threshold: u8, require_first_n: u8) -> Bytes {
+pub fn gen_multi_sign_script(keys: &[Privkey], threshold: u8, require_first_n: u8) -> Bytes {
+    gen_multi_sign_script_with_mode(keys, MULTISIG_MODE_ANY_ORDER, threshold, require_first_n)
+}
+
+pub fn gen_multi_sign_script_with_mode(
+    keys: &[Privkey],
+    mode: u8,
+    threshold: u8,
+    require_first_n: u8,
+) -> Bytes {
     let pubkeys = keys
         .iter()
         .map(|key| key.pubkey().unwrap())
         .collect::<Vec<_>>();
-    let mut script = vec![0u8, require_first_n, threshold, pubkeys.len() as u8];
+    let mut script = vec![mode, require_first_n, threshold, pubkeys.len() as u8];
     pubkeys.iter().for_each(|pubkey| {
         script.extend_from_slice(&blake160(&pubkey.serialize()));
     });
     script.into()
 }
 
-fn gen_tx_with_extra_inputs(
+pub fn gen_tx_with_extra_inputs(
     dummy: &mut DummyDataLoader,
     lock_args: Bytes,
     extra_inputs: u32,
+) -> TransactionView {
+    gen_tx_with_binaries(
+        dummy,
+        lock_args,
+        extra_inputs,
+        &MULTISIG_ALL_BIN,
+        &SECP256K1_DATA_BIN,
+    )
+}
+
+// Same as `gen_tx_with_extra_inputs`, but uses the given lock script and
+// secp256k1 data binaries in cell deps.
+pub fn gen_tx_with_binaries(
+    dummy: &mut DummyDataLoader,
+    lock_args: Bytes,
+    extra_inputs: u32,
+    lock_bin: &Bytes,
+    secp256k1_data_bin: &Bytes,
 ) -> TransactionView {
     let previous_tx_hash = {
         let mut rng = thread_rng();
@@ -705,16 +939,15 @@ fn gen_tx_with_extra_inputs(
     // dep contract code
     let dep_cell = CellOutput::new_builder()
         .capacity(
-            Capacity::bytes(MULTISIG_ALL_BIN.len())
+            Capacity::bytes(lock_bin.len())
                 .expect("script capacity")
                 .pack(),
         )
         .build();
-    let dep_cell_data_hash = CellOutput::calc_data_hash(&MULTISIG_ALL_BIN);
-    dummy.cells.insert(
-        contract_out_point.clone(),
-        (dep_cell, MULTISIG_ALL_BIN.clone()),
-    );
+    let dep_cell_data_hash = CellOutput::calc_data_hash(lock_bin);
+    dummy
+        .cells
+        .insert(contract_out_point.clone(), (dep_cell, lock_bin.clone()));
     // secp256k1 data
     let secp256k1_data_out_point = {
         let tx_hash = {
@@ -727,14 +960,14 @@ fn gen_tx_with_extra_inputs(
     };
     let secp256k1_data_cell = CellOutput::new_builder()
         .capacity(
-            Capacity::bytes(SECP256K1_DATA_BIN.len())
+            Capacity::bytes(secp256k1_data_bin.len())
                 .expect("data capacity")
                 .pack(),
         )
         .build();
     dummy.cells.insert(
         secp256k1_data_out_point.clone(),
-        (secp256k1_data_cell, SECP256K1_DATA_BIN.clone()),
+        (secp256k1_data_cell, secp256k1_data_bin.clone()),
     );
     // input unlock script
     let script = Script::new_builder()
@@ -801,7 +1034,10 @@ fn gen_tx(dummy: &mut DummyDataLoader, lock_args: Bytes) -> TransactionView {
     gen_tx_with_extra_inputs(dummy, lock_args, 0)
 }
 
-fn build_resolved_tx(data_loader: &DummyDataLoader, tx: &TransactionView) -> ResolvedTransaction {
+pub fn build_resolved_tx(
+    data_loader: &DummyDataLoader,
+    tx: &TransactionView,
+) -> ResolvedTransaction {
     let resolved_cell_deps = tx
         .cell_deps()
         .into_iter()
@@ -833,7 +1069,7 @@ fn build_resolved_tx(data_loader: &DummyDataLoader, tx: &TransactionView) -> Res
     }
 }
 
-fn generate_keys(n: usize) -> Vec<Privkey> {
+pub fn generate_keys(n: usize) -> Vec<Privkey> {
     let mut keys = Vec::with_capacity(n);
     for _ in 0..n {
         keys.push(Generator::random_privkey());
@@ -842,7 +1078,7 @@ fn generate_keys(n: usize) -> Vec<Privkey> {
     keys
 }
 
-fn verify(data_loader: &DummyDataLoader, tx: &TransactionView) -> Result<u64, Error> {
+pub fn verify(data_loader: &DummyDataLoader, tx: &TransactionView) -> Result<u64, Error> {
     let resolved_tx = build_resolved_tx(&data_loader, &tx);
     TransactionScriptsVerifier::new(&resolved_tx, data_loader).verify(MAX_CYCLES)
 }
@@ -26,10 +26,28 @@ fn gen_tx(dummy: &mut DummyDataLoader, lock_args: Bytes) -> TransactionView {
     gen_tx_with_grouped_args(dummy, vec![(lock_args, 1)], &mut rng)
 }
 
-fn gen_tx_with_grouped_args<R: Rng>(
+pub fn gen_tx_with_grouped_args<R: Rng>(
     dummy: &mut DummyDataLoader,
     grouped_args: Vec<(Bytes, usize)>,
     rng: &mut R,
+) -> TransactionView {
+    gen_tx_with_binaries(
+        dummy,
+        grouped_args,
+        &SIGHASH_ALL_BIN,
+        &SECP256K1_DATA_BIN,
+        rng,
+    )
+}
+
+// Same as `gen_tx_with_grouped_args`, but uses the given lock script and
+// secp256k1 data binaries in cell deps.
+pub fn gen_tx_with_binaries<R: Rng>(
+    dummy: &mut DummyDataLoader,
+    grouped_args: Vec<(Bytes, usize)>,
+    lock_bin: &Bytes,
+    secp256k1_data_bin: &Bytes,
+    rng: &mut R,
 ) -> TransactionView {
     // setup sighash_all dep
     let sighash_all_out_point = {
@@ -43,15 +61,15 @@ fn gen_tx_with_grouped_args<R: Rng>(
     // dep contract code
     let sighash_all_cell = CellOutput::new_builder()
         .capacity(
-            Capacity::bytes(SIGHASH_ALL_BIN.len())
+            Capacity::bytes(lock_bin.len())
                 .expect("script capacity")
                 .pack(),
         )
         .build();
-    let sighash_all_cell_data_hash = CellOutput::calc_data_hash(&SIGHASH_ALL_BIN);
+    let sighash_all_cell_data_hash = CellOutput::calc_data_hash(lock_bin);
     dummy.cells.insert(
         sighash_all_out_point.clone(),
-        (sighash_all_cell, SIGHASH_ALL_BIN.clone()),
+        (sighash_all_cell, lock_bin.clone()),
     );
     // setup secp256k1_data dep
     let secp256k1_data_out_point = {
@@ -64,14 +82,14 @@ fn gen_tx_with_grouped_args<R: Rng>(
     };
     let secp256k1_data_cell = CellOutput::new_builder()
         .capacity(
-            Capacity::bytes(SECP256K1_DATA_BIN.len())
+            Capacity::bytes(secp256k1_data_bin.len())
                 .expect("data capacity")
                 .pack(),
         )
         .build();
     dummy.cells.insert(
         secp256k1_data_out_point.clone(),
-        (secp256k1_data_cell, SECP256K1_DATA_BIN.clone()),
+        (secp256k1_data_cell, secp256k1_data_bin.clone()),
     );
     // setup default tx builder
     let dummy_capacity = Capacity::shannons(42);
@@ -147,7 +165,10 @@ fn sign_tx_hash(tx: TransactionView, key: &Privkey, tx_hash: &[u8]) -> Transacti
         .build()
 }
 
-fn build_resolved_tx(data_loader: &DummyDataLoader, tx: &TransactionView) -> ResolvedTransaction {
+pub fn build_resolved_tx(
+    data_loader: &DummyDataLoader,
+    tx: &TransactionView,
+) -> ResolvedTransaction {
     let resolved_cell_deps = tx
         .cell_deps()
         .into_iter()
@@ -393,6 +414,68 @@ fn test_super_long_witness() {
     );
 }
 
+#[test]
+fn test_super_long_group_and_trailing_witnesses_unlock() {
+    let mut rng = thread_rng();
+    let mut data_loader = DummyDataLoader::new();
+    let privkey = Generator::random_privkey();
+    let pubkey = privkey.pubkey().expect("pubkey");
+    let pubkey_hash = blake160(&pubkey.serialize());
+
+    // Only the first witness is limited to 32KB, the other group witnesses and the
+    // trailing witnesses are streamed into the hasher.
+    let tx = gen_tx_with_grouped_args(&mut data_loader, vec![(pubkey_hash, 2)], &mut rng);
+    let witness = Unpack::<Vec<_>>::unpack(&tx.witnesses()).remove(0);
+    let tx = tx
+        .as_advanced_builder()
+        .set_witnesses(vec![
+            witness.pack(),
+            Bytes::from(vec![1u8; 40000]).pack(),
+            Bytes::from(vec![2u8; 100000]).pack(),
+        ])
+        .build();
+    let tx = sign_tx_by_input_group(tx, &privkey, 0, 3);
+
+    let resolved_tx = build_resolved_tx(&data_loader, &tx);
+    let verify_result =
+        TransactionScriptsVerifier::new(&resolved_tx, &data_loader).verify(MAX_CYCLES);
+    verify_result.expect("pass verification");
+}
+
+#[test]
+fn test_random_witnesses_around_block_boundaries_unlock() {
+    let mut rng = thread_rng();
+    let mut data_loader = DummyDataLoader::new();
+    let privkey = Generator::random_privkey();
+    let pubkey = privkey.pubkey().expect("pubkey");
+    let pubkey_hash = blake160(&pubkey.serialize());
+
+    // Random bytes in witnesses whose lengths land just around the 128-byte
+    // blake2b block size, so the script's blake2b_compress is checked against
+    // the signing side for every block position.
+    let lengths = [1usize, 127, 128, 129, 255, 256, 257, 32768];
+    let tx = gen_tx_with_grouped_args(
+        &mut data_loader,
+        vec![(pubkey_hash, lengths.len() + 1)],
+        &mut rng,
+    );
+    let witness = Unpack::<Vec<_>>::unpack(&tx.witnesses()).remove(0);
+    let mut witnesses = vec![witness.pack()];
+    for length in lengths.iter() {
+        let mut buf = vec![0u8; *length];
+        rng.fill(&mut buf[..]);
+        witnesses.push(Bytes::from(buf).pack());
+    }
+    let witnesses_len = witnesses.len();
+    let tx = tx.as_advanced_builder().set_witnesses(witnesses).build();
+    let tx = sign_tx_by_input_group(tx, &privkey, 0, witnesses_len);
+
+    let resolved_tx = build_resolved_tx(&data_loader, &tx);
+    let verify_result =
+        TransactionScriptsVerifier::new(&resolved_tx, &data_loader).verify(MAX_CYCLES);
+    verify_result.expect("pass verification");
+}
+
 #[test]
 fn test_sighash_all_2_in_2_out_cycles() {
     const CONSUME_CYCLES: u64 = 3394434;
@@ -459,6 +542,37 @@ fn test_sighash_all_witness_append_junk_data() {
     );
 }
 
+#[test]
+fn test_sighash_all_witness_malformed_lock() {
+    let mut rng = thread_rng();
+    let mut data_loader = DummyDataLoader::new();
+    let privkey = Generator::random_privkey();
+    let pubkey = privkey.pubkey().expect("pubkey");
+    let pubkey_hash = blake160(&pubkey.serialize());
+
+    let tx = gen_tx_with_grouped_args(&mut data_loader, vec![(pubkey_hash, 1)], &mut rng);
+    let tx = sign_tx_by_input_group(tx, &privkey, 0, 1);
+    let mut witnesses: Vec<_> = Unpack::<Vec<_>>::unpack(&tx.witnesses());
+    // the lock field starts right after the 16-byte WitnessArgs header, make its
+    // length claim one more byte than it holds
+    let mut witness = witnesses[0].to_vec();
+    witness[16] += 1;
+    witnesses[0] = witness.into();
+
+    let tx = tx
+        .as_advanced_builder()
+        .set_witnesses(witnesses.into_iter().map(|w| w.pack()).collect())
+        .build();
+
+    let resolved_tx = build_resolved_tx(&data_loader, &tx);
+    let verify_result =
+        TransactionScriptsVerifier::new(&resolved_tx, &data_loader).verify(MAX_CYCLES);
+    assert_error_eq!(
+        verify_result.unwrap_err(),
+        ScriptError::ValidationFailure(ERROR_ENCODING),
+    );
+}
+
 #[test]
 fn test_sighash_all_witness_args_ambiguity() {
     // This test case build tx with WitnessArgs(lock, data, "")
@@ -0,0 +1,164 @@
+use super::{
+    blake160,
+    secp256k1_blake160_multisig_all::{
+        gen_multi_sign_script, gen_tx_with_extra_inputs, generate_keys, verify,
+    },
+    secp256k1_blake160_sighash_all::{build_resolved_tx, gen_tx_with_grouped_args},
+    sign_tx_by_input_group_with, DummyDataLoader, MAX_CYCLES, SIGNATURE_SIZE,
+};
+use crate::{SigningError, SigningMessages};
+use ckb_crypto::secp::{Generator, Privkey};
+use ckb_script::TransactionScriptsVerifier;
+use ckb_types::{
+    bytes::Bytes,
+    core::TransactionView,
+    packed::{self, WitnessArgs},
+    prelude::*,
+    H256,
+};
+use rand::thread_rng;
+use std::cell::RefCell;
+
+fn tx_hash(tx: &TransactionView) -> [u8; 32] {
+    let mut tx_hash = [0u8; 32];
+    tx_hash.copy_from_slice(&tx.hash().raw_data());
+    tx_hash
+}
+
+fn witnesses(tx: &TransactionView) -> Vec<Bytes> {
+    tx.witnesses().into_iter().map(|w| w.unpack()).collect()
+}
+
+fn sighash_all_message(tx: &TransactionView, group: &[usize]) -> [u8; 32] {
+    let tx_hash = tx_hash(tx);
+    let witnesses = witnesses(tx);
+    let witness_slices: Vec<&[u8]> = witnesses.iter().map(|w| &w[..]).collect();
+    let messages = SigningMessages::new(&tx_hash, tx.inputs().len(), &witness_slices);
+    messages.sighash_all(group).expect("message")
+}
+
+fn set_lock(tx: TransactionView, index: usize, lock: Bytes) -> TransactionView {
+    let mut witnesses: Vec<packed::Bytes> = tx.witnesses().into_iter().collect();
+    let witness = WitnessArgs::new_unchecked(witnesses[index].unpack());
+    witnesses[index] = witness
+        .as_builder()
+        .lock(lock.pack())
+        .build()
+        .as_bytes()
+        .pack();
+    tx.as_advanced_builder().set_witnesses(witnesses).build()
+}
+
+fn signature(key: &Privkey, message: [u8; 32]) -> Bytes {
+    let sig = key.sign_recoverable(&H256::from(message)).expect("sign");
+    sig.serialize().into()
+}
+
+fn sighash_key() -> (Privkey, Bytes) {
+    let privkey = Generator::random_privkey();
+    let pubkey = privkey.pubkey().expect("pubkey");
+    let pubkey_hash = blake160(&pubkey.serialize());
+    (privkey, pubkey_hash)
+}
+
+#[test]
+fn test_sighash_all_groups_unlock() {
+    let mut rng = thread_rng();
+    let mut data_loader = DummyDataLoader::new();
+    let (privkey, pubkey_hash) = sighash_key();
+    let (privkey2, pubkey_hash2) = sighash_key();
+    let tx = gen_tx_with_grouped_args(
+        &mut data_loader,
+        vec![(pubkey_hash, 2), (pubkey_hash2, 3)],
+        &mut rng,
+    );
+    let placeholder = Bytes::from(vec![0; SIGNATURE_SIZE]);
+    let tx = set_lock(tx, 0, placeholder.clone());
+    let tx = set_lock(tx, 2, placeholder);
+
+    // Same messages as the test signer, which doesn't hash trailing witnesses.
+    for &(begin_index, len) in &[(0, 2), (2, 3)] {
+        let signed = RefCell::new(Vec::new());
+        sign_tx_by_input_group_with(tx.clone(), begin_index, len, SIGNATURE_SIZE, |message| {
+            signed.borrow_mut().push(message.clone());
+            Bytes::from(vec![0; SIGNATURE_SIZE])
+        });
+        let group: Vec<usize> = (begin_index..begin_index + len).collect();
+        assert_eq!(
+            signed.into_inner(),
+            vec![H256::from(sighash_all_message(&tx, &group))]
+        );
+    }
+
+    let tx = tx
+        .as_advanced_builder()
+        .witness(Bytes::from(vec![42; 1000]).pack())
+        .build();
+    let tx_hash = tx_hash(&tx);
+    let witnesses = witnesses(&tx);
+    let witness_slices: Vec<&[u8]> = witnesses.iter().map(|w| &w[..]).collect();
+    let messages = SigningMessages::new(&tx_hash, tx.inputs().len(), &witness_slices);
+    let message = messages.sighash_all(&[0, 1]).expect("message");
+    let message2 = messages.sighash_all(&[2, 3, 4]).expect("message");
+
+    let tx = set_lock(tx, 0, signature(&privkey, message));
+    let tx = set_lock(tx, 2, signature(&privkey2, message2));
+    let resolved_tx = build_resolved_tx(&data_loader, &tx);
+    let verify_result =
+        TransactionScriptsVerifier::new(&resolved_tx, &data_loader).verify(MAX_CYCLES);
+    verify_result.expect("pass verification");
+}
+
+#[test]
+fn test_multisig_all_unlock() {
+    let mut data_loader = DummyDataLoader::new();
+    let keys = generate_keys(3);
+    let multi_sign_script = gen_multi_sign_script(&keys, 2, 1);
+    let args = blake160(&multi_sign_script);
+    let tx = gen_tx_with_extra_inputs(&mut data_loader, args, 1);
+    let mut lock = multi_sign_script.to_vec();
+    lock.resize(multi_sign_script.len() + 2 * SIGNATURE_SIZE, 0);
+    let tx = set_lock(tx, 0, Bytes::from(lock));
+
+    let tx_hash = tx_hash(&tx);
+    let witnesses = witnesses(&tx);
+    let witness_slices: Vec<&[u8]> = witnesses.iter().map(|w| &w[..]).collect();
+    let messages = SigningMessages::new(&tx_hash, tx.inputs().len(), &witness_slices);
+    let message = messages.multisig_all(&[0, 1]).expect("message");
+
+    let mut lock = multi_sign_script.to_vec();
+    lock.extend_from_slice(&signature(&keys[0], message));
+    lock.extend_from_slice(&signature(&keys[1], message));
+    let tx = set_lock(tx, 0, Bytes::from(lock));
+    verify(&data_loader, &tx).expect("pass verification");
+}
+
+#[test]
+fn test_signing_errors() {
+    let mut rng = thread_rng();
+    let mut data_loader = DummyDataLoader::new();
+    let (_, pubkey_hash) = sighash_key();
+    let tx = gen_tx_with_grouped_args(&mut data_loader, vec![(pubkey_hash, 2)], &mut rng);
+
+    let check = |tx: &TransactionView, group: &[usize]| {
+        let tx_hash = tx_hash(tx);
+        let witnesses = witnesses(tx);
+        let witness_slices: Vec<&[u8]> = witnesses.iter().map(|w| &w[..]).collect();
+        let messages = SigningMessages::new(&tx_hash, tx.inputs().len(), &witness_slices);
+        (messages.sighash_all(group), messages.multisig_all(group))
+    };
+
+    let (sighash_all, _) = check(&tx, &[0, 1]);
+    assert_eq!(sighash_all, Err(SigningError::Encoding));
+
+    let tx = set_lock(tx, 0, Bytes::from(vec![0; SIGNATURE_SIZE - 1]));
+    let (sighash_all, multisig_all) = check(&tx, &[0, 1]);
+    assert_eq!(sighash_all, Err(SigningError::LockSize));
+    assert_eq!(multisig_all, Err(SigningError::MultisigScript));
+
+    let tx = set_lock(tx, 0, Bytes::from(vec![0; SIGNATURE_SIZE]));
+    assert!(check(&tx, &[0, 1]).0.is_ok());
+    assert_eq!(check(&tx, &[]).0, Err(SigningError::InvalidGroup));
+    assert_eq!(check(&tx, &[1, 0]).0, Err(SigningError::InvalidGroup));
+    assert_eq!(check(&tx, &[2]).0, Err(SigningError::InvalidGroup));
+}
@@ -0,0 +1,236 @@
+//! Call stack traces of the scripts.
+//!
+//! `make trace` builds the native replay builds of the scripts into `build/trace` with
+//! call tracing, see `c/trace.h`, and `make trace-cycles` runs them on the replay files
+//! `make replay-files` records into `target/replay`: the single-sig and 3-of-5
+//! multisig transactions and the DAO withdraw of `replay.rs`. The traced functions are
+//! named after the symbols of the binaries, and two files are written per script:
+//!
+//! * `target/trace/<script>.folded`, one line per call stack with the nanoseconds spent
+//! in its innermost function, as taken by flamegraph.pl and similar tools;
+//! * `target/trace/<script>.sites.csv`, the calls and nanoseconds, callees included, of
+//! each function per call site. The call sites are turned into source lines by
+//! `addr2line` when it is found, and left as addresses otherwise.
+//!
+//! The times are the ones of the host, CKB-VM at the pinned ckb version gives the
+//! scripts no way to read their cycles. They rank the call stacks the same way as long
+//! as the host and the VM agree on what is expensive, which is mostly true of the
+//! hashing and field arithmetic, less so of the syscalls. The tracing hooks themselves
+//! are not counted.
+
+use byteorder::{ByteOrder, LittleEndian};
+use std::{collections::BTreeMap, fs, path::Path, process::Command};
+
+const TRACE_DIR: &str = "build/trace";
+const REPLAY_DIR: &str = "target/replay";
+const OUTPUT_DIR: &str = "target/trace";
+const TRACE_PREFIX: &str = "trace ";
+const ADDR2LINE: &str = "addr2line";
+const SCRIPTS: &[&str] = &[
+    "secp256k1_blake160_sighash_all",
+    "secp256k1_blake160_multisig_all",
+    "dao",
+];
+// The script main is renamed by c/trace.h.
+const TRACED_MAIN: &str = "ckb_trace_script_main";
+
+// ELF constants, only what is needed to read the symbol table.
+const SHT_SYMTAB: u32 = 2;
+const STT_FUNC: u8 = 2;
+const SECTION_HEADER_SIZE: usize = 64;
+const SYMBOL_SIZE: usize = 24;
+
+// Function symbols of a traced binary, sorted by address.
+struct Symbols(Vec<(u64, u64, String)>);
+
+impl Symbols {
+    fn load(path: &str) -> Symbols {
+        let elf = fs::read(path).expect("read symbol file");
+        let section_headers = LittleEndian::read_u64(&elf[0x28..]) as usize;
+        let sections = LittleEndian::read_u16(&elf[0x3c..]) as usize;
+        let section = |i: usize| &elf[section_headers + i * SECTION_HEADER_SIZE..];
+        let mut symbols = Vec::new();
+        for i in 0..sections {
+            let header = section(i);
+            if LittleEndian::read_u32(&header[4..]) != SHT_SYMTAB {
+                continue;
+            }
+            let offset = LittleEndian::read_u64(&header[0x18..]) as usize;
+            let size = LittleEndian::read_u64(&header[0x20..]) as usize;
+            let strtab = section(LittleEndian::read_u32(&header[0x28..]) as usize);
+            let strtab_offset = LittleEndian::read_u64(&strtab[0x18..]) as usize;
+            for symbol in elf[offset..offset + size].chunks(SYMBOL_SIZE) {
+                if symbol[4] & 0xf != STT_FUNC {
+                    continue;
+                }
+                let name_offset = strtab_offset + LittleEndian::read_u32(symbol) as usize;
+                let name_len = elf[name_offset..]
+                    .iter()
+                    .position(|b| *b == 0)
+                    .expect("symbol name");
+                let name = String::from_utf8_lossy(&elf[name_offset..name_offset + name_len]);
+                symbols.push((
+                    LittleEndian::read_u64(&symbol[8..]),
+                    LittleEndian::read_u64(&symbol[16..]),
+                    name.into_owned(),
+                ));
+            }
+        }
+        symbols.sort();
+        Symbols(symbols)
+    }
+
+    fn name(&self, address: u64) -> String {
+        let i = match self
+            .0
+            .binary_search_by_key(&address, |(start, _, _)| *start)
+        {
+            Ok(i) => i,
+            Err(0) => return format!("{:#x}", address),
+            Err(i) => i - 1,
+        };
+        let (start, size, name) = &self.0[i];
+        if address != *start && address >= start + size {
+            return format!("{:#x}", address);
+        }
+        if name.as_str() == TRACED_MAIN {
+            "main".to_string()
+        } else {
+            name.clone()
+        }
+    }
+}
+
+// A call stack printed by c/trace.h, frames are function and call site addresses.
+struct TraceLine {
+    frames: Vec<(u64, u64)>,
+    nanoseconds: u64,
+    calls: u64,
+}
+
+fn parse_trace_line(line: &str) -> Option<TraceLine> {
+    if !line.starts_with(TRACE_PREFIX) {
+        return None;
+    }
+    let mut parts = line[TRACE_PREFIX.len()..].split(' ');
+    let frames = parts
+        .next()?
+        .split(';')
+        .map(|frame| {
+            let mut addresses = frame.split('@');
+            let function = u64::from_str_radix(addresses.next()?, 16).ok()?;
+            let call_site = u64::from_str_radix(addresses.next()?, 16).ok()?;
+            Some((function, call_site))
+        })
+        .collect::<Option<Vec<_>>>()?;
+    let nanoseconds = parts.next()?.parse().ok()?;
+    let calls = parts.next()?.parse().ok()?;
+    Some(TraceLine {
+        frames,
+        nanoseconds,
+        calls,
+    })
+}
+
+fn trace(script: &str) {
+    let binary = format!("{}/{}", TRACE_DIR, script);
+    let replay_file = format!("{}/{}.bin", REPLAY_DIR, script);
+    if !Path::new(&binary).exists() || !Path::new(&replay_file).exists() {
+        println!(
+            "{}: {} or {} missing, run `make trace` and `make replay-files`",
+            script, binary, replay_file
+        );
+        return;
+    }
+    let symbols = Symbols::load(&binary);
+
+    let output = Command::new(&binary)
+        .env("CKB_REPLAY_FILE", &replay_file)
+        .output()
+        .expect("run traced script");
+    assert!(
+        output.status.success(),
+        "{} failed: {}",
+        script,
+        output.status
+    );
+    // ckb_debug prints to stderr in the replay builds.
+    let stderr = String::from_utf8_lossy(&output.stderr);
+    let lines: Vec<TraceLine> = stderr.lines().filter_map(parse_trace_line).collect();
+
+    let mut folded = BTreeMap::new();
+    let mut functions = BTreeMap::new();
+    // Cycles and calls per function and call site, callees included.
+    let mut sites: BTreeMap<(u64, u64), (u64, u64)> = BTreeMap::new();
+    let mut traced = 0;
+    for line in &lines {
+        let names: Vec<String> = line.frames.iter().map(|(f, _)| symbols.name(*f)).collect();
+        *folded.entry(names.join(";")).or_insert(0) += line.nanoseconds;
+        *functions.entry(names[names.len() - 1].clone()).or_insert(0) += line.nanoseconds;
+        for frame in &line.frames {
+            sites.entry(*frame).or_insert((0, 0)).0 += line.nanoseconds;
+        }
+        sites
+            .entry(line.frames[line.frames.len() - 1])
+            .or_insert((0, 0))
+            .1 += line.calls;
+        traced += line.nanoseconds;
+    }
+
+    // Source lines of the call sites, when binutils are around. A call site is the
+    // return address of the call, the byte before it is in the call instruction.
+    let call_sites: Vec<String> = sites
+        .keys()
+        .map(|(_, site)| format!("{:#x}", site - 1))
+        .collect();
+    let source_lines: Vec<String> = Command::new(ADDR2LINE)
+        .arg("-e")
+        .arg(&binary)
+        .args(&call_sites)
+        .output()
+        .ok()
+        .filter(|output| output.status.success())
+        .map(|output| {
+            String::from_utf8_lossy(&output.stdout)
+                .lines()
+                .map(|line| line.to_string())
+                .collect()
+        })
+        .filter(|lines: &Vec<String>| lines.len() == call_sites.len())
+        .unwrap_or_else(|| call_sites.clone());
+
+    fs::create_dir_all(OUTPUT_DIR).expect("create trace dir");
+    let folded_table: String = folded
+        .iter()
+        .map(|(stack, nanoseconds)| format!("{} {}\n", stack, nanoseconds))
+        .collect();
+    fs::write(format!("{}/{}.folded", OUTPUT_DIR, script), folded_table)
+        .expect("write folded stacks");
+    let mut sites_table = "function,call_site,calls,nanoseconds\n".to_string();
+    for (((function, _), (nanoseconds, calls)), source_line) in sites.iter().zip(&source_lines) {
+        sites_table.push_str(&format!(
+            "{},{},{},{}\n",
+            symbols.name(*function),
+            source_line,
+            calls,
+            nanoseconds
+        ));
+    }
+    fs::write(format!("{}/{}.sites.csv", OUTPUT_DIR, script), sites_table)
+        .expect("write call sites");
+
+    let mut functions: Vec<(String, u64)> = functions.into_iter().collect();
+    functions.sort_by(|a, b| b.1.cmp(&a.1));
+    println!("{}: {} ns traced, by function:", script, traced);
+    for (function, nanoseconds) in functions.iter().take(10) {
+        println!("  {:>10} {}", nanoseconds, function);
+    }
+}
+
+#[test]
+#[ignore]
+fn trace_cycles() {
+    for script in SCRIPTS {
+        trace(script);
+    }
+}
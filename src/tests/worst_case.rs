@@ -0,0 +1,534 @@
+//! Worst-case cycle search for the bundled scripts.
+//!
+//! The search is ignored in a normal `cargo test` run, use `make worst-case-cycles` to
+//! run it. Each script is verified against a grid of transaction shapes picked to be
+//! expensive for it: witnesses at exactly `MAX_WITNESS_SIZE`, many inputs in the lock
+//! group, unrelated cell deps in front of the secp256k1 data so it has to be scanned
+//! for, 255-of-255 multisig with every signature matching the last public key left in
+//! the scan, and DAO withdrawals with the most output cells and distinct deposit
+//! headers. The maximum found per script is printed at the end.
+//!
+//! Then invalid transactions are built for the error codes of each script, to show how
+//! cheaply they are rejected. A failing verification doesn't report its cycles, so they
+//! are found by bisecting the cycle limit: below the cost of the rejection, the
+//! verifier stops with `ExceededMaximumCycles` instead of the script error.
+//!
+//! All results are written as a CSV table to `target/worst_case.csv`, in the same
+//! format as `target/cycles.csv`. Like there, the DAO cases include the sighash lock
+//! group guarding the DAO inputs.
+
+use super::{
+    blake160,
+    cycles::{dao_withdraw_tx_with, max_extra_size, to_csv, Record, MAX_WITNESS_SIZE},
+    secp256k1_blake160_multisig_all::{
+        build_resolved_tx as build_multisig_resolved_tx, gen_multi_sign_script,
+        gen_multi_sign_script_with_mode, gen_tx_with_binaries as gen_multisig_tx_with_binaries,
+        generate_keys, multi_sign_tx, MULTISIG_MODE_ANY_ORDER, MULTISIG_MODE_SORTED,
+    },
+    secp256k1_blake160_sighash_all::{build_resolved_tx, gen_tx_with_binaries},
+    sign_tx_by_input_group, DummyDataLoader, MAX_CYCLES, MULTISIG_ALL_BIN, SECP256K1_DATA_BIN,
+    SIGHASH_ALL_BIN, SIGNATURE_SIZE,
+};
+use ckb_crypto::secp::{Generator, Privkey};
+use ckb_script::{ScriptError, TransactionScriptsVerifier};
+use ckb_types::{
+    bytes::Bytes,
+    core::{cell::ResolvedTransaction, Capacity, DepType, TransactionView},
+    packed::{CellDep, CellOutput, OutPoint, WitnessArgs},
+    prelude::*,
+};
+use rand::{rngs::SmallRng, Rng, SeedableRng};
+use std::fs;
+
+const OUTPUT_PATH: &str = "target/worst_case.csv";
+
+const SIGHASH_ALL: &str = "secp256k1_blake160_sighash_all";
+const MULTISIG_ALL: &str = "secp256k1_blake160_multisig_all";
+const DAO: &str = "dao";
+
+const SIGHASH_ALL_INPUTS: &[usize] = &[1, 16, 64, 256];
+const LEADING_CELL_DEPS: &[usize] = &[0, 16, 64, 256];
+const MULTISIG_ALL_MAX_PUBKEYS: usize = 255;
+// Outputs of the DAO script are limited to MAX_OUTPUT_LENGTH in c/dao.c, and each
+// withdrawing input comes with its own output here.
+const DAO_MAX_INPUTS: usize = 64;
+const DAO_SINCE: u64 = 0x2003e8022a0002f3;
+const DAO_OUTPUT_CAPACITY: u64 = 123468105678;
+// Cycle limit the failure cost bisection starts from, it is doubled until the script
+// error shows up.
+const BISECT_START_CYCLES: u64 = 1 << 20;
+
+// Error codes from the C sources
+const ERROR_ARGUMENTS_LEN: i8 = -1;
+const ERROR_ENCODING: i8 = -2;
+const ERROR_SECP_RECOVER_PUBKEY: i8 = -11;
+const ERROR_SECP_PARSE_SIGNATURE: i8 = -14;
+const ERROR_WITNESS_SIZE: i8 = -22;
+const ERROR_PUBKEY_BLAKE160_HASH: i8 = -31;
+const ERROR_INVALID_RESERVE_FIELD: i8 = -41;
+const ERROR_INVALID_PUBKEYS_CNT: i8 = -42;
+const ERROR_INVALID_THRESHOLD: i8 = -43;
+const ERROR_INVALID_REQUIRE_FIRST_N: i8 = -44;
+const ERROR_MULTSIG_SCRIPT_HASH: i8 = -51;
+const ERROR_VERIFICATION: i8 = -52;
+const DAO_ERROR_INCORRECT_CAPACITY: i8 = -15;
+const DAO_ERROR_INCORRECT_SINCE: i8 = -17;
+
+fn verify(data_loader: &DummyDataLoader, rtx: &ResolvedTransaction) -> u64 {
+    TransactionScriptsVerifier::new(rtx, data_loader)
+        .verify(MAX_CYCLES)
+        .expect("pass verification")
+}
+
+fn error_string(error: ScriptError) -> String {
+    Into::<ckb_error::Error>::into(error).to_string()
+}
+
+// Cycles spent on rejecting a transaction with `code`, see the module docs.
+fn failure_cycles(data_loader: &DummyDataLoader, rtx: &ResolvedTransaction, code: i8) -> u64 {
+    let expected = error_string(ScriptError::ValidationFailure(code));
+    let exceeded = error_string(ScriptError::ExceededMaximumCycles);
+    let rejected_within = |max_cycles| {
+        let error = TransactionScriptsVerifier::new(rtx, data_loader)
+            .verify(max_cycles)
+            .expect_err("invalid transaction passes verification")
+            .to_string();
+        if error == exceeded {
+            return false;
+        }
+        assert_eq!(error, expected, "unexpected error");
+        true
+    };
+    rejected_within(MAX_CYCLES);
+
+    let mut low = 0;
+    let mut high = BISECT_START_CYCLES;
+    while !rejected_within(high) {
+        low = high;
+        high *= 2;
+    }
+    while low + 1 < high {
+        let mid = low + (high - low) / 2;
+        if rejected_within(mid) {
+            high = mid;
+        } else {
+            low = mid;
+        }
+    }
+    high
+}
+
+// Puts `count` cell deps with unrelated data in front of the cell dep at `index`.
+fn insert_cell_deps(
+    data_loader: &mut DummyDataLoader,
+    tx: TransactionView,
+    index: usize,
+    count: usize,
+    rng: &mut SmallRng,
+) -> TransactionView {
+    let mut cell_deps: Vec<CellDep> = tx.cell_deps().into_iter().collect();
+    let extra_cell_deps = (0..count).map(|i| {
+        let out_point = {
+            let mut buf = [0u8; 32];
+            rng.fill(&mut buf);
+            OutPoint::new(buf.pack(), 0)
+        };
+        let data = Bytes::from((i as u64).to_le_bytes().to_vec());
+        let cell = CellOutput::new_builder()
+            .capacity(Capacity::bytes(data.len()).expect("capacity").pack())
+            .build();
+        data_loader.cells.insert(out_point.clone(), (cell, data));
+        CellDep::new_builder()
+            .out_point(out_point)
+            .dep_type(DepType::Code.into())
+            .build()
+    });
+    let tail = cell_deps.split_off(index);
+    cell_deps.extend(extra_cell_deps);
+    cell_deps.extend(tail);
+    tx.as_advanced_builder().set_cell_deps(cell_deps).build()
+}
+
+fn witness_with_extra(extra_size: usize) -> WitnessArgs {
+    WitnessArgs::new_builder()
+        .extra(Bytes::from(vec![0x42u8; extra_size]).pack())
+        .build()
+}
+
+// A sighash transaction with `inputs` inputs in one lock group, `leading_cell_deps`
+// cell deps between the lock code and the secp256k1 data, and an `extra` field of
+// `extra_size` bytes in every witness. `sign` signs the transaction, it is given the
+// key of the lock and the unsigned transaction.
+fn sighash_all_tx<F>(
+    inputs: usize,
+    leading_cell_deps: usize,
+    extra_size: usize,
+    sign: F,
+) -> (DummyDataLoader, ResolvedTransaction)
+where
+    F: FnOnce(&Privkey, TransactionView) -> TransactionView,
+{
+    let mut data_loader = DummyDataLoader::new();
+    let mut generator = Generator::non_crypto_safe_prng(42);
+    let mut rng = SmallRng::seed_from_u64(42);
+    let privkey = generator.gen_privkey();
+    let pubkey_hash = blake160(&privkey.pubkey().expect("pubkey").serialize());
+
+    let tx = gen_tx_with_binaries(
+        &mut data_loader,
+        vec![(pubkey_hash, inputs)],
+        &SIGHASH_ALL_BIN,
+        &SECP256K1_DATA_BIN,
+        &mut rng,
+    );
+    let tx = insert_cell_deps(&mut data_loader, tx, 1, leading_cell_deps, &mut rng);
+    let witnesses = (0..inputs)
+        .map(|_| witness_with_extra(extra_size).as_bytes().pack())
+        .collect();
+    let tx = tx.as_advanced_builder().set_witnesses(witnesses).build();
+    let tx = sign(&privkey, tx);
+    let rtx = build_resolved_tx(&data_loader, &tx);
+    (data_loader, rtx)
+}
+
+fn sign_sighash_all(inputs: usize) -> impl FnOnce(&Privkey, TransactionView) -> TransactionView {
+    move |privkey, tx| sign_tx_by_input_group(tx, privkey, 0, inputs)
+}
+
+// Replaces the first witness, for invalid transactions which don't get that far as
+// checking the signature.
+fn with_first_witness(witness: Bytes) -> impl FnOnce(&Privkey, TransactionView) -> TransactionView {
+    move |_, tx| {
+        let mut witnesses: Vec<_> = tx.witnesses().into_iter().collect();
+        witnesses[0] = witness.pack();
+        tx.as_advanced_builder().set_witnesses(witnesses).build()
+    }
+}
+
+fn with_lock(lock: Vec<u8>) -> impl FnOnce(&Privkey, TransactionView) -> TransactionView {
+    with_first_witness(
+        WitnessArgs::new_builder()
+            .lock(Bytes::from(lock).pack())
+            .build()
+            .as_bytes(),
+    )
+}
+
+fn search_sighash_all(records: &mut Vec<Record>) {
+    let max_extra = max_extra_size();
+    for &inputs in SIGHASH_ALL_INPUTS {
+        for &leading_cell_deps in LEADING_CELL_DEPS {
+            let (data_loader, rtx) = sighash_all_tx(
+                inputs,
+                leading_cell_deps,
+                max_extra,
+                sign_sighash_all(inputs),
+            );
+            records.push(Record::new(
+                SIGHASH_ALL,
+                "max_witnesses",
+                format!("{}-inputs-{}-leading-cell-deps", inputs, leading_cell_deps),
+                verify(&data_loader, &rtx),
+            ));
+        }
+    }
+
+    let mut failures = Vec::new();
+    let (data_loader, rtx) = {
+        let mut data_loader = DummyDataLoader::new();
+        let mut rng = SmallRng::seed_from_u64(42);
+        let tx = gen_tx_with_binaries(
+            &mut data_loader,
+            vec![(Bytes::from(vec![0u8; 21]), 1)],
+            &SIGHASH_ALL_BIN,
+            &SECP256K1_DATA_BIN,
+            &mut rng,
+        );
+        let rtx = build_resolved_tx(&data_loader, &tx);
+        (data_loader, rtx)
+    };
+    failures.push(("ERROR_ARGUMENTS_LEN", ERROR_ARGUMENTS_LEN, data_loader, rtx));
+    let (data_loader, rtx) =
+        sighash_all_tx(1, 0, 0, with_first_witness(Bytes::from(vec![0xffu8; 64])));
+    failures.push(("ERROR_ENCODING", ERROR_ENCODING, data_loader, rtx));
+    let (data_loader, rtx) = sighash_all_tx(1, 0, max_extra + 1, sign_sighash_all(1));
+    failures.push(("ERROR_WITNESS_SIZE", ERROR_WITNESS_SIZE, data_loader, rtx));
+    // An overflowing r value, with a valid recovery ID so the signature reaches the
+    // parser instead of the illegal argument callback.
+    let mut overflowing_signature = vec![0xffu8; SIGNATURE_SIZE];
+    overflowing_signature[SIGNATURE_SIZE - 1] = 0;
+    let (data_loader, rtx) = sighash_all_tx(1, 0, 0, with_lock(overflowing_signature));
+    failures.push((
+        "ERROR_SECP_PARSE_SIGNATURE",
+        ERROR_SECP_PARSE_SIGNATURE,
+        data_loader,
+        rtx,
+    ));
+    let (data_loader, rtx) = sighash_all_tx(1, 0, 0, with_lock(vec![0u8; SIGNATURE_SIZE]));
+    failures.push((
+        "ERROR_SECP_RECOVER_PUBKEY",
+        ERROR_SECP_RECOVER_PUBKEY,
+        data_loader,
+        rtx,
+    ));
+    // The most expensive rejection: everything is hashed and recovered before the
+    // public key turns out to be a different one.
+    let (data_loader, rtx) = sighash_all_tx(256, 256, max_extra, |_, tx| {
+        sign_tx_by_input_group(tx, &Generator::random_privkey(), 0, 256)
+    });
+    failures.push((
+        "ERROR_PUBKEY_BLAKE160_HASH",
+        ERROR_PUBKEY_BLAKE160_HASH,
+        data_loader,
+        rtx,
+    ));
+
+    push_failures(records, SIGHASH_ALL, failures);
+}
+
+// A multisig transaction for the multisig script of `keys` in `mode`, the first
+// witness has an `extra` field of `extra_size` bytes and is signed by `signers`, in
+// order.
+fn multisig_all_tx(
+    keys: &[Privkey],
+    mode: u8,
+    threshold: usize,
+    require_first_n: u8,
+    signers: &[&Privkey],
+    extra_size: usize,
+) -> (DummyDataLoader, ResolvedTransaction) {
+    let mut data_loader = DummyDataLoader::new();
+    let multi_sign_script =
+        gen_multi_sign_script_with_mode(keys, mode, threshold as u8, require_first_n);
+    let args = blake160(&multi_sign_script);
+    let tx = gen_multisig_tx_with_binaries(
+        &mut data_loader,
+        args,
+        0,
+        &MULTISIG_ALL_BIN,
+        &SECP256K1_DATA_BIN,
+    );
+    let tx = tx
+        .as_advanced_builder()
+        .set_witnesses(vec![witness_with_extra(extra_size).as_bytes().pack()])
+        .build();
+    let tx = multi_sign_tx(tx, &multi_sign_script, signers);
+    let rtx = build_multisig_resolved_tx(&data_loader, &tx);
+    (data_loader, rtx)
+}
+
+// A multisig transaction whose first witness holds `lock` as it is.
+fn multisig_all_tx_with_lock(
+    keys: &[Privkey],
+    lock: Vec<u8>,
+) -> (DummyDataLoader, ResolvedTransaction) {
+    let mut data_loader = DummyDataLoader::new();
+    let args = blake160(&gen_multi_sign_script(keys, 1, 0));
+    let tx = gen_multisig_tx_with_binaries(
+        &mut data_loader,
+        args,
+        0,
+        &MULTISIG_ALL_BIN,
+        &SECP256K1_DATA_BIN,
+    );
+    let witness = WitnessArgs::new_builder()
+        .lock(Bytes::from(lock).pack())
+        .build();
+    let tx = tx
+        .as_advanced_builder()
+        .set_witnesses(vec![witness.as_bytes().pack()])
+        .build();
+    let rtx = build_multisig_resolved_tx(&data_loader, &tx);
+    (data_loader, rtx)
+}
+
+// Size of the `extra` field which makes a signed multisig witness exactly
+// MAX_WITNESS_SIZE bytes long.
+fn multisig_max_extra_size(pubkeys_cnt: usize, threshold: usize) -> usize {
+    let lock_len = 4 + 20 * pubkeys_cnt + SIGNATURE_SIZE * threshold;
+    let witness = WitnessArgs::new_builder()
+        .lock(Bytes::from(vec![0u8; lock_len]).pack())
+        .extra(Bytes::new().pack())
+        .build();
+    MAX_WITNESS_SIZE - witness.as_bytes().len()
+}
+
+fn search_multisig_all(records: &mut Vec<Record>) {
+    let keys = generate_keys(MULTISIG_ALL_MAX_PUBKEYS);
+    let n = keys.len();
+    let in_order: Vec<&Privkey> = keys.iter().collect();
+    // Each signature matches the last public key left unused, so the scan of every
+    // signature runs over all the remaining public keys.
+    let reversed: Vec<&Privkey> = keys.iter().rev().collect();
+    // In sorted mode, signatures can only come in public key order, and the forward
+    // pass reads every public key once however the signers are picked.
+    let any = MULTISIG_MODE_ANY_ORDER;
+    let sorted = MULTISIG_MODE_SORTED;
+    let cases: Vec<(&'static str, u8, usize, &[&Privkey])> = vec![
+        ("in_order", any, 1, &in_order[..1]),
+        ("last_key", any, 1, &reversed[..1]),
+        ("in_order", any, n, &in_order[..]),
+        ("reversed", any, n, &reversed[..]),
+        ("sorted_last_key", sorted, 1, &reversed[..1]),
+        ("sorted", sorted, n, &in_order[..]),
+    ];
+    for (case, mode, threshold, signers) in cases {
+        let extra_size = multisig_max_extra_size(n, threshold);
+        let (data_loader, rtx) = multisig_all_tx(&keys, mode, threshold, 0, signers, extra_size);
+        records.push(Record::new(
+            MULTISIG_ALL,
+            case,
+            format!("{}-of-{}", threshold, n),
+            verify(&data_loader, &rtx),
+        ));
+    }
+
+    let mut failures = Vec::new();
+    let (data_loader, rtx) = multisig_all_tx_with_lock(&keys, vec![2, 0, 1, 1]);
+    failures.push((
+        "ERROR_INVALID_RESERVE_FIELD",
+        ERROR_INVALID_RESERVE_FIELD,
+        data_loader,
+        rtx,
+    ));
+    let (data_loader, rtx) = multisig_all_tx_with_lock(&keys, vec![0, 0, 1, 0]);
+    failures.push((
+        "ERROR_INVALID_PUBKEYS_CNT",
+        ERROR_INVALID_PUBKEYS_CNT,
+        data_loader,
+        rtx,
+    ));
+    let (data_loader, rtx) = multisig_all_tx_with_lock(&keys, vec![0, 0, 2, 1]);
+    failures.push((
+        "ERROR_INVALID_THRESHOLD",
+        ERROR_INVALID_THRESHOLD,
+        data_loader,
+        rtx,
+    ));
+    let (data_loader, rtx) = multisig_all_tx_with_lock(&keys, vec![0, 2, 1, 1]);
+    failures.push((
+        "ERROR_INVALID_REQUIRE_FIRST_N",
+        ERROR_INVALID_REQUIRE_FIRST_N,
+        data_loader,
+        rtx,
+    ));
+    let (data_loader, rtx) = multisig_all_tx_with_lock(&keys, vec![0, 0, 1, 1]);
+    failures.push(("ERROR_WITNESS_SIZE", ERROR_WITNESS_SIZE, data_loader, rtx));
+    // The multisig script in the witness is hashed before it is found to be another
+    // one than the script args commit to.
+    let mut other_script = gen_multi_sign_script(&keys, n as u8, 0).to_vec();
+    other_script[4] ^= 1;
+    other_script.resize(other_script.len() + SIGNATURE_SIZE * n, 0);
+    let (data_loader, rtx) = multisig_all_tx_with_lock(&keys, other_script);
+    failures.push((
+        "ERROR_MULTSIG_SCRIPT_HASH",
+        ERROR_MULTSIG_SCRIPT_HASH,
+        data_loader,
+        rtx,
+    ));
+    // The most expensive rejection: all signatures are recovered, and only the last one
+    // is found to be from a key outside of the multisig script.
+    let stranger = Generator::random_privkey();
+    let mut signers = reversed.clone();
+    signers[n - 1] = &stranger;
+    let extra_size = multisig_max_extra_size(n, n);
+    let (data_loader, rtx) = multisig_all_tx(&keys, any, n, 0, &signers, extra_size);
+    failures.push(("ERROR_VERIFICATION", ERROR_VERIFICATION, data_loader, rtx));
+
+    push_failures(records, MULTISIG_ALL, failures);
+}
+
+fn search_dao(records: &mut Vec<Record>) {
+    for &deposit_headers in &[1, DAO_MAX_INPUTS] {
+        let (data_loader, rtx) = dao_withdraw_tx_with(
+            DAO_MAX_INPUTS,
+            deposit_headers,
+            DAO_SINCE,
+            DAO_OUTPUT_CAPACITY,
+        );
+        records.push(Record::new(
+            DAO,
+            "withdraw",
+            format!(
+                "{}-inputs-{}-deposit-headers",
+                DAO_MAX_INPUTS, deposit_headers
+            ),
+            verify(&data_loader, &rtx),
+        ));
+    }
+
+    let mut failures = Vec::new();
+    let (data_loader, rtx) =
+        dao_withdraw_tx_with(DAO_MAX_INPUTS, DAO_MAX_INPUTS, 0, DAO_OUTPUT_CAPACITY);
+    failures.push((
+        "ERROR_INCORRECT_SINCE",
+        DAO_ERROR_INCORRECT_SINCE,
+        data_loader,
+        rtx,
+    ));
+    // All inputs are processed before the capacities are compared.
+    let (data_loader, rtx) = dao_withdraw_tx_with(
+        DAO_MAX_INPUTS,
+        DAO_MAX_INPUTS,
+        DAO_SINCE,
+        DAO_OUTPUT_CAPACITY + 1,
+    );
+    failures.push((
+        "ERROR_INCORRECT_CAPACITY",
+        DAO_ERROR_INCORRECT_CAPACITY,
+        data_loader,
+        rtx,
+    ));
+
+    push_failures(records, DAO, failures);
+}
+
+fn push_failures(
+    records: &mut Vec<Record>,
+    script: &'static str,
+    failures: Vec<(&'static str, i8, DummyDataLoader, ResolvedTransaction)>,
+) {
+    for (name, code, data_loader, rtx) in failures {
+        records.push(Record::new(
+            script,
+            "error",
+            format!("{}({})", name, code),
+            failure_cycles(&data_loader, &rtx, code),
+        ));
+    }
+}
+
+#[test]
+#[ignore]
+fn worst_case_cycles() {
+    let mut records = Vec::new();
+    search_sighash_all(&mut records);
+    search_multisig_all(&mut records);
+    search_dao(&mut records);
+
+    for record in &records {
+        println!(
+            "{},{},{}: {}",
+            record.script, record.case, record.param, record.cycles
+        );
+    }
+    for &script in &[SIGHASH_ALL, MULTISIG_ALL, DAO] {
+        let valid = records
+            .iter()
+            .filter(|record| record.script == script && record.case != "error")
+            .max_by_key(|record| record.cycles);
+        let rejected = records
+            .iter()
+            .filter(|record| record.script == script && record.case == "error")
+            .max_by_key(|record| record.cycles);
+        if let (Some(valid), Some(rejected)) = (valid, rejected) {
+            println!(
+                "{}: at most {} cycles ({} {}), at most {} cycles to reject ({})",
+                script, valid.cycles, valid.case, valid.param, rejected.cycles, rejected.param
+            );
+        }
+    }
+
+    fs::create_dir_all("target").expect("create target dir");
+    fs::write(OUTPUT_PATH, to_csv(&records)).expect("write worst case table");
+}